@@ -0,0 +1,399 @@
+/**************************************************************************
+ *   edp_bench.cpp                                                        *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+/*
+ * Micro benchmarks for the performance critical parts of EDP.
+ *
+ * Usage: edp_bench parse [number of values]
+ *        edp_bench interp [number of samples]
+ *        edp_bench layout [grid dimension]
+ *        edp_bench color [number of pixels]
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include "float_parser.h"
+#include "trilinear.h"
+#include "tricubic.h"
+#include "brick_layout.h"
+#include "color_map.h"
+
+/*
+ * Build a text buffer in the VASP CHGCAR layout (five values per line,
+ * written as 1X,E17.11 which drops the leading zero of negative numbers)
+ */
+static std::string make_vasp_text(size_t n) {
+    std::string text;
+    text.reserve(n * 18 + n / 5 + 1);
+    char buf[32];
+    unsigned int seed = 12345;
+    for(size_t i=0; i<n; i++) {
+        seed = seed * 1103515245 + 12345;
+        double val = double(seed % 1000000) / 1000.0 - 100.0;
+        // VASP writes a mantissa in [0.1,1)
+        int e = 0;
+        double m = val < 0 ? -val : val;
+        while(m >= 1.0) { m /= 10.0; e++; }
+        while(m > 0 && m < 0.1) { m *= 10.0; e--; }
+        snprintf(buf, sizeof(buf), " %s.%011.0fE%+03d", val < 0 ? "-" : "0", m * 1e11, e);
+        text += buf;
+        if(i % 5 == 4) {
+            text += '\n';
+        }
+    }
+    text += '\n';
+    return text;
+}
+
+static double seconds_since(const std::chrono::steady_clock::time_point &start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void report(const std::string &name, size_t bytes, size_t values, double t) {
+    if(bytes == 0) {
+        printf("%-24s %8.3f s %10.2f Msamples/s\n", name.c_str(), t, double(values) / t / 1e6);
+        return;
+    }
+    printf("%-24s %8.3f s %10.1f MiB/s %10.2f Mvalues/s\n", name.c_str(), t,
+           double(bytes) / t / (1024.0 * 1024.0), double(values) / t / 1e6);
+}
+
+/*
+ * Parse throughput of the grid tokenizer versus a plain strtod() loop
+ */
+static int bench_parse(size_t n) {
+    std::string text = make_vasp_text(n);
+    std::vector<float> ref(n), out(n);
+    const char* begin = text.data();
+    const char* end = begin + text.size();
+
+    // reference: tokenize on whitespace and convert via strtod
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const char* p = begin;
+    size_t cnt = 0;
+    while(cnt < n) {
+        char* stop;
+        ref[cnt++] = (float)strtod(p, &stop);
+        p = stop;
+    }
+    report("strtod", text.size(), n, seconds_since(start));
+
+    start = std::chrono::steady_clock::now();
+    p = begin;
+    size_t got = FloatParser::parse_range(p, end, &out[0], n);
+    report("FloatParser", text.size(), n, seconds_since(start));
+
+    if(got != n || memcmp(&ref[0], &out[0], n * sizeof(float)) != 0) {
+        std::cerr << "ERROR: parsed values differ from strtod()" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Samples per second (on a single core) of every trilinear and tricubic
+ * kernel the processor supports, on random points in a 128^3 grid
+ */
+static int bench_interp(size_t n) {
+    const unsigned int dim = 128;
+    std::vector<float> grid(dim * dim * dim);
+    unsigned int seed = 12345;
+    for(size_t i=0; i<grid.size(); i++) {
+        seed = seed * 1103515245 + 12345;
+        grid[i] = float(seed % 100000) / 1000.0f;
+    }
+
+    std::vector<uint32_t> base(n);
+    std::vector<int32_t> ox(n), oy(n), oz(n);
+    std::vector<float> fx(n), fy(n), fz(n);
+    for(size_t i=0; i<n; i++) {
+        unsigned int c[3];
+        float f[3];
+        for(unsigned int a=0; a<3; a++) {
+            seed = seed * 1103515245 + 12345;
+            c[a] = (seed >> 8) % dim;
+            f[a] = (c[a] == dim - 1) ? 0.0f : float((seed >> 4) % 1024) / 1024.0f;
+        }
+        base[i] = (c[2] * dim + c[1]) * dim + c[0];
+        ox[i] = (c[0] + 1 < dim) ? 1 : 0;
+        oy[i] = (c[1] + 1 < dim) ? dim : 0;
+        oz[i] = (c[2] + 1 < dim) ? dim * dim : 0;
+        fx[i] = f[0];
+        fy[i] = f[1];
+        fz[i] = f[2];
+    }
+    const Trilinear::Points points = {&base[0], &ox[0], &oy[0], &oz[0], &fx[0], &fy[0], &fz[0]};
+
+    const Trilinear::Kernel kernels[3] = {Trilinear::KERNEL_SCALAR, Trilinear::KERNEL_AVX2,
+                                          Trilinear::KERNEL_AVX512};
+    const Trilinear::Kernel selected = Trilinear::get_kernel();
+    std::vector<float> ref(n), out(n);
+    int ret = 0;
+    for(unsigned int k=0; k<3; k++) {
+        if(!Trilinear::set_kernel(kernels[k])) {
+            printf("%-24s not supported\n", Trilinear::get_name(kernels[k]));
+            continue;
+        }
+        std::vector<float> &dest = (k == 0) ? ref : out;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        Trilinear::interpolate(&grid[0], points, n, &dest[0]);
+        report(std::string("trilinear ") + Trilinear::get_name(kernels[k]), 0, n, seconds_since(start));
+
+        if(k > 0 && memcmp(&ref[0], &out[0], n * sizeof(float)) != 0) {
+            std::cerr << "ERROR: " << Trilinear::get_name(kernels[k])
+                      << " kernel differs from the scalar kernel" << std::endl;
+            ret = 1;
+        }
+    }
+
+    // the same points with the 4x4x4 taps of the tricubic kernels, held
+    // away from the faces
+    std::vector<int32_t> taps(12 * n);
+    for(size_t i=0; i<n; i++) {
+        unsigned int c[3] = {base[i] % dim, base[i] / dim % dim, base[i] / (dim * dim)};
+        const uint32_t stride[3] = {1, dim, dim * dim};
+        for(unsigned int a=0; a<3; a++) {
+            c[a] = std::min(std::max(c[a], 1u), dim - 3);
+            for(unsigned int t=0; t<4; t++) {
+                taps[(4 * a + t) * n + i] = (int32_t(t) - 1) * int32_t(stride[a]);
+            }
+        }
+        base[i] = (c[2] * dim + c[1]) * dim + c[0];
+    }
+    const Tricubic::Points cubic = {&base[0],
+                                    {&taps[0], &taps[n], &taps[2 * n], &taps[3 * n]},
+                                    {&taps[4 * n], &taps[5 * n], &taps[6 * n], &taps[7 * n]},
+                                    {&taps[8 * n], &taps[9 * n], &taps[10 * n], &taps[11 * n]},
+                                    &fx[0], &fy[0], &fz[0]};
+    for(unsigned int k=0; k<3; k++) {
+        if(!Trilinear::set_kernel(kernels[k])) {
+            continue;
+        }
+        std::vector<float> &dest = (k == 0) ? ref : out;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        Tricubic::interpolate(&grid[0], cubic, n, &dest[0]);
+        report(std::string("tricubic ") + Trilinear::get_name(kernels[k]), 0, n, seconds_since(start));
+
+        if(k > 0 && memcmp(&ref[0], &out[0], n * sizeof(float)) != 0) {
+            std::cerr << "ERROR: " << Trilinear::get_name(kernels[k])
+                      << " tricubic kernel differs from the scalar kernel" << std::endl;
+            ret = 1;
+        }
+    }
+
+    // the B-spline prefilter that precedes tricubic interpolation
+    const unsigned int dims[3] = {dim, dim, dim};
+    const bool periodic[3] = {true, true, true};
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Tricubic::prefilter(&grid[0], dims, periodic, NULL);
+    report("prefilter", grid.size() * sizeof(float), grid.size(), seconds_since(start));
+    Trilinear::set_kernel(selected);
+    return ret;
+}
+
+/*
+ * Interpolate a square plane through the center of a dim^3 grid, row by
+ * row as ScalarField::sample_row() does, with the grid in plain k-major
+ * order (bricks == NULL) or in bricked order. The plane is spanned by the
+ * unit vectors u and v (in grid coordinates) with a step of half a grid
+ * spacing.
+ */
+static void sample_plane(const float* grid, unsigned int dim, const BrickLayout* bricks,
+                         const double u[3], const double v[3], unsigned int width,
+                         std::vector<float> &out) {
+    const unsigned int chunk = 256;
+    uint32_t base[chunk];
+    int32_t ox[chunk], oy[chunk], oz[chunk];
+    float fx[chunk], fy[chunk], fz[chunk];
+    const Trilinear::Points points = {base, ox, oy, oz, fx, fy, fz};
+
+    out.resize(size_t(width) * width);
+    const double step = 0.5;
+    const double c = 0.5 * double(dim - 1);
+    for(unsigned int j=0; j<width; j++) {
+        const double b = (double(j) - 0.5 * width) * step;
+        for(unsigned int i0=0; i0<width; i0+=chunk) {
+            const unsigned int m = std::min(chunk, width - i0);
+            for(unsigned int t=0; t<m; t++) {
+                const double a = (double(i0 + t) - 0.5 * width) * step;
+                const double r[3] = {c + a * u[0] + b * v[0], c + a * u[1] + b * v[1], c + a * u[2] + b * v[2]};
+                unsigned int p[3];
+                float f[3];
+                for(unsigned int d=0; d<3; d++) {
+                    p[d] = std::min((unsigned int)r[d], dim - 2);
+                    f[d] = float(r[d] - p[d]);
+                }
+                fx[t] = f[0];
+                fy[t] = f[1];
+                fz[t] = f[2];
+                if(bricks != NULL) {
+                    base[t] = bricks->get_index(p[0], p[1], p[2]);
+                    ox[t] = int32_t(bricks->get_offset(0, p[0] + 1) - bricks->get_offset(0, p[0]));
+                    oy[t] = int32_t(bricks->get_offset(1, p[1] + 1) - bricks->get_offset(1, p[1]));
+                    oz[t] = int32_t(bricks->get_offset(2, p[2] + 1) - bricks->get_offset(2, p[2]));
+                } else {
+                    base[t] = (p[2] * dim + p[1]) * dim + p[0];
+                    ox[t] = 1;
+                    oy[t] = int32_t(dim);
+                    oz[t] = int32_t(dim * dim);
+                }
+            }
+            Trilinear::interpolate(grid, points, m, &out[size_t(j) * width + i0]);
+        }
+    }
+}
+
+/*
+ * Samples per second of planes through a dim^3 grid in plain and in
+ * bricked order, for a plane of constant z and for a plane oblique to the
+ * lattice, with the fastest trilinear kernel
+ */
+static int bench_layout(unsigned int dim) {
+    std::vector<float> grid(size_t(dim) * dim * dim);
+    unsigned int seed = 12345;
+    for(size_t i=0; i<grid.size(); i++) {
+        seed = seed * 1103515245 + 12345;
+        grid[i] = float(seed % 100000) / 1000.0f;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const unsigned int dims[3] = {dim, dim, dim};
+    BrickLayout bricks(dims);
+    std::vector<float> bricked(bricks.get_size());
+    bricks.arrange(&grid[0], &bricked[0], 1);
+    report("arrange bricks", grid.size() * sizeof(float), grid.size(), seconds_since(start));
+
+    // plane of constant z, and a plane whose rows run across all axes
+    const double planes[2][2][3] = {
+        {{1.0, 0.0, 0.0}, {0.0, 1.0, 0.0}},
+        {{2.0 / 3.0, -1.0 / 3.0, 2.0 / 3.0}, {-1.0 / 3.0, 2.0 / 3.0, 2.0 / 3.0}}
+    };
+    const char* names[2] = {"axis-aligned", "oblique"};
+
+    // the plane stays inside the grid: |a u_i + b v_i| <= r (|u_i| + |v_i|)
+    const double radius = (0.5 * double(dim) - 2.0) / (4.0 / 3.0);
+    const unsigned int width = (unsigned int)(2.0 * radius / 0.5);
+
+    int ret = 0;
+    std::vector<float> linear, blocked;
+    for(unsigned int p=0; p<2; p++) {
+        start = std::chrono::steady_clock::now();
+        sample_plane(&grid[0], dim, NULL, planes[p][0], planes[p][1], width, linear);
+        report(std::string(names[p]) + " linear", 0, linear.size(), seconds_since(start));
+
+        start = std::chrono::steady_clock::now();
+        sample_plane(&bricked[0], dim, &bricks, planes[p][0], planes[p][1], width, blocked);
+        report(std::string(names[p]) + " brick", 0, blocked.size(), seconds_since(start));
+
+        if(memcmp(&linear[0], &blocked[0], linear.size() * sizeof(float)) != 0) {
+            std::cerr << "ERROR: bricked grid gives other values than the linear grid" << std::endl;
+            ret = 1;
+        }
+    }
+    return ret;
+}
+
+/*
+ * Pixels per second (on a single core) of the logarithmic scale and the
+ * color table lookup for every kernel the processor supports, versus
+ * log10() of the C library, on densities spread over eight decades
+ */
+static int bench_color(size_t n) {
+    std::vector<float> values(n);
+    unsigned int seed = 12345;
+    for(size_t i=0; i<n; i++) {
+        seed = seed * 1103515245 + 12345;
+        values[i] = std::pow(10.0f, float(seed >> 8) / float(1 << 24) * 8.0f - 4.0f);
+    }
+
+    std::vector<float> logs(n);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(size_t i=0; i<n; i++) {
+        logs[i] = log10(values[i]);
+    }
+    report("log10 libm", 0, n, seconds_since(start));
+
+    // a gray scale over the range of the logarithms
+    std::vector<uint32_t> colors(4096);
+    for(unsigned int i=0; i<colors.size(); i++) {
+        colors[i] = 0xFF000000u | (i >> 4) * 0x010101u;
+    }
+    const ColorMap::Table table = {&colors[0], 4096, -4.0f, 4095.0f / 8.0f};
+
+    const Trilinear::Kernel kernels[3] = {Trilinear::KERNEL_SCALAR, Trilinear::KERNEL_AVX2,
+                                          Trilinear::KERNEL_AVX512};
+    const Trilinear::Kernel selected = Trilinear::get_kernel();
+    std::vector<float> ref(n), out(n);
+    std::vector<uint32_t> ref_pixels(n), pixels(n);
+    int ret = 0;
+    for(unsigned int k=0; k<3; k++) {
+        if(!Trilinear::set_kernel(kernels[k])) {
+            printf("%-24s not supported\n", Trilinear::get_name(kernels[k]));
+            continue;
+        }
+        std::vector<float> &dest = (k == 0) ? ref : out;
+        start = std::chrono::steady_clock::now();
+        ColorMap::log_scale(&values[0], n, false, &dest[0]);
+        report(std::string("log_scale ") + Trilinear::get_name(kernels[k]), 0, n, seconds_since(start));
+
+        std::vector<uint32_t> &dest_pixels = (k == 0) ? ref_pixels : pixels;
+        start = std::chrono::steady_clock::now();
+        ColorMap::lookup(table, &ref[0], n, &dest_pixels[0]);
+        report(std::string("lookup ") + Trilinear::get_name(kernels[k]), 0, n, seconds_since(start));
+
+        if(k > 0 && (memcmp(&ref[0], &out[0], n * sizeof(float)) != 0 ||
+                     memcmp(&ref_pixels[0], &pixels[0], n * sizeof(uint32_t)) != 0)) {
+            std::cerr << "ERROR: " << Trilinear::get_name(kernels[k])
+                      << " color kernels differ from the scalar kernels" << std::endl;
+            ret = 1;
+        }
+    }
+    Trilinear::set_kernel(selected);
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    std::string mode = argc > 1 ? argv[1] : "parse";
+    size_t n = argc > 2 ? strtoul(argv[2], NULL, 10) :
+               (mode == "interp" || mode == "color" ? 4000000 : (mode == "layout" ? 320 : 20000000));
+
+    if(mode == "parse") {
+        return bench_parse(n);
+    }
+    if(mode == "interp") {
+        return bench_interp(n);
+    }
+    if(mode == "layout") {
+        return bench_layout((unsigned int)n);
+    }
+    if(mode == "color") {
+        return bench_color(n);
+    }
+
+    std::cerr << "Usage: " << argv[0] << " parse|interp|layout|color [values]" << std::endl;
+    return 1;
+}
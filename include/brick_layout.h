@@ -0,0 +1,73 @@
+/**************************************************************************
+ *   brick_layout.h                                                       *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#ifndef _BRICK_LAYOUT_H
+#define _BRICK_LAYOUT_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+/*
+ * Cache blocked order of the grid of a ScalarField
+ *
+ * The grid is cut into bricks of 8x8x8 points (2 KiB of floats). Bricks
+ * follow each other x fastest, as do the points inside a brick. The eight
+ * corners of a cell then lie in at most eight bricks, close together,
+ * whatever the direction of the plane that is sampled, whereas a plain
+ * k-major array spreads them over two slabs of the grid.
+ *
+ * The position of a point in the bricked array is the sum of a term for
+ * each coordinate, which get_offset() looks up. Offsets between corners
+ * therefore take the same form as in a plain array and the trilinear
+ * kernels address both layouts alike. Partial bricks at the far faces are
+ * padded.
+ */
+class BrickLayout {
+private:
+    static const unsigned int brick_bits = 3;  // bricks of 8x8x8 points
+
+    unsigned int dims[3];
+    size_t size;                        // points including the padding
+    std::vector<uint32_t> offsets[3];   // term of every coordinate along each axis
+
+public:
+    BrickLayout(const unsigned int _dims[3]);
+
+    void arrange(const float* grid, float* bricked, unsigned int nthreads) const;
+
+    size_t get_size() const;
+    uint32_t get_offset(unsigned int dim, unsigned int i) const;
+    uint32_t get_index(unsigned int i, unsigned int j, unsigned int k) const;
+
+private:
+    void arrange_layers(const float* grid, float* bricked, unsigned int kbegin, unsigned int kend) const;
+};
+
+inline uint32_t BrickLayout::get_offset(unsigned int dim, unsigned int i) const {
+    return this->offsets[dim][i];
+}
+
+inline uint32_t BrickLayout::get_index(unsigned int i, unsigned int j, unsigned int k) const {
+    return this->offsets[0][i] + this->offsets[1][j] + this->offsets[2][k];
+}
+
+#endif //_BRICK_LAYOUT_H
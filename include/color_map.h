@@ -0,0 +1,75 @@
+/**************************************************************************
+ *   color_map.h                                                          *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#ifndef _COLOR_MAP_H
+#define _COLOR_MAP_H
+
+#include <cstddef>
+#include <stdint.h>
+
+/*
+ * Color mapping kernels
+ *
+ * log_scale() puts the values of the plane on the logarithmic scale of
+ * the color scheme: log10(v), or for fields with negative values
+ * sign(v)*log10(|v|) beyond +-10 and v/10 in between. The logarithm is
+ * the Cephes single precision polynomial on the mantissa, accurate to
+ * about one ulp, evaluated by fused multiply-adds; the scalar code is
+ * built for the FMA instructions as in Trilinear. Processors without FMA
+ * (which have no vector kernels either) take log10f() of libm instead,
+ * as the polynomial would call fmaf() of libm for every step; its results
+ * may then differ from those of the polynomial by about an ulp.
+ *
+ * lookup() turns values into pixels by a table of packed ARGB32 colors
+ * that samples the color scheme at equal steps; a value takes the
+ * nearest entry and values outside the table take its first or last one.
+ *
+ * Both follow the kernel choice of Trilinear (scalar, AVX2 or AVX-512)
+ * and give bit-identical results for every kernel (with FMA).
+ *
+ * Usage: ColorMap::log_scale(values, n, negative_values, out);
+ *        ColorMap::lookup(table, values, n, pixels);
+ */
+class ColorMap {
+public:
+    struct Table {
+        const uint32_t* colors; // packed ARGB32 colors
+        unsigned int size;      // number of colors
+        float low;              // value of the first color
+        float scale;            // colors per unit of value
+    };
+
+public:
+    static void log_scale(const float* in, size_t n, bool negative_values, float* out);
+    static void lookup(const Table &t, const float* in, size_t n, uint32_t* out);
+    static float log10(float x);
+
+private:
+    static void log_scale_scalar(const float* in, size_t begin, size_t end, bool negative_values, float* out);
+    static void log_scale_scalar_fma(const float* in, size_t begin, size_t end, bool negative_values, float* out);
+    static void log_scale_avx2(const float* in, size_t n, bool negative_values, float* out);
+    static void log_scale_avx512(const float* in, size_t n, bool negative_values, float* out);
+    static void lookup_scalar(const Table &t, const float* in, size_t begin, size_t end, uint32_t* out);
+    static void lookup_avx2(const Table &t, const float* in, size_t n, uint32_t* out);
+    static void lookup_avx512(const Table &t, const float* in, size_t n, uint32_t* out);
+};
+
+#endif //_COLOR_MAP_H
@@ -0,0 +1,112 @@
+/**************************************************************************
+ *   compressed_stream.h                                                  *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#ifndef _COMPRESSED_STREAM_H
+#define _COMPRESSED_STREAM_H
+
+#include <cstdio>
+#include <deque>
+#include <istream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+
+/*
+ * Stream buffer that decompresses a gzip or xz file on a background thread
+ *
+ * The worker thread reads and inflates the file into chunks that are
+ * handed over through a bounded queue, so decompression of the next chunks
+ * overlaps with parsing of the current one.
+ */
+class CompressedStreambuf : public std::streambuf {
+public:
+    enum Codec {
+        CODEC_NONE,
+        CODEC_GZIP,
+        CODEC_XZ
+    };
+
+private:
+    Codec codec;
+    FILE* file;
+    std::thread worker;
+
+    std::mutex mtx;
+    std::condition_variable cv_filled;      // a chunk was queued or the worker is done
+    std::condition_variable cv_drained;     // a chunk was taken from the queue
+    std::deque<std::vector<char>*> queue;
+    std::vector<char>* current;
+    bool finished;                          // worker has queued its last chunk
+    bool failed;                            // the input could not be decompressed
+    bool stop;                              // the reader went away
+
+    uint64_t delivered;                     // bytes handed out before the current chunk
+
+public:
+    CompressedStreambuf();
+    ~CompressedStreambuf();
+
+    bool open(const std::string &filename, Codec _codec);
+    void close();
+    bool has_failed();
+
+    static Codec detect(const std::string &filename);
+
+protected:
+    int_type underflow();
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                     std::ios_base::openmode which);
+
+private:
+    void run();
+    bool run_gzip();
+    bool run_xz();
+    bool push(std::vector<char>* chunk);
+
+    CompressedStreambuf(const CompressedStreambuf&);            // non-copyable
+    CompressedStreambuf& operator=(const CompressedStreambuf&);
+};
+
+/*
+ * Input stream reading a compressed file
+ *
+ * Usage: CompressedStream in;
+ *        if(in.open("CHGCAR.gz", CompressedStream::detect("CHGCAR.gz"))) {
+ *            std::getline(in, line); ...
+ *        }
+ */
+class CompressedStream : public std::istream {
+private:
+    CompressedStreambuf buf;
+
+public:
+    CompressedStream();
+
+    bool open(const std::string &filename, CompressedStreambuf::Codec codec);
+    bool has_failed();
+
+    static CompressedStreambuf::Codec detect(const std::string &filename);
+};
+
+#endif //_COMPRESSED_STREAM_H
@@ -0,0 +1,45 @@
+/**************************************************************************
+ *   cube_reader.h                                                        *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#ifndef _CUBE_READER_H
+#define _CUBE_READER_H
+
+#include <string>
+#include <iostream>
+#include "grid_reader.h"
+
+/*
+ * Reader for Gaussian cube files
+ *
+ * The header holds two comment lines, the number of atoms and the origin,
+ * the number of points and the step vector of each axis (in bohr, or in
+ * angstrom when the number of points is negative) and one line per atom.
+ * The data runs over z fastest and every row along z starts on a new line
+ * (six values per line). Values are taken as they are.
+ */
+class CubeReader : public GridReader {
+public:
+    bool read_header(std::istream &infile, GridHeader &header, bool debug);
+    GridLayout get_layout(const GridHeader &header) const;
+    const char* get_name() const;
+};
+
+#endif //_CUBE_READER_H
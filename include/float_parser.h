@@ -0,0 +1,59 @@
+/**************************************************************************
+ *   float_parser.h                                                       *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef _FLOAT_PARSER_H
+#define _FLOAT_PARSER_H
+
+#include <cstddef>
+
+/*
+ * Tokenizer for the numeric body of VASP volumetric files
+ *
+ * A token is a run of the characters [0-9Ee.+-]; everything else is treated
+ * as a separator. Each token is converted to the same float as the former
+ * pcrecpp based reader gave (strtod() rounded to float), but without any
+ * allocation and, for the common VASP layout (" 0.12345678901E+02"),
+ * without calling into the C library.
+ */
+class FloatParser {
+public:
+    static bool parse(const char* &p, const char* end, float* val);
+    static size_t parse_range(const char* &p, const char* end, float* out, size_t n);
+    static size_t count_tokens(const char* p, const char* end);
+
+private:
+    static bool is_token_char(char c);
+    static bool convert(const char* begin, const char* end, float* val);
+    static bool convert_slow(const char* begin, const char* end, float* val);
+};
+
+/*
+ * bool is_token_char(c)
+ *
+ * Characters that make up a number (the same set as the former
+ * pcrecpp pattern "([0-9Ee.+-]+)")
+ *
+ */
+inline bool FloatParser::is_token_char(char c) {
+    return (c >= '0' && c <= '9') || c == '.' || c == '-' || c == '+' ||
+           c == 'E' || c == 'e';
+}
+
+#endif //_FLOAT_PARSER_H
@@ -0,0 +1,105 @@
+/**************************************************************************
+ *   grid_cache.h                                                         *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#ifndef _GRID_CACHE_H
+#define _GRID_CACHE_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "mapped_file.h"
+
+/*
+ * Header of the binary grid cache (sidecar) file
+ *
+ * The header is followed by the number of atoms per element (nrat_count
+ * uint32 values), the grid dimension line (gridline_length characters)
+ * and, at data_offset, the raw float grid.
+ */
+struct GridCacheHeader {
+    char magic[8];                  // "EDPCACHE"
+    uint32_t version;
+    uint32_t byte_order;            // 0x01020304 in the native byte order
+
+    // fingerprint of the source file
+    uint64_t source_size;
+    int64_t source_mtime_sec;
+    int64_t source_mtime_nsec;
+    uint64_t source_hash;           // FNV-1a of the head and tail of the file
+
+    double scalar;
+    double mat[3][3];
+    double origin[3];
+    uint32_t grid_dimensions[3];
+    uint32_t vasp5_input;
+    uint32_t closed_grid;
+    uint32_t nrat_count;
+    uint32_t gridline_length;
+
+    uint64_t data_offset;
+    uint64_t data_count;
+};
+
+/*
+ * Binary sidecar that stores a parsed grid next to its source file
+ *
+ * Usage: GridCache cache("CHGCAR");   // uses CHGCAR.edpcache
+ *        if(cache.load()) { float* grid = cache.get_grid(); ... }
+ *
+ * Different grids derived from the same source (e.g. the spin up
+ * density) are told apart by a variant name: GridCache("CHGCAR", "up")
+ * uses CHGCAR.up.edpcache.
+ *
+ * A cache is only accepted when the fingerprint of the source file
+ * (size, modification time and a hash of its head and tail) still
+ * matches, so it is invalidated automatically when the source changes.
+ */
+class GridCache {
+private:
+    std::string source;
+    std::string path;
+    MappedFile* map;
+    GridCacheHeader header;
+    std::vector<unsigned int> nrat;
+    std::string gridline;
+
+public:
+    GridCache(const std::string &_source, const std::string &_variant = "");
+    ~GridCache();
+
+    bool load();
+    bool store(GridCacheHeader _header, const std::vector<unsigned int> &_nrat,
+               const std::string &_gridline, const float* grid);
+
+    const GridCacheHeader& get_header() const;
+    const std::vector<unsigned int>& get_nrat() const;
+    const std::string& get_gridline() const;
+    float* get_grid();
+    const std::string& get_path() const;
+
+private:
+    bool fingerprint(GridCacheHeader* hdr) const;
+
+    GridCache(const GridCache&);            // non-copyable
+    GridCache& operator=(const GridCache&);
+};
+
+#endif //_GRID_CACHE_H
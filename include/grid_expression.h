@@ -0,0 +1,88 @@
+/**************************************************************************
+ *   grid_expression.h                                                    *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#ifndef _GRID_EXPRESSION_H
+#define _GRID_EXPRESSION_H
+
+#include <string>
+#include <vector>
+#include "thread_pool.h"
+
+/*
+ * Element-wise arithmetic over several grids, e.g. "AB - A - B"
+ *
+ * The expression consists of grid names, numbers, + - * /, unary minus and
+ * parentheses. It is compiled once into postfix code, which is then run
+ * over short blocks of grid points: every operation works on a block that
+ * stays in the L1 cache, so the whole expression is evaluated in a single
+ * pass over the grids without any temporary grid. The blocks are shared
+ * out over the threads of a pool.
+ *
+ * Usage: GridExpression expr;
+ *        expr.parse("AB - A - B", names);
+ *        expr.evaluate(grids, result, gridsize, &pool);
+ */
+class GridExpression {
+private:
+    struct Op {
+        enum Code {
+            PUSH_GRID,
+            PUSH_CONST,
+            ADD,
+            SUB,
+            MUL,
+            DIV,
+            NEG
+        } code;
+        unsigned int index;  // grid (PUSH_GRID) or constant (PUSH_CONST)
+    };
+
+    static const size_t block_size = 1024;  // grid points per block
+
+    std::string text;
+    std::vector<Op> code;
+    std::vector<float> constants;
+    unsigned int depth;                     // largest stack depth of the code
+
+    // parser state
+    std::vector<std::string> names;
+    size_t pos;
+    unsigned int sp;                        // stack depth at pos
+
+public:
+    GridExpression();
+
+    bool parse(const std::string &_text, const std::vector<std::string> &_names);
+    void evaluate(const std::vector<const float*> &grids, float* out, size_t n, ThreadPool* pool) const;
+    const std::string& get_text() const;
+
+private:
+    bool parse_sum();
+    bool parse_product();
+    bool parse_factor();
+    void emit(Op::Code _code, unsigned int _index);
+    void skip_space();
+    bool fail(const std::string &msg) const;
+
+    void evaluate_range(const std::vector<const float*> &grids, float* out, size_t begin, size_t end) const;
+};
+
+#endif //_GRID_EXPRESSION_H
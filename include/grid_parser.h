@@ -0,0 +1,108 @@
+/**************************************************************************
+ *   grid_parser.h                                                        *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#ifndef _GRID_PARSER_H
+#define _GRID_PARSER_H
+
+#include <cstddef>
+#include <string>
+#include "float_parser.h"
+
+/*
+ * Parallel parser for the data block of volumetric files
+ *
+ * The data block consists of records of a fixed number of values (the
+ * whole block for VASP files, one row along z for Gaussian cube files).
+ * Every record starts on a new line and all its lines carry the same
+ * number of values, only the last line of a record may be shorter. The
+ * block is split into byte ranges on newline boundaries; the number of
+ * lines in front of a range determines where its values go in the output
+ * array, so every thread can parse its range independently.
+ *
+ * A slice of a single record block can also be read on its own; the line
+ * that holds its first value is then found from the fixed line width that
+ * VASP writes, so the part of the file in front of it is never touched.
+ */
+class GridParser {
+public:
+    static const char* parse_block(const char* begin, const char* end,
+                                   float* out, size_t n, unsigned int nthreads,
+                                   size_t record = 0);
+    static const char* skip_block(const char* begin, const char* end, size_t n,
+                                  size_t record = 0);
+    static const char* parse_slice(const char* begin, const char* end, float* out,
+                                   size_t first, size_t count, size_t n,
+                                   unsigned int nthreads);
+    static const char* seek_value(const char* begin, const char* end, size_t first,
+                                  size_t n, size_t* vpl);
+    static const char* find_line(const char* begin, const char* end, const std::string &line);
+
+private:
+    struct Part {
+        const char* begin;
+        const char* end;
+        size_t lines;
+        bool ok;
+    };
+
+    static size_t block_lines(size_t n, size_t vpl, size_t record);
+    static size_t line_values(size_t lines, size_t vpl, size_t record);
+    static const char* next_line(const char* p, const char* end);
+    static size_t count_lines(const char* p, const char* end);
+    static const char* find_block_end(const char* begin, const char* end, size_t nlines);
+    static const char* seek_line(const char* begin, const char* end, size_t line, size_t stride);
+    static size_t get_stride(const char* begin, const char* end, size_t n, size_t vpl);
+    static void split(const char* begin, const char* end, Part* parts, unsigned int nparts);
+    static void count_parts(Part* parts, unsigned int nparts);
+};
+
+/*
+ * Sequential reader of (a slice of) a single record data block in pieces
+ * of any size, i.e. to combine several files block by block without
+ * keeping a grid of each of them
+ *
+ * Whole lines are parsed in parallel straight into the output; a line that
+ * is only needed in part is kept for the next piece.
+ *
+ * Usage: BlockStream bs;
+ *        if(bs.open(begin, end, n, first)) { bs.read(out, count, nthreads); ... }
+ */
+class BlockStream {
+private:
+    const char* pos;        // start of the next line to parse
+    const char* end;
+    size_t left;            // values of the block from pos onwards
+    size_t vpl;             // values per line
+    float line[64];         // values of the last line that was parsed
+    size_t nline;           // number of them
+    size_t used;            // number of them taken
+
+public:
+    BlockStream();
+    bool open(const char* begin, const char* _end, size_t n, size_t first);
+    bool read(float* out, size_t count, unsigned int nthreads);
+    const char* get_position() const;
+
+private:
+    bool read_line();
+};
+
+#endif //_GRID_PARSER_H
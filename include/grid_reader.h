@@ -0,0 +1,90 @@
+/**************************************************************************
+ *   grid_reader.h                                                        *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#ifndef _GRID_READER_H
+#define _GRID_READER_H
+
+#include <string>
+#include <vector>
+#include <istream>
+
+/*
+ * Everything a reader takes from the header of a volumetric file
+ */
+struct GridHeader {
+    double scalar;                      // scaling factor of the unit cell
+    double mat[3][3];                   // unit cell vectors (rows) in angstrom
+    double origin[3];                   // cartesian position of the first grid point
+    unsigned int grid_dimensions[3];
+    std::vector<unsigned int> nrat;     // number of atoms per element
+    bool vasp5_input;
+    std::string gridline;               // grid dimension line (VASP)
+    bool closed_grid;                   // the last grid points lie on the far faces of the cell (cube)
+
+    GridHeader();
+};
+
+/*
+ * Layout of the data block(s) following the header
+ */
+struct GridLayout {
+    size_t record;              // values per record, every record starts on a new line (0: one record)
+    bool z_fastest;             // the file runs over z fastest instead of x
+    std::string stopline;       // line that ends a block early (empty: none)
+    std::string stop_prefix;    // start of a line that ends a block early (empty: none)
+    bool spin_blocks;           // a magnetization block may follow a copy of the grid dimension line
+};
+
+/*
+ * Interface of the readers for the supported volumetric file formats
+ *
+ * A reader only parses the header and describes the layout of the data;
+ * the data itself is loaded by ScalarField with the shared tokenizer and
+ * parallel machinery (GridParser for memory mapped files, StreamPipeline
+ * for pipes and compressed files).
+ *
+ * Usage: GridReader* reader = GridReader::create(GridReader::detect("CHGCAR"));
+ *        reader->read_header(infile, header, true);
+ *        GridLayout layout = reader->get_layout(header);
+ *        delete reader;
+ */
+class GridReader {
+public:
+    enum Format {
+        FORMAT_AUTO,
+        FORMAT_VASP,    // CHGCAR, LOCPOT, ELFCAR, PARCHG, AECCAR, CHG
+        FORMAT_CUBE     // Gaussian cube
+    };
+
+    virtual ~GridReader();
+
+    virtual bool read_header(std::istream &infile, GridHeader &header, bool debug) = 0;
+    virtual GridLayout get_layout(const GridHeader &header) const = 0;
+    virtual const char* get_name() const = 0;
+
+    static Format detect(const std::string &filename);
+    static GridReader* create(Format format);
+
+private:
+    static bool is_cube_line(const std::string &line, size_t min_tokens, size_t max_tokens);
+};
+
+#endif //_GRID_READER_H
@@ -0,0 +1,129 @@
+/**************************************************************************
+ *   grid_storage.h                                                       *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#ifndef _GRID_STORAGE_H
+#define _GRID_STORAGE_H
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+/*
+ * Compact storage for the grid of a ScalarField
+ *
+ * PRECISION_FP32: no compaction, the grid stays a float array (ScalarField
+ *                 does not create a GridStorage in that case)
+ * PRECISION_FP16: IEEE half precision numbers, after scaling the grid by a
+ *                 power of two that brings its largest magnitude max to
+ *                 [2^14,2^15); the error of any value is at most 2^-11 of
+ *                 max (half an ulp of the top binade). Values down to about
+ *                 max * 2^-29 are normal halves and also keep a relative
+ *                 error of 2^-11; smaller ones become subnormal halves with
+ *                 a fixed step of about max * 2^-39, and those below half
+ *                 that step are flushed to (signed) zero, so their relative
+ *                 error is not bounded
+ * PRECISION_Q16:  16 bit integers between the minimum and the maximum of
+ *                 every 8x8x8 brick; the error is at most 1/131070 of the
+ *                 value range of the brick
+ *
+ * Values are decoded on the fly by get(). The largest deviation from the
+ * original grid is measured while encoding.
+ */
+class GridStorage {
+public:
+    enum Precision {
+        PRECISION_FP32,
+        PRECISION_FP16,
+        PRECISION_Q16
+    };
+
+private:
+    static const unsigned int brick_bits = 3;  // bricks of 8x8x8 points
+
+    Precision precision;
+    unsigned int dims[3];
+    unsigned int bricks[3];     // number of bricks in each direction
+    size_t size;
+    uint16_t* data;             // fp16 or quantized value per grid point
+    float* brick_offset;        // minimum of every brick (q16)
+    float* brick_step;          // value of one quantization step (q16)
+    float fp16_scale;           // power of two the fp16 values are scaled by
+    float max_error;            // largest deviation from the original grid
+
+public:
+    GridStorage(Precision _precision, const unsigned int _dims[3]);
+    ~GridStorage();
+
+    void encode(const float* grid, unsigned int nthreads);
+    float get(unsigned int i, unsigned int j, unsigned int k) const;
+
+    size_t get_bytes() const;
+    float get_max_error() const;
+    static const char* get_name(Precision _precision);
+
+private:
+    void encode_fp16(const float* grid, unsigned int kbegin, unsigned int kend, float* err);
+    void encode_q16(const float* grid, unsigned int kbegin, unsigned int kend, float* err);
+    size_t get_brick(unsigned int i, unsigned int j, unsigned int k) const;
+
+    static uint16_t float_to_half(float f);
+    static float half_to_float(uint16_t h);
+
+    GridStorage(const GridStorage&);            // non-copyable
+    GridStorage& operator=(const GridStorage&);
+};
+
+/*
+ * float get(i,j,k)
+ *
+ * Decode the value at a grid point
+ *
+ */
+inline float GridStorage::get(unsigned int i, unsigned int j, unsigned int k) const {
+    const uint16_t v = this->data[(size_t(k) * this->dims[1] + j) * this->dims[0] + i];
+    if(this->precision == PRECISION_FP16) {
+        return half_to_float(v) * this->fp16_scale;
+    }
+    const size_t b = this->get_brick(i, j, k);
+    return this->brick_offset[b] + float(v) * this->brick_step[b];
+}
+
+inline size_t GridStorage::get_brick(unsigned int i, unsigned int j, unsigned int k) const {
+    return (size_t(k >> brick_bits) * this->bricks[1] + (j >> brick_bits)) * this->bricks[0] +
+           (i >> brick_bits);
+}
+
+/*
+ * float half_to_float(h)
+ *
+ * Shifting exponent and mantissa of a half into place gives a float that
+ * is 2^112 too small, for normal as well as subnormal numbers
+ *
+ */
+inline float GridStorage::half_to_float(uint16_t h) {
+    const uint32_t bits = uint32_t(h & 0x7FFF) << 13;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    f *= 5.192296858534828e+33f; // 2^112
+    return (h & 0x8000) ? -f : f;
+}
+
+#endif //_GRID_STORAGE_H
@@ -0,0 +1,67 @@
+/**************************************************************************
+ *   job_list.h                                                           *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#ifndef _JOB_LIST_H
+#define _JOB_LIST_H
+
+#include <string>
+#include <vector>
+#include "mathtools.h"
+
+/*
+ * Frames to render from a single loaded field (edp --jobs), i.e. a sweep
+ * of the cutting plane through the unit cell
+ *
+ * A job file holds one frame per line: the output file and the starting
+ * point of the plane, optionally followed by the two plane vectors and
+ * the scale. Fields that are left out take the values of the command
+ * line. Empty lines and lines that start with # are skipped.
+ *
+ *     # output      point      vector1  vector2  scale
+ *     img_0.png     0,0.00,0
+ *     img_1.png     0,0.05,0   1,1,0    0,0,1    150
+ *
+ * Usage: JobList jobs;
+ *        jobs.read("frames.txt", defaults);
+ *        for(size_t i=0; i<jobs.size(); i++) { render(jobs[i]); }
+ */
+class JobList {
+public:
+    struct Job {
+        std::string output;     // image file
+        Vector s;               // starting point
+        Vector v1, v2;          // plane vectors
+        float scale;            // px/angstrom
+    };
+
+private:
+    std::vector<Job> jobs;
+
+public:
+    bool read(const std::string &filename, const Job &defaults);
+    void add(const Job &job);
+    size_t size() const;
+    const Job& operator[](size_t i) const;
+
+    static bool parse_vector(const std::string &text, Vector* v);
+};
+
+#endif //_JOB_LIST_H
@@ -0,0 +1,60 @@
+/**************************************************************************
+ *   mapped_file.h                                                        *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#ifndef _MAPPED_FILE_H
+#define _MAPPED_FILE_H
+
+#include <string>
+#include <cstddef>
+
+/*
+ * Read-only memory map of a file on the HD
+ *
+ * Usage: MappedFile mf("CHGCAR");
+ *        if(mf.is_open()) { const char* p = mf.data(); ... }
+ *
+ * A copy-on-write mapping can be written to through writable_data();
+ * the changes stay private to the process. The mapping is released
+ * when the object goes out of scope; release() gives back the part of a
+ * read-only mapping that has been parsed already.
+ */
+class MappedFile {
+private:
+    char* ptr;
+    size_t length;
+    bool copy_on_write;
+
+public:
+    MappedFile(const std::string &_filename, bool _copy_on_write = false);
+    ~MappedFile();
+
+    bool is_open() const;
+    const char* data() const;
+    char* writable_data();
+    size_t size() const;
+    void release(size_t offset);
+
+private:
+    MappedFile(const MappedFile&);            // non-copyable
+    MappedFile& operator=(const MappedFile&);
+};
+
+#endif //_MAPPED_FILE_H
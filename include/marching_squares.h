@@ -0,0 +1,76 @@
+/**************************************************************************
+ *   marching_squares.h                                                   *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#ifndef _MARCHING_SQUARES_H
+#define _MARCHING_SQUARES_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+#include "thread_pool.h"
+
+/*
+ * Contour lines of an image at a set of levels by marching squares
+ *
+ * A cell of four neighbouring pixels holds the levels that lie strictly
+ * between its lowest and its highest corner, found by a binary search in
+ * the sorted list of levels, so a single pass over the image serves all
+ * levels. Per level a cell yields one segment between two of its edges,
+ * or two for a saddle (split by the mean of the corners), with the end
+ * points interpolated linearly along the edges. The cells are traced in
+ * blocks (i.e. the tiles of an image that is never stored as a whole),
+ * each needing its own values plus one row and one column beyond it.
+ *
+ * Segments that end on the same edge are then joined into polylines,
+ * open ones ending at the border of the image or closed loops. Points are
+ * in the coordinates of the image, with pixel (i,j) centered at
+ * (i + 0.5, j + 0.5).
+ *
+ * Usage: std::vector<std::vector<MarchingSquares::Polyline> > lines;
+ *        MarchingSquares::trace_cells(tile, stride, x0, y0, w, h, nx, levels, segments[t]);
+ *        MarchingSquares::join(segments, levels.size(), pool, lines);
+ */
+class MarchingSquares {
+public:
+    struct Polyline {
+        std::vector<float> points;  // x0, y0, x1, y1, ...
+        bool closed;                // the last point connects to the first
+    };
+
+    struct Segment {
+        uint32_t level;
+        uint32_t edge[2];           // edges of the end points (two per pixel: to its right and below it)
+        float x[2], y[2];
+    };
+
+public:
+    static void trace_cells(const float* values, size_t stride, unsigned int x0, unsigned int y0,
+                            unsigned int w, unsigned int h, unsigned int nx,
+                            const std::vector<float> &levels, std::vector<Segment> &segments);
+    static void join(const std::vector<std::vector<Segment> > &blocks, unsigned int nlevels,
+                     ThreadPool* pool, std::vector<std::vector<Polyline> > &lines);
+
+private:
+    static void join_level(const std::vector<Segment> &segments, std::vector<Polyline> &lines);
+};
+
+#endif //_MARCHING_SQUARES_H
@@ -0,0 +1,83 @@
+/**************************************************************************
+ *   plane_writer.h                                                       *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#ifndef _PLANE_WRITER_H
+#define _PLANE_WRITER_H
+
+#include <string>
+#include <cstddef>
+#include <stdint.h>
+#include "xyz.h"
+
+/*
+ * Writer of the values of the plane for analysis outside of EDP
+ *
+ * FORMAT_NPY writes a NumPy array file (version 1.0) of float32 with
+ * shape (rows, columns), i.e. numpy.load("plane_real.npy").
+ *
+ * FORMAT_RAW writes a header of 64 bytes followed by the float32 values
+ * row by row:
+ *
+ *     char     magic[8]        "EDPPLANE"
+ *     uint32   byte_order      0x01020304 in the byte order of the file
+ *     uint32   header_size     64, the offset of the values
+ *     uint32   nx, ny          values per row, rows
+ *     float32  origin[3]       position of the first value (Angstrom)
+ *     float32  dx[3]           step along a row (Angstrom)
+ *     float32  dy[3]           step between rows (Angstrom)
+ *     uint32   log_scale       1 if the values are on the logarithmic scale
+ *
+ * Both formats store the values in the byte order of the machine, which
+ * the dtype of the npy header and byte_order record, so the plane is
+ * written by a single gathered write from its memory without a copy.
+ *
+ * Usage: PlaneWriter::write_npy("plane_real.npy", values, nx, ny);
+ */
+class PlaneWriter {
+public:
+    enum Format {
+        FORMAT_NPY,
+        FORMAT_RAW
+    };
+
+    struct RawHeader {
+        char magic[8];
+        uint32_t byte_order;
+        uint32_t header_size;
+        uint32_t nx, ny;
+        float origin[3];
+        float dx[3];
+        float dy[3];
+        uint32_t log_scale;
+    };
+
+public:
+    static bool write_npy(const std::string &filename, const float* values, unsigned int nx, unsigned int ny);
+    static bool write_raw(const std::string &filename, const float* values, unsigned int nx, unsigned int ny,
+                          const XYZ &origin, const XYZ &dx, const XYZ &dy, bool log_scale);
+    static const char* get_extension(Format format);
+
+private:
+    static bool write_file(const std::string &filename, const void* header, size_t header_size,
+                           const float* values, size_t n);
+};
+
+#endif //_PLANE_WRITER_H
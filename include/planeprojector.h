@@ -25,29 +25,64 @@
 #include "plotter.h"
 #include "mathtools.h"
 #include "scalar_field.h"
+#include "profiler.h"
+#include "thread_pool.h"
+#include "marching_squares.h"
+#include "plane_writer.h"
+#include "png_writer.h"
 
 class PlaneProjector {
 private:
-    ColorScheme* scheme;
+    static const unsigned int tile_width = 128;    // pixels of a tile along a row
+    static const unsigned int tile_rows = 32;      // rows of a tile
+
+    const ColorScheme* scheme;
+    bool own_scheme;
     ScalarField* sf;
     Plotter* plt;
+    Profiler* profiler;
+    ThreadPool* pool;
 
-    float* planegrid_log;
-    float* planegrid_real;
+    // the plane: the window of wx x wy pixels around the starting point
+    // and the rectangle of ix x iy pixels at (left, top) in it that covers
+    // the unit cell
+    Vector v1, v2, s;
+    float scale;
+    int wx, wy;
+    unsigned int left, top;
     float min, max;
 
     int ix, iy;
+
+    // the values of the plane, only stored for write_planes()
+    bool keep_planes;
+    float* planegrid_real;
+    float* planegrid_log;
+    size_t plane_size;
+
+    bool verbose;
+
+    int png_level;
+    PngWriter::Filter png_filter;
 public:
     PlaneProjector(ScalarField* _sf, float _min, float _max);
-    void extract(Vector _v1, Vector _v2, Vector _s, float _scale, float li, float hi, float lj, float hj, bool negative_values);
-    void plot();
-    void isolines(unsigned int bins, bool negative_values);
-    void write(std::string filename);
+    PlaneProjector(ScalarField* _sf, const ColorScheme* _scheme, float _min, float _max);
+    void set_profiler(Profiler* _profiler);
+    void set_thread_pool(ThreadPool* _pool);
+    void set_verbose(bool _verbose);
+    void set_keep_planes(bool _keep_planes);
+    void set_png(int _level, PngWriter::Filter _filter);
+    void set_plane(Vector _v1, Vector _v2, Vector _s, float _scale, float li, float hi, float lj, float hj);
+    void render(unsigned int bins, bool negative_values);
+    size_t get_pixels() const;
+    bool write(std::string filename);
+    bool write_planes(const std::string &prefix, PlaneWriter::Format format);
     ~PlaneProjector();
 private:
-    void cut_and_recast_plane();
-    void draw_isoline(float val);
-    bool is_crossing(const unsigned int &i, const unsigned int &j, const float &val);
+    void init(ScalarField* _sf, float _min, float _max);
+    XYZ get_row_start(int j) const;
+    XYZ get_step() const;
+    std::vector<float> get_levels(unsigned int bins, bool negative_values) const;
 };
 
 #endif
@@ -28,6 +28,10 @@
 #include <string>
 #include <cstdlib>
 #include <math.h>
+#include <stdint.h>
+
+#include "color_map.h"
+#include "png_writer.h"
 
 class Color {
 private:
@@ -37,19 +41,24 @@ public:
   float get_r() const;
   float get_g() const;
   float get_b() const;
+  uint32_t get_argb() const;
 };
 
 class ColorScheme {
 private:
   std::vector<std::string> scheme;
   std::vector<Color> colors;
+  std::vector<uint32_t> table;
   double low, high;
 public:
   ColorScheme(const double &_low, const double &_high);
   Color get_color(const double &_value);
+  ColorMap::Table get_table() const;
+  void get_pixels(const float* values, size_t n, uint32_t* pixels) const;
 private:
   void construct_scheme();
   void convert_scheme();
+  void build_table();
   Color rgb2color(const std::string &_hex);
   unsigned int hex2int(const std::string &_hex);
 };
@@ -60,11 +69,13 @@ private:
   cairo_t *cr;
   cairo_surface_t *surface;
   unsigned int width, height;
-  ColorScheme *scheme;
 public:
   Plotter(const unsigned int &_width, const unsigned int &_height);
+  ~Plotter();
+  unsigned int get_width() const;
+  unsigned int get_height() const;
   void set_background(const Color &_color);
-  void write(const char* filename);
+  bool write(const char* filename, const PngWriter &png);
   void draw_filled_rectangle(float xstart, float ystart, float xstop, float ystop,
                       const Color &_color);
   void draw_empty_rectangle(float xstart, float ystart, float xstop, float ystop,
@@ -75,6 +86,11 @@ public:
                           const Color &_color);
   void draw_empty_circle(float cx, float cy, float radius,
                         const Color &_color, float line_width);
+  void add_polyline(const float* points, size_t n, bool closed);
+  void stroke_path(const Color &_color, float line_width);
+  void begin_raster();
+  uint32_t* get_raster_row(unsigned int j);
+  void end_raster();
 private:
 
 };
@@ -0,0 +1,95 @@
+/**************************************************************************
+ *   png_writer.h                                                         *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#ifndef _PNG_WRITER_H
+#define _PNG_WRITER_H
+
+#include <cstddef>
+#include <cstdio>
+#include <stdint.h>
+#include <vector>
+#include "thread_pool.h"
+
+/*
+ * Writer of PNG files from ARGB32 images (i.e. the Cairo surface of the
+ * plot) with a choice of compression level and row filter
+ *
+ * Opaque images are written as 8 bit RGB, others as 8 bit RGBA. The rows
+ * are filtered and deflated in strips of about strip_bytes on the threads
+ * of the pool, each strip in a buffer of its own. Every strip is a raw
+ * deflate stream primed with the last 32 KiB of filtered data before it
+ * (filtered once more by the task of the strip) and ended by a sync flush,
+ * so the strips join into one zlib stream that compresses about as well as
+ * a serial one; the checksums of the strips are combined. The strips are
+ * encoded and written a batch at a time, so memory stays at a few strips
+ * per thread whatever the size of the image. The strips follow from the
+ * width of the image only, so the file does not depend on the number of
+ * threads.
+ *
+ * Level 0 stores the rows without compression, level 1 is the fastest and
+ * level 9 the strongest compression. FILTER_ADAPTIVE picks the filter of
+ * every row by the smallest sum of absolute differences, as libpng does;
+ * the flat color bands of the plots compress better and faster without
+ * a filter, though.
+ *
+ * Usage: PngWriter png(6, PngWriter::FILTER_NONE);
+ *        png.set_thread_pool(&pool);
+ *        png.write("plot.png", data, width, height, stride);
+ */
+class PngWriter {
+public:
+    enum Filter {
+        FILTER_NONE,
+        FILTER_SUB,
+        FILTER_UP,
+        FILTER_AVERAGE,
+        FILTER_PAETH,
+        FILTER_ADAPTIVE
+    };
+
+private:
+    static const size_t strip_bytes = 1 << 20;   // filtered bytes per deflate strip
+    static const size_t window = 32768;          // bytes of history of deflate
+
+    int level;
+    Filter filter;
+    ThreadPool* pool;
+
+public:
+    PngWriter(int _level, Filter _filter);
+    void set_thread_pool(ThreadPool* _pool);
+    bool write(const char* filename, const unsigned char* data, unsigned int width,
+               unsigned int height, size_t stride) const;
+
+private:
+    static void convert_row(const uint32_t* in, unsigned int width, unsigned int channels, unsigned char* out);
+    static void filter_row(const unsigned char* row, const unsigned char* prev, size_t n,
+                           unsigned int bpp, Filter f, unsigned char* trial, unsigned char* out);
+    static unsigned long get_cost(const unsigned char* line, size_t n);
+    bool encode_strip(const unsigned char* data, unsigned int width, unsigned int height, size_t stride,
+                      unsigned int channels, unsigned int j0, unsigned int rows, bool last,
+                      std::vector<unsigned char> &out, unsigned long* checksum, size_t* length) const;
+    bool deflate_strip(const unsigned char* begin, const unsigned char* end, size_t history,
+                       bool last, std::vector<unsigned char> &out) const;
+    static void write_chunk(FILE* f, const char* type, const unsigned char* data, size_t n);
+};
+
+#endif //_PNG_WRITER_H
@@ -0,0 +1,89 @@
+/**************************************************************************
+ *   profiler.h                                                           *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#ifndef _PROFILER_H
+#define _PROFILER_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <chrono>
+#include <cstddef>
+#include <stdint.h>
+
+/*
+ * Wall time, throughput and hardware counters of the phases of a run
+ *
+ * Every phase is bracketed by start() and stop(); stop() also takes the
+ * amount of data the phase went through, from which the throughput is
+ * derived. Cycles and cache misses are counted via perf_event_open()
+ * when the kernel allows it (see /proc/sys/kernel/perf_event_paranoid),
+ * including the threads that were started and joined within a phase.
+ *
+ * Usage: Profiler prof;
+ *        prof.start("read");
+ *        ...
+ *        prof.stop("read", bytes, values, "values");
+ *        prof.report(std::cout, false);
+ */
+class Profiler {
+private:
+    struct Phase {
+        std::string name;
+        double seconds;
+        size_t bytes;           // bytes processed (0 if not applicable)
+        size_t count;           // items processed
+        std::string unit;       // what the items are (values, samples, pixels)
+        uint64_t cycles;
+        uint64_t cache_misses;
+        long peak_rss;          // peak resident set size at the end (KiB)
+    };
+
+    std::vector<Phase> phases;
+    std::string current;        // name of the running phase
+    std::chrono::steady_clock::time_point started;
+    uint64_t cycles_start;
+    uint64_t misses_start;
+    int fd_cycles;              // perf event descriptors, -1 if unavailable
+    int fd_misses;
+
+public:
+    Profiler();
+    ~Profiler();
+
+    void start(const std::string &name);
+    void stop(const std::string &name, size_t bytes, size_t count, const std::string &unit);
+    void report(std::ostream &out, bool json) const;
+
+    bool has_counters() const;
+
+private:
+    static int open_counter(uint64_t config);
+    static uint64_t read_counter(int fd);
+    static long get_peak_rss();
+    void report_text(std::ostream &out) const;
+    void report_json(std::ostream &out) const;
+
+    Profiler(const Profiler&);            // non-copyable
+    Profiler& operator=(const Profiler&);
+};
+
+#endif //_PROFILER_H
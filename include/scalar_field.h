@@ -29,22 +29,75 @@
 #include <fstream>
 #include <pcrecpp.h>
 #include <math.h>
+#include <algorithm>
+#include <thread>
 #include "xyz.h"
+#include "float_parser.h"
+#include "grid_parser.h"
+#include "mapped_file.h"
+#include "grid_cache.h"
+#include "compressed_stream.h"
+#include "stream_pipeline.h"
+#include "grid_storage.h"
+#include "grid_expression.h"
+#include "grid_reader.h"
+#include "trilinear.h"
+#include "brick_layout.h"
+#include "tricubic.h"
+#include "thread_pool.h"
 
 class ScalarField{
+private:
+    static const size_t eval_chunk = 1 << 20;   // grid points per step of a streamed evaluation
+
+public:
+    enum SpinMode {
+        SPIN_TOTAL,          // spin up + spin down (first block)
+        SPIN_UP,
+        SPIN_DOWN,
+        SPIN_MAGNETIZATION   // spin up - spin down (second block)
+    };
+
+    enum Interpolation {
+        INTERPOLATION_LINEAR,   // trilinear between the grid points
+        INTERPOLATION_CUBIC     // cubic B-spline through the grid points
+    };
+
 private:
     std::string filename;
     double scalar;
     double mat[3][3];   // matrix dimensions
     double imat[3][3];  // inverse of matrix
+    double origin[3];   // position of the first grid point
 
     unsigned int grid_dimensions[3];
     std::vector<unsigned int> nrat;
     std::string gridline;
     float* gridptr;  // grid to first pos of float array
-    float* gridptr2; // grid to first pos of float array
+    float* gridptr2; // magnetization block (only while combining spin densities)
     unsigned int gridsize;
     bool vasp5_input;
+    bool closed_grid;       // the last grid points lie on the far faces of the cell
+    bool periodic;          // repeat the cell instead of zero outside of it
+    unsigned int nthreads;  // number of threads used for parsing
+    ThreadPool* pool;       // threads of evaluate() and the B-spline prefilter (see set_thread_pool())
+    bool use_cache;         // whether to use the binary grid cache
+    GridCache* cache;       // owns gridptr when loaded from the cache
+    SpinMode spin_mode;     // which density to take from spin polarized files
+    GridStorage::Precision precision; // how the grid is kept after reading
+    GridStorage* storage;   // compact grid, replaces gridptr when set
+    bool use_bricks;        // whether gridptr is rearranged into bricks
+    BrickLayout* bricks;    // order of gridptr when set, otherwise k-major
+    Interpolation interpolation; // how sample_row() interpolates
+    bool prefiltered;       // the grid holds B-spline coefficients instead of values
+    GridReader::Format format; // format of the input file
+    GridLayout layout;      // layout of the data block(s) of the input file
+    bool use_region;        // whether only the slabs around a plane are kept
+    XYZ region[3];          // corner and the two edges of that plane
+    unsigned int slabs[2];  // first and one past the last slab (z) in memory
+    size_t bytes_read;      // bytes taken from the input by read()
+    MappedFile* stream_file; // file whose values are streamed instead of read (see open_values())
+    BlockStream stream;     // position in its data block
 
 public:
     ScalarField(const std::string &_filename);
@@ -52,24 +105,52 @@ public:
     ~ScalarField();
 
 public:
-    void read(bool debug);
+    bool read(bool debug);
+    void set_threads(unsigned int _nthreads);
+    void set_thread_pool(ThreadPool* _pool);
+    void set_cache(bool _use_cache);
+    void set_spin_mode(SpinMode _spin_mode);
+    void set_precision(GridStorage::Precision _precision);
+    void set_format(GridReader::Format _format);
+    void set_region(const XYZ &corner, const XYZ &edge1, const XYZ &edge2);
+    void set_periodic(bool _periodic);
+    void set_bricks(bool _use_bricks);
+    void set_interpolation(Interpolation _interpolation);
+    bool open_values(bool debug);
+    bool read_values(float* out, size_t count);
+    bool evaluate(const GridExpression &expression, const std::vector<ScalarField*> &fields, bool debug);
+    size_t get_bytes_read() const;
+    unsigned int get_gridsize() const;
 
     /*
      * function for reading in the CHGCAR file
      */
 private:
-    void test_vasp5(bool debug);
-    void read_scalar(bool debug);
-    void read_matrix(bool debug);
-    void read_grid_dimensions(bool debug);
-    void read_grid(bool debug);
-    void read_atoms(bool debug);
+    void set_header(const GridHeader &header);
+    void transpose_grid();
+    bool read_grid(StreamPipeline &pipe, bool debug);
+    bool read_grid_block(StreamPipeline &pipe, float* dest, bool debug);
+    bool read_grid_mapped(std::streamoff &offset, bool debug);
+    bool read_cache(bool debug);
+    void write_cache(bool debug);
+    std::string cache_variant() const;
+    void combine_spin();
+    void compact_grid(bool debug);
+    void arrange_grid(bool debug);
+    bool prefilter_grid(bool debug);
+    void select_slabs(bool debug);
+    void crop_grid();
 
     /*
      * output and handler functions
      */
 public:
     float get_value_interp(const float &x, const float &y, const float &z);
+    void sample_row(const XYZ &start, const XYZ &step, unsigned int n, float* out) const;
+    void sample_span(const XYZ &start, const XYZ &step, unsigned int first, unsigned int last,
+                     float* out) const;
+    void get_span(const XYZ &start, const XYZ &step, unsigned int n,
+                  unsigned int* begin, unsigned int* end) const;
 
     /*
      * utility functions
@@ -77,11 +158,17 @@ public:
 private:
     float get_max_direction(const unsigned int &dim);
     void calculate_inverse();
+    void get_row_span(const XYZ &d0, const XYZ &dd, unsigned int n,
+                      unsigned int* begin, unsigned int* end) const;
+    void sample_row_cubic(const XYZ &d0, const XYZ &dd, unsigned int begin, unsigned int end,
+                          float* out) const;
+    double get_grid_scale(unsigned int dim) const;
+    static double wrap_coordinate(double r, unsigned int n);
 
     /*
      * value extraction and dimensionality manipulators
      */
-    const float& get_value(const unsigned int i,
+    float get_value(const unsigned int i,
                        const unsigned int j,
                        const unsigned int k) const;
     XYZ grid_to_realspace(const double &i,
@@ -0,0 +1,92 @@
+/**************************************************************************
+ *   stream_pipeline.h                                                    *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#ifndef _STREAM_PIPELINE_H
+#define _STREAM_PIPELINE_H
+
+#include <istream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include "float_parser.h"
+
+/*
+ * Pipelined reader for the data blocks of non-seekable inputs (pipes,
+ * stdin, decompressing streams)
+ *
+ * One thread reads the input in chunks that end on a line boundary and
+ * places them in a bounded ring of slots. Worker threads tokenize complete
+ * lines of a slot into a buffer of their own, and the calling thread moves
+ * the values into the grid in the order of the input and reports progress.
+ * Data that was read beyond the end of a block is kept for the next call.
+ *
+ * Usage: StreamPipeline pipe(std::cin, 4);
+ *        size_t n = pipe.parse_block(grid, gridsize, gridline, "augmentation", true);
+ */
+class StreamPipeline {
+private:
+    struct Slot {
+        std::vector<char> text;
+        size_t length;              // bytes of complete lines in text
+        std::vector<float> values;
+        size_t count;               // values found in the slot
+        size_t stop_at;             // offset of a line that ends the block
+        bool parsed;
+    };
+
+    std::istream &in;
+    unsigned int nthreads;
+    std::string pending;            // input read ahead by a previous call
+    size_t bytes_read;              // bytes taken from the input
+
+    // state shared by the threads of a single parse_block() call
+    std::mutex mtx;
+    std::condition_variable cv_free;    // a slot was recycled
+    std::condition_variable cv_work;    // a slot was filled
+    std::condition_variable cv_parsed;  // a slot was parsed
+    std::vector<Slot> slots;
+    std::deque<unsigned int> free_slots;
+    std::deque<unsigned int> work;      // filled slots waiting for a worker
+    std::deque<unsigned int> order;     // filled slots in the order of the input
+    bool reader_done;
+    bool stop;
+    std::string carry;                  // partial line left by the reader
+
+public:
+    StreamPipeline(std::istream &_in, unsigned int _nthreads);
+
+    size_t parse_block(float* out, size_t n, const std::string &stopline,
+                       const std::string &stop_prefix, bool debug);
+    bool find_line(const std::string &line);
+    size_t get_bytes_read() const;
+
+private:
+    void run_reader();
+    void run_worker(bool convert, const std::string &stopline, const std::string &stop_prefix);
+    size_t line_end(const Slot &slot, size_t n, bool convert) const;
+
+    StreamPipeline(const StreamPipeline&);            // non-copyable
+    StreamPipeline& operator=(const StreamPipeline&);
+};
+
+#endif //_STREAM_PIPELINE_H
@@ -0,0 +1,89 @@
+/**************************************************************************
+ *   thread_pool.h                                                        *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#ifndef _THREAD_POOL_H
+#define _THREAD_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/*
+ * Pool of persistent worker threads that run loops over independent items
+ * (i.e. the rows of an image) with work stealing
+ *
+ * parallel_for() hands every thread (the calling thread included) an equal
+ * share of the items. A thread takes chunks of grain items from the front
+ * of its own share; once that is used up it steals the back half of the
+ * largest share left. Items that cost nothing (rows outside the unit
+ * cell) and expensive ones thus even out without a central queue. Every
+ * item is processed exactly once, so results written per item do not
+ * depend on the number of threads or on the schedule.
+ *
+ * Usage: ThreadPool pool(4);
+ *        pool.parallel_for(rows, 4, [&](unsigned int begin, unsigned int end) {...});
+ */
+class ThreadPool {
+public:
+    typedef std::function<void(unsigned int, unsigned int)> Body;
+
+private:
+    struct Share {
+        std::mutex mtx;
+        unsigned int begin;         // next item of the share
+        unsigned int end;           // one past the last item of the share
+    };
+
+    unsigned int nthreads;
+    std::vector<std::thread> workers;   // nthreads - 1 threads besides the caller
+    Share* shares;                      // one per thread, the caller's is the last
+
+    // state of the running loop
+    std::mutex mtx;
+    std::mutex run_mtx;                 // serializes parallel_for() calls
+    std::condition_variable cv_start;   // a loop was started (or the pool stops)
+    std::condition_variable cv_done;    // the last worker finished the loop
+    const Body* body;
+    unsigned int grain;
+    unsigned long generation;           // number of loops started
+    unsigned int busy;                  // workers still in the current loop
+    bool stop;
+
+public:
+    ThreadPool(unsigned int _nthreads);
+    ~ThreadPool();
+
+    void parallel_for(unsigned int n, unsigned int _grain, const Body &_body);
+    unsigned int get_threads() const;
+
+private:
+    void run_worker(unsigned int id);
+    void run_share(unsigned int id);
+    bool take(unsigned int id, unsigned int* begin, unsigned int* end);
+    bool steal(unsigned int id);
+
+    ThreadPool(const ThreadPool&);            // non-copyable
+    ThreadPool& operator=(const ThreadPool&);
+};
+
+#endif //_THREAD_POOL_H
@@ -0,0 +1,125 @@
+/**************************************************************************
+ *   tricubic.h                                                           *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#ifndef _TRICUBIC_H
+#define _TRICUBIC_H
+
+#include <cstddef>
+#include <cmath>
+#include <stdint.h>
+#include "thread_pool.h"
+
+/*
+ * Tricubic B-spline interpolation
+ *
+ * prefilter() turns the values of a grid into the coefficients of the
+ * cubic B-spline that passes through them, by a causal and an anti-causal
+ * recursive filter along every axis (Unser, IEEE Trans. Signal Process.
+ * 41 (1993) 821). Interpolating these coefficients then gives a C2 smooth
+ * field that still matches the grid at the grid points.
+ *
+ * A point takes the 4x4x4 coefficients around it, weighted by the cubic
+ * B-spline of its fractional position along each axis: four taps along x
+ * are summed per row, four rows per plane and four planes per point, all
+ * by fused multiply-adds. The kernels follow the choice of Trilinear
+ * (scalar, AVX2 or AVX-512) and give bit-identical results. As there, the
+ * scalar code runs in a clone for the FMA instructions when the processor
+ * has them (Trilinear::has_fma()) and calls fmaf() in libm otherwise.
+ *
+ * A point is given by the grid index of the coefficient at its lower
+ * corner, the offsets from there to the four taps along each axis (from
+ * one below to two above the corner, reflected at the faces of the grid
+ * or wrapped around for periodic images) and its fractional position.
+ *
+ * Usage: Tricubic::prefilter(grid, dims, periodic, &pool);
+ *        Tricubic::interpolate(grid, points, n, out);
+ */
+class Tricubic {
+public:
+    struct Points {
+        const uint32_t* base;   // index of the coefficient at the lower corner
+        const int32_t* ox[4];   // offsets to the taps along x, per point
+        const int32_t* oy[4];   // offsets to the taps along y
+        const int32_t* oz[4];   // offsets to the taps along z
+        const float* fx;        // fractional position in the cell
+        const float* fy;
+        const float* fz;
+    };
+
+public:
+    static void prefilter(float* grid, const unsigned int dims[3], const bool periodic[3], ThreadPool* pool);
+    static void interpolate(const float* grid, const Points &p, size_t n, float* out);
+    static void weights(float f, float w[4]);
+    static float blend(const float c[64], const float wx[4], const float wy[4], const float wz[4]);
+    static void blend_points(const float* c, const float* fx, const float* fy, const float* fz,
+                             size_t n, float* out);
+
+private:
+    static void filter_lines(float* line, unsigned int n, size_t stride, unsigned int width, bool periodic);
+    static void interpolate_scalar(const float* grid, const Points &p, size_t begin, size_t end, float* out);
+    static void interpolate_scalar_fma(const float* grid, const Points &p, size_t begin, size_t end, float* out);
+    static void blend_points_fma(const float* c, const float* fx, const float* fy, const float* fz,
+                                 size_t n, float* out);
+    static void interpolate_avx2(const float* grid, const Points &p, size_t n, float* out);
+    static void interpolate_avx512(const float* grid, const Points &p, size_t n, float* out);
+};
+
+/*
+ * void weights(f, w)
+ *
+ * Weights of the four taps at -1, 0, 1 and 2 for a point at fraction f
+ * past the lower corner
+ *
+ */
+inline void Tricubic::weights(float f, float w[4]) {
+    const float t = 1.0f - f;
+    const float f2 = f * f;
+    w[0] = t * t * t * (1.0f / 6.0f);
+    w[1] = std::fma(f2, std::fma(0.5f, f, -1.0f), 2.0f / 3.0f);
+    w[3] = f2 * f * (1.0f / 6.0f);
+    w[2] = 1.0f - w[0] - w[1] - w[3];
+}
+
+/*
+ * float blend(c, wx, wy, wz)
+ *
+ * Sum the coefficients c (x running fastest, then y, then z) with the
+ * weights of the taps
+ *
+ */
+inline float Tricubic::blend(const float c[64], const float wx[4], const float wy[4], const float wz[4]) {
+    float sum = 0.0f;
+    for(unsigned int k=0; k<4; k++) {
+        float plane = 0.0f;
+        for(unsigned int j=0; j<4; j++) {
+            const float* r = c + 16 * k + 4 * j;
+            float row = wx[0] * r[0];
+            row = std::fma(wx[1], r[1], row);
+            row = std::fma(wx[2], r[2], row);
+            row = std::fma(wx[3], r[3], row);
+            plane = (j == 0) ? wy[0] * row : std::fma(wy[j], row, plane);
+        }
+        sum = (k == 0) ? wz[0] * plane : std::fma(wz[k], plane, sum);
+    }
+    return sum;
+}
+
+#endif //_TRICUBIC_H
@@ -0,0 +1,110 @@
+/**************************************************************************
+ *   trilinear.h                                                          *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#ifndef _TRILINEAR_H
+#define _TRILINEAR_H
+
+#include <cstddef>
+#include <cmath>
+#include <stdint.h>
+
+/*
+ * Trilinear interpolation kernels
+ *
+ * The eight corners around a sample point are blended by seven linear
+ * interpolations (along x, then y, then z) in single precision, each a
+ * fused multiply-add. The AVX2 and AVX-512 kernels do 8 and 16 points at
+ * once, gathering the corners from the grid. The kernel is picked from
+ * CPUID at startup; all kernels give bit-identical results, the scalar
+ * one uses std::fma(). The scalar code (the reference kernel, the points
+ * the vector kernels leave and blend_points() for compact grids) runs in
+ * a clone built for the FMA instructions when the processor has them;
+ * only without FMA does std::fma() become a (slow) call into libm.
+ *
+ * A point is given by the grid index of its lower corner, the offsets to
+ * the upper corners (zero on the upper faces of the grid, or negative to
+ * wrap around for periodic images) and its fractional position within the
+ * grid cell.
+ *
+ * Usage: Trilinear::interpolate(grid, points, n, out);
+ */
+class Trilinear {
+public:
+    enum Kernel {
+        KERNEL_SCALAR,
+        KERNEL_AVX2,
+        KERNEL_AVX512
+    };
+
+    struct Points {
+        const uint32_t* base;   // index of the lower corner
+        const int32_t* ox;      // offset to the next point along x (1, 0 or back to the first)
+        const int32_t* oy;      // offset along y (nx, 0 or back to the first)
+        const int32_t* oz;      // offset along z (nx*ny, 0 or back to the first)
+        const float* fx;        // fractional position in the cell
+        const float* fy;
+        const float* fz;
+    };
+
+private:
+    static Kernel kernel;
+    static bool fma;        // whether the scalar code runs on the FMA instructions
+
+public:
+    static void interpolate(const float* grid, const Points &p, size_t n, float* out);
+    static float blend(const float c[8], float fx, float fy, float fz);
+    static void blend_points(const float* c, const float* fx, const float* fy, const float* fz,
+                             size_t n, float* out);
+
+    static Kernel get_kernel();
+    static bool has_fma();
+    static bool set_kernel(Kernel _kernel);
+    static bool is_supported(Kernel _kernel);
+    static const char* get_name(Kernel _kernel);
+
+private:
+    static Kernel select();
+    static bool detect_fma();
+    static void interpolate_scalar(const float* grid, const Points &p, size_t begin, size_t end, float* out);
+    static void interpolate_scalar_fma(const float* grid, const Points &p, size_t begin, size_t end, float* out);
+    static void blend_points_fma(const float* c, const float* fx, const float* fy, const float* fz,
+                                 size_t n, float* out);
+    static void interpolate_avx2(const float* grid, const Points &p, size_t n, float* out);
+    static void interpolate_avx512(const float* grid, const Points &p, size_t n, float* out);
+};
+
+/*
+ * float blend(c, fx, fy, fz)
+ *
+ * Interpolate between the corners c (x running fastest, then y, then z)
+ *
+ */
+inline float Trilinear::blend(const float c[8], float fx, float fy, float fz) {
+    const float c00 = std::fma(fx, c[1] - c[0], c[0]);
+    const float c10 = std::fma(fx, c[3] - c[2], c[2]);
+    const float c01 = std::fma(fx, c[5] - c[4], c[4]);
+    const float c11 = std::fma(fx, c[7] - c[6], c[6]);
+    const float c0 = std::fma(fy, c10 - c00, c00);
+    const float c1 = std::fma(fy, c11 - c01, c01);
+    return std::fma(fz, c1 - c0, c0);
+}
+
+#endif //_TRILINEAR_H
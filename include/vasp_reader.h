@@ -0,0 +1,53 @@
+/**************************************************************************
+ *   vasp_reader.h                                                        *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#ifndef _VASP_READER_H
+#define _VASP_READER_H
+
+#include <string>
+#include <iostream>
+#include <pcrecpp.h>
+#include "grid_reader.h"
+
+/*
+ * Reader for the volumetric files of VASP (CHGCAR, LOCPOT, ELFCAR,
+ * PARCHG, AECCAR, CHG), in both the VASP4 and the VASP5 flavour
+ *
+ * All of these share the POSCAR style header followed by the grid
+ * dimension line and a data block that runs over x fastest. CHGCAR files
+ * add augmentation occupancies behind each block; spin polarized files
+ * repeat the grid dimension line in front of the second block.
+ */
+class VaspReader : public GridReader {
+public:
+    bool read_header(std::istream &infile, GridHeader &header, bool debug);
+    GridLayout get_layout(const GridHeader &header) const;
+    const char* get_name() const;
+
+private:
+    void test_vasp5(const std::string &line, GridHeader &header, bool debug);
+    void read_scalar(std::istream &infile, GridHeader &header, bool debug);
+    void read_matrix(std::istream &infile, GridHeader &header, bool debug);
+    void read_atoms(std::istream &infile, GridHeader &header, bool debug);
+    void read_grid_dimensions(std::istream &infile, GridHeader &header, bool debug);
+};
+
+#endif //_VASP_READER_H
@@ -0,0 +1,111 @@
+/**************************************************************************
+ *   brick_layout.cpp                                                     *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#include "brick_layout.h"
+
+#include <algorithm>
+#include <thread>
+
+BrickLayout::BrickLayout(const unsigned int _dims[3]) {
+    const unsigned int edge = 1u << brick_bits;
+    const unsigned int mask = edge - 1;
+
+    unsigned int bricks[3];
+    for(unsigned int d=0; d<3; d++) {
+        this->dims[d] = _dims[d];
+        bricks[d] = (_dims[d] + mask) >> brick_bits;
+    }
+    this->size = size_t(bricks[0]) * bricks[1] * bricks[2] << (3 * brick_bits);
+
+    // a step of one brick along x, y or z skips this many points
+    const uint32_t brick_stride[3] = {
+        uint32_t(1) << (3 * brick_bits),
+        uint32_t(bricks[0]) << (3 * brick_bits),
+        uint32_t(bricks[0] * bricks[1]) << (3 * brick_bits)
+    };
+
+    for(unsigned int d=0; d<3; d++) {
+        this->offsets[d].resize(this->dims[d]);
+        for(unsigned int i=0; i<this->dims[d]; i++) {
+            this->offsets[d][i] = (i >> brick_bits) * brick_stride[d] +
+                                  ((i & mask) << (d * brick_bits));
+        }
+    }
+}
+
+/*
+ * void arrange(grid, bricked, nthreads)
+ *
+ * Copy a k-major float grid of the same dimensions into the bricked order
+ * (get_size() floats), working on layers of bricks in parallel. The
+ * padding is set to zero.
+ *
+ */
+void BrickLayout::arrange(const float* grid, float* bricked, unsigned int nthreads) const {
+    const unsigned int layers = (this->dims[2] + (1u << brick_bits) - 1) >> brick_bits;
+    nthreads = std::max(1u, std::min(nthreads, layers));
+    std::vector<std::thread> threads;
+    for(unsigned int t=0; t<nthreads; t++) {
+        unsigned int kbegin = (layers * t / nthreads) << brick_bits;
+        unsigned int kend = std::min(this->dims[2], (layers * (t + 1) / nthreads) << brick_bits);
+        threads.push_back(std::thread(&BrickLayout::arrange_layers, this, grid, bricked, kbegin, kend));
+    }
+    for(unsigned int t=0; t<nthreads; t++) {
+        threads[t].join();
+    }
+}
+
+/*
+ * size_t get_size()
+ *
+ * Number of floats of the bricked grid
+ *
+ */
+size_t BrickLayout::get_size() const {
+    return this->size;
+}
+
+/*
+ * void arrange_layers(grid, bricked, kbegin, kend)
+ *
+ * Copy the slabs [kbegin,kend), which cover whole layers of bricks (up
+ * to the last slab of the grid), and clear the padding of these layers
+ *
+ */
+void BrickLayout::arrange_layers(const float* grid, float* bricked, unsigned int kbegin, unsigned int kend) const {
+    const size_t layer = this->size / ((this->dims[2] + (1u << brick_bits) - 1) >> brick_bits);
+    const size_t first = size_t(kbegin >> brick_bits) * layer;
+    const size_t last = std::min(this->size, size_t((kend + (1u << brick_bits) - 1) >> brick_bits) * layer);
+    if(this->dims[0] % (1u << brick_bits) != 0 || this->dims[1] % (1u << brick_bits) != 0 ||
+       kend % (1u << brick_bits) != 0) {
+        std::fill(bricked + first, bricked + last, 0.0f);
+    }
+
+    for(unsigned int k=kbegin; k<kend; k++) {
+        for(unsigned int j=0; j<this->dims[1]; j++) {
+            const float* src = grid + (size_t(k) * this->dims[1] + j) * this->dims[0];
+            float* dest = bricked + this->offsets[1][j] + this->offsets[2][k];
+            for(unsigned int i=0; i<this->dims[0]; i++) {
+                dest[this->offsets[0][i]] = src[i];
+            }
+        }
+    }
+}
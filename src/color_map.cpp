@@ -0,0 +1,421 @@
+/**************************************************************************
+ *   color_map.cpp                                                        *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#include "color_map.h"
+#include "trilinear.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define COLOR_MAP_X86
+#include <immintrin.h>
+#endif
+
+// coefficients of ln(1+m) - m + m^2/2 on [sqrt(1/2)-1, sqrt(2)-1] (Cephes logf)
+static const float logp[9] = {
+     7.0376836292E-2f, -1.1514610310E-1f,  1.1676998740E-1f,
+    -1.2420140846E-1f,  1.4249322787E-1f, -1.6668057665E-1f,
+     2.0000714765E-1f, -2.4999993993E-1f,  3.3333331174E-1f
+};
+static const float sqrthf = 0.707106781186547524f;
+static const float log10e = 0.434294481903251828f;
+// log10(2) split such that e * lg2hi is exact
+static const float lg2hi = 3.00781250e-01f;
+static const float lg2lo = 2.48745663981195213739e-04f;
+
+/*
+ * float log10_poly(x)
+ *
+ * log10 of a positive x by the polynomial, -inf for zero, inf for inf and
+ * NaN for negative values and NaN; inlined into the plain functions as
+ * well as into their clones for the FMA instructions
+ *
+ */
+__attribute__((always_inline))
+static inline float log10_poly(float x) {
+    if(x != x || x < 0.0f) {
+        return std::numeric_limits<float>::quiet_NaN();
+    }
+    if(x == 0.0f) {
+        return -std::numeric_limits<float>::infinity();
+    }
+    if(x == std::numeric_limits<float>::infinity()) {
+        return x;
+    }
+
+    // split x into 2^e * (1 + m), sqrt(1/2) <= 1 + m < sqrt(2)
+    int32_t e = 0;
+    if(x < std::numeric_limits<float>::min()) {
+        x *= 8388608.0f; // 2^23, out of the denormals
+        e = -23;
+    }
+    uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    e += int32_t(bits >> 23) - 126;
+    bits = (bits & 0x007FFFFFu) | 0x3F000000u;
+    float m;
+    std::memcpy(&m, &bits, sizeof(m));
+    if(m < sqrthf) {
+        e -= 1;
+        m = m + m;
+    }
+    m = m - 1.0f;
+
+    const float z = m * m;
+    float y = logp[0];
+    for(unsigned int i=1; i<9; i++) {
+        y = std::fma(y, m, logp[i]);
+    }
+    y = (y * m) * z;
+    const float r = m + std::fma(-0.5f, z, y);
+
+    const float fe = float(e);
+    return std::fma(fe, lg2hi, std::fma(r, log10e, fe * lg2lo));
+}
+
+/*
+ * void log_scale_values(in, begin, end, negative_values, out)
+ *
+ * The loop of the scalar kernel, with the polynomial or with log10f()
+ *
+ */
+template<bool poly>
+__attribute__((always_inline))
+static inline void log_scale_values(const float* in, size_t begin, size_t end, bool negative_values, float* out) {
+    if(negative_values) {
+        for(size_t i=begin; i<end; i++) {
+            const float val = in[i];
+            if(val < -10.0f) {
+                out[i] = poly ? -log10_poly(-val) : -std::log10(-val);
+            } else if(val > 10.0f) {
+                out[i] = poly ? log10_poly(val) : std::log10(val);
+            } else {
+                out[i] = val / 10.0f;
+            }
+        }
+    } else {
+        for(size_t i=begin; i<end; i++) {
+            out[i] = poly ? log10_poly(in[i]) : std::log10(in[i]);
+        }
+    }
+}
+
+/*
+ * float log10(x)
+ *
+ * Reference for the vector kernels: log10 of a positive x, -inf for zero,
+ * inf for inf and NaN for negative values and NaN
+ *
+ */
+float ColorMap::log10(float x) {
+    return log10_poly(x);
+}
+
+/*
+ * void log_scale(in, n, negative_values, out)
+ *
+ * Put n values on the logarithmic scale of the plot
+ *
+ */
+void ColorMap::log_scale(const float* in, size_t n, bool negative_values, float* out) {
+    switch(Trilinear::get_kernel()) {
+        case Trilinear::KERNEL_AVX512:
+            log_scale_avx512(in, n, negative_values, out);
+            break;
+        case Trilinear::KERNEL_AVX2:
+            log_scale_avx2(in, n, negative_values, out);
+            break;
+        default:
+            log_scale_scalar(in, 0, n, negative_values, out);
+            break;
+    }
+}
+
+/*
+ * void lookup(t, in, n, out)
+ *
+ * Turn n values into the pixels of the nearest colors in the table
+ *
+ */
+void ColorMap::lookup(const Table &t, const float* in, size_t n, uint32_t* out) {
+    switch(Trilinear::get_kernel()) {
+        case Trilinear::KERNEL_AVX512:
+            lookup_avx512(t, in, n, out);
+            break;
+        case Trilinear::KERNEL_AVX2:
+            lookup_avx2(t, in, n, out);
+            break;
+        default:
+            lookup_scalar(t, in, 0, n, out);
+            break;
+    }
+}
+
+/*
+ * void log_scale_scalar(in, begin, end, negative_values, out)
+ *
+ * Reference kernel, also used for the values the vector kernels leave;
+ * log10f() of libm without FMA
+ *
+ */
+void ColorMap::log_scale_scalar(const float* in, size_t begin, size_t end, bool negative_values, float* out) {
+    if(Trilinear::has_fma()) {
+        log_scale_scalar_fma(in, begin, end, negative_values, out);
+        return;
+    }
+    log_scale_values<false>(in, begin, end, negative_values, out);
+}
+
+/*
+ * void lookup_scalar(t, in, begin, end, out)
+ *
+ * Reference kernel, also used for the values the vector kernels leave
+ *
+ */
+void ColorMap::lookup_scalar(const Table &t, const float* in, size_t begin, size_t end, uint32_t* out) {
+    const float top = float(t.size - 1);
+    for(size_t i=begin; i<end; i++) {
+        float x = (in[i] - t.low) * t.scale;
+        x = x > 0.0f ? x : 0.0f;    // also for NaN
+        x = x < top ? x : top;
+        out[i] = t.colors[uint32_t(x + 0.5f)];
+    }
+}
+
+#ifdef COLOR_MAP_X86
+
+/*
+ * void log_scale_scalar_fma(in, begin, end, negative_values, out)
+ *
+ * The scalar kernel with std::fma() on the FMA instructions
+ *
+ */
+__attribute__((target("fma")))
+void ColorMap::log_scale_scalar_fma(const float* in, size_t begin, size_t end, bool negative_values, float* out) {
+    log_scale_values<true>(in, begin, end, negative_values, out);
+}
+
+/*
+ * __m256 log10_8(x) and __m512 log10_16(x)
+ *
+ * log10() for eight and sixteen values; the AVX-512 code uses the masked
+ * forms of the instructions to avoid reading undefined source registers
+ *
+ */
+__attribute__((target("avx2,fma")))
+static inline __m256 log10_8(__m256 x) {
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 tiny = _mm256_cmp_ps(x, _mm256_set1_ps(std::numeric_limits<float>::min()), _CMP_LT_OQ);
+    __m256 v = _mm256_blendv_ps(x, _mm256_mul_ps(x, _mm256_set1_ps(8388608.0f)), tiny);
+    __m256i e = _mm256_and_si256(_mm256_castps_si256(tiny), _mm256_set1_epi32(-23));
+
+    const __m256i bits = _mm256_castps_si256(v);
+    e = _mm256_add_epi32(e, _mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(126)));
+    __m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)),
+                                                   _mm256_set1_epi32(0x3F000000)));
+    const __m256 low = _mm256_cmp_ps(m, _mm256_set1_ps(sqrthf), _CMP_LT_OQ);
+    e = _mm256_add_epi32(e, _mm256_castps_si256(low)); // -1 where low
+    m = _mm256_blendv_ps(m, _mm256_add_ps(m, m), low);
+    m = _mm256_sub_ps(m, _mm256_set1_ps(1.0f));
+
+    const __m256 z = _mm256_mul_ps(m, m);
+    __m256 y = _mm256_set1_ps(logp[0]);
+    for(unsigned int i=1; i<9; i++) {
+        y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(logp[i]));
+    }
+    y = _mm256_mul_ps(_mm256_mul_ps(y, m), z);
+    const __m256 r = _mm256_add_ps(m, _mm256_fmadd_ps(_mm256_set1_ps(-0.5f), z, y));
+
+    const __m256 fe = _mm256_cvtepi32_ps(e);
+    __m256 res = _mm256_fmadd_ps(fe, _mm256_set1_ps(lg2hi),
+                                 _mm256_fmadd_ps(r, _mm256_set1_ps(log10e), _mm256_mul_ps(fe, _mm256_set1_ps(lg2lo))));
+
+    const __m256 inf = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+    res = _mm256_blendv_ps(res, inf, _mm256_cmp_ps(x, inf, _CMP_EQ_OQ));
+    res = _mm256_blendv_ps(res, _mm256_set1_ps(-std::numeric_limits<float>::infinity()), _mm256_cmp_ps(x, zero, _CMP_EQ_OQ));
+    res = _mm256_blendv_ps(res, _mm256_set1_ps(std::numeric_limits<float>::quiet_NaN()), _mm256_cmp_ps(x, zero, _CMP_NGE_UQ));
+    return res;
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 log10_16(__m512 x) {
+    const __m512 zero = _mm512_setzero_ps();
+    const __mmask16 tiny = _mm512_cmp_ps_mask(x, _mm512_set1_ps(std::numeric_limits<float>::min()), _CMP_LT_OQ);
+    const __m512 v = _mm512_mask_mul_ps(x, tiny, x, _mm512_set1_ps(8388608.0f));
+    __m512i e = _mm512_maskz_mov_epi32(tiny, _mm512_set1_epi32(-23));
+
+    const __m512i bits = _mm512_castps_si512(v);
+    e = _mm512_add_epi32(e, _mm512_sub_epi32(_mm512_maskz_srli_epi32(0xFFFF, bits, 23), _mm512_set1_epi32(126)));
+    __m512 m = _mm512_castsi512_ps(_mm512_or_si512(_mm512_and_si512(bits, _mm512_set1_epi32(0x007FFFFF)),
+                                                   _mm512_set1_epi32(0x3F000000)));
+    const __mmask16 low = _mm512_cmp_ps_mask(m, _mm512_set1_ps(sqrthf), _CMP_LT_OQ);
+    e = _mm512_mask_sub_epi32(e, low, e, _mm512_set1_epi32(1));
+    m = _mm512_mask_add_ps(m, low, m, m);
+    m = _mm512_sub_ps(m, _mm512_set1_ps(1.0f));
+
+    const __m512 z = _mm512_mul_ps(m, m);
+    __m512 y = _mm512_set1_ps(logp[0]);
+    for(unsigned int i=1; i<9; i++) {
+        y = _mm512_fmadd_ps(y, m, _mm512_set1_ps(logp[i]));
+    }
+    y = _mm512_mul_ps(_mm512_mul_ps(y, m), z);
+    const __m512 r = _mm512_add_ps(m, _mm512_fmadd_ps(_mm512_set1_ps(-0.5f), z, y));
+
+    const __m512 fe = _mm512_maskz_cvtepi32_ps(0xFFFF, e);
+    __m512 res = _mm512_fmadd_ps(fe, _mm512_set1_ps(lg2hi),
+                                 _mm512_fmadd_ps(r, _mm512_set1_ps(log10e), _mm512_mul_ps(fe, _mm512_set1_ps(lg2lo))));
+
+    const __m512 inf = _mm512_set1_ps(std::numeric_limits<float>::infinity());
+    res = _mm512_mask_mov_ps(res, _mm512_cmp_ps_mask(x, inf, _CMP_EQ_OQ), inf);
+    res = _mm512_mask_mov_ps(res, _mm512_cmp_ps_mask(x, zero, _CMP_EQ_OQ),
+                             _mm512_set1_ps(-std::numeric_limits<float>::infinity()));
+    res = _mm512_mask_mov_ps(res, _mm512_cmp_ps_mask(x, zero, _CMP_NGE_UQ),
+                             _mm512_set1_ps(std::numeric_limits<float>::quiet_NaN()));
+    return res;
+}
+
+/*
+ * void log_scale_avx2(in, n, negative_values, out)
+ *
+ * Eight values per iteration
+ *
+ */
+__attribute__((target("avx2,fma")))
+void ColorMap::log_scale_avx2(const float* in, size_t n, bool negative_values, float* out) {
+    size_t i = 0;
+    if(negative_values) {
+        const __m256 sign = _mm256_set1_ps(-0.0f);
+        const __m256 ten = _mm256_set1_ps(10.0f);
+        for(; i + 8 <= n; i += 8) {
+            const __m256 val = _mm256_loadu_ps(in + i);
+            const __m256 mag = _mm256_andnot_ps(sign, val);
+            const __m256 l = _mm256_xor_ps(log10_8(mag), _mm256_and_ps(sign, val));
+            const __m256 big = _mm256_cmp_ps(mag, ten, _CMP_GT_OQ);
+            _mm256_storeu_ps(out + i, _mm256_blendv_ps(_mm256_div_ps(val, ten), l, big));
+        }
+    } else {
+        for(; i + 8 <= n; i += 8) {
+            _mm256_storeu_ps(out + i, log10_8(_mm256_loadu_ps(in + i)));
+        }
+    }
+    log_scale_scalar(in, i, n, negative_values, out);
+}
+
+/*
+ * void log_scale_avx512(in, n, negative_values, out)
+ *
+ * Sixteen values per iteration
+ *
+ */
+__attribute__((target("avx512f")))
+void ColorMap::log_scale_avx512(const float* in, size_t n, bool negative_values, float* out) {
+    size_t i = 0;
+    if(negative_values) {
+        const __m512i sign = _mm512_set1_epi32(int32_t(0x80000000u));
+        const __m512i mask = _mm512_set1_epi32(0x7FFFFFFF);
+        const __m512 ten = _mm512_set1_ps(10.0f);
+        for(; i + 16 <= n; i += 16) {
+            const __m512 val = _mm512_loadu_ps(in + i);
+            const __m512i bits = _mm512_castps_si512(val);
+            const __m512 mag = _mm512_castsi512_ps(_mm512_and_si512(mask, bits));
+            const __m512 l = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(log10_16(mag)),
+                                                                  _mm512_and_si512(sign, bits)));
+            const __mmask16 big = _mm512_cmp_ps_mask(mag, ten, _CMP_GT_OQ);
+            _mm512_storeu_ps(out + i, _mm512_mask_mov_ps(_mm512_div_ps(val, ten), big, l));
+        }
+    } else {
+        for(; i + 16 <= n; i += 16) {
+            _mm512_storeu_ps(out + i, log10_16(_mm512_loadu_ps(in + i)));
+        }
+    }
+    log_scale_scalar(in, i, n, negative_values, out);
+}
+
+/*
+ * void lookup_avx2(t, in, n, out)
+ *
+ * Eight values per iteration, gathering the colors from the table
+ *
+ */
+__attribute__((target("avx2,fma")))
+void ColorMap::lookup_avx2(const Table &t, const float* in, size_t n, uint32_t* out) {
+    const __m256 low = _mm256_set1_ps(t.low);
+    const __m256 scale = _mm256_set1_ps(t.scale);
+    const __m256 top = _mm256_set1_ps(float(t.size - 1));
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const int* colors = reinterpret_cast<const int*>(t.colors);
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(in + i), low), scale);
+        x = _mm256_min_ps(_mm256_max_ps(x, _mm256_setzero_ps()), top); // max() takes zero for NaN
+        const __m256i idx = _mm256_cvttps_epi32(_mm256_add_ps(x, half));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_i32gather_epi32(colors, idx, 4));
+    }
+    lookup_scalar(t, in, i, n, out);
+}
+
+/*
+ * void lookup_avx512(t, in, n, out)
+ *
+ * Sixteen values per iteration, gathering the colors from the table
+ *
+ */
+__attribute__((target("avx512f")))
+void ColorMap::lookup_avx512(const Table &t, const float* in, size_t n, uint32_t* out) {
+    const __m512 low = _mm512_set1_ps(t.low);
+    const __m512 scale = _mm512_set1_ps(t.scale);
+    const __m512 top = _mm512_set1_ps(float(t.size - 1));
+    const __m512 half = _mm512_set1_ps(0.5f);
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        __m512 x = _mm512_mul_ps(_mm512_sub_ps(_mm512_loadu_ps(in + i), low), scale);
+        x = _mm512_maskz_min_ps(0xFFFF, _mm512_maskz_max_ps(0xFFFF, x, _mm512_setzero_ps()), top);
+        const __m512i idx = _mm512_maskz_cvttps_epi32(0xFFFF, _mm512_add_ps(x, half));
+        _mm512_storeu_si512(out + i, _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), 0xFFFF, idx, t.colors, 4));
+    }
+    lookup_scalar(t, in, i, n, out);
+}
+
+#else
+
+void ColorMap::log_scale_scalar_fma(const float* in, size_t begin, size_t end, bool negative_values, float* out) {
+    log_scale_values<true>(in, begin, end, negative_values, out);
+}
+
+void ColorMap::log_scale_avx2(const float* in, size_t n, bool negative_values, float* out) {
+    log_scale_scalar(in, 0, n, negative_values, out);
+}
+
+void ColorMap::log_scale_avx512(const float* in, size_t n, bool negative_values, float* out) {
+    log_scale_scalar(in, 0, n, negative_values, out);
+}
+
+void ColorMap::lookup_avx2(const Table &t, const float* in, size_t n, uint32_t* out) {
+    lookup_scalar(t, in, 0, n, out);
+}
+
+void ColorMap::lookup_avx512(const Table &t, const float* in, size_t n, uint32_t* out) {
+    lookup_scalar(t, in, 0, n, out);
+}
+
+#endif
@@ -0,0 +1,414 @@
+/**************************************************************************
+ *   compressed_stream.cpp                                                *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#include "compressed_stream.h"
+
+#include <cstring>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <lzma.h>
+
+static const size_t chunk_size = 1 << 20;      // bytes per decompressed chunk
+static const size_t input_size = 256 * 1024;   // bytes per read of compressed data
+static const size_t max_queued = 8;            // chunks the worker may run ahead
+
+/*
+ * Constructor
+ *
+ * Creates a closed stream buffer; see open()
+ *
+ */
+CompressedStreambuf::CompressedStreambuf() {
+    this->codec = CODEC_NONE;
+    this->file = NULL;
+    this->current = NULL;
+    this->finished = true;
+    this->failed = false;
+    this->stop = false;
+    this->delivered = 0;
+}
+
+/*
+ * Destructor
+ *
+ * Stops the worker thread and closes the file
+ *
+ */
+CompressedStreambuf::~CompressedStreambuf() {
+    this->close();
+}
+
+/*
+ * bool open(filename, codec)
+ *
+ * Open a compressed file and start decompressing it in the background
+ *
+ */
+bool CompressedStreambuf::open(const std::string &filename, Codec _codec) {
+    this->close();
+
+    if(_codec == CODEC_NONE) {
+        return false;
+    }
+
+    this->file = fopen(filename.c_str(), "rb");
+    if(this->file == NULL) {
+        return false;
+    }
+
+    this->codec = _codec;
+    this->finished = false;
+    this->failed = false;
+    this->stop = false;
+    this->delivered = 0;
+    this->worker = std::thread(&CompressedStreambuf::run, this);
+
+    return true;
+}
+
+/*
+ * void close()
+ *
+ * Stop the worker thread, release all pending chunks and close the file
+ *
+ */
+void CompressedStreambuf::close() {
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->stop = true;
+    }
+    this->cv_drained.notify_all();
+    if(this->worker.joinable()) {
+        this->worker.join();
+    }
+
+    while(!this->queue.empty()) {
+        delete this->queue.front();
+        this->queue.pop_front();
+    }
+    delete this->current;
+    this->current = NULL;
+    this->setg(NULL, NULL, NULL);
+
+    if(this->file != NULL) {
+        fclose(this->file);
+        this->file = NULL;
+    }
+}
+
+/*
+ * bool has_failed()
+ *
+ * Whether the worker ran into corrupt or truncated input
+ *
+ */
+bool CompressedStreambuf::has_failed() {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    return this->failed;
+}
+
+/*
+ * Codec detect(filename)
+ *
+ * Determine the compression of a file from its magic bytes. Only regular
+ * files are inspected, as peeking into a pipe would consume its data.
+ *
+ */
+CompressedStreambuf::Codec CompressedStreambuf::detect(const std::string &filename) {
+    struct stat st;
+    if(stat(filename.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return CODEC_NONE;
+    }
+
+    unsigned char magic[6] = {0, 0, 0, 0, 0, 0};
+    FILE* f = fopen(filename.c_str(), "rb");
+    if(f == NULL) {
+        return CODEC_NONE;
+    }
+    size_t n = fread(magic, 1, sizeof(magic), f);
+    fclose(f);
+
+    static const unsigned char xz_magic[6] = {0xFD, '7', 'z', 'X', 'Z', 0x00};
+    if(n >= 2 && magic[0] == 0x1F && magic[1] == 0x8B) {
+        return CODEC_GZIP;
+    }
+    if(n == 6 && memcmp(magic, xz_magic, 6) == 0) {
+        return CODEC_XZ;
+    }
+    return CODEC_NONE;
+}
+
+/*
+ * int_type underflow()
+ *
+ * Hand the next decompressed chunk to the stream, waiting for the worker
+ * when it has not produced one yet
+ *
+ */
+CompressedStreambuf::int_type CompressedStreambuf::underflow() {
+    if(this->gptr() < this->egptr()) {
+        return traits_type::to_int_type(*this->gptr());
+    }
+
+    std::unique_lock<std::mutex> lock(this->mtx);
+    if(this->current != NULL) {
+        this->delivered += this->current->size();
+        delete this->current;
+        this->current = NULL;
+    }
+
+    while(this->queue.empty() && !this->finished) {
+        this->cv_filled.wait(lock);
+    }
+    if(this->queue.empty()) {
+        this->setg(NULL, NULL, NULL);
+        return traits_type::eof();
+    }
+
+    this->current = this->queue.front();
+    this->queue.pop_front();
+    lock.unlock();
+    this->cv_drained.notify_one();
+
+    char* begin = &(*this->current)[0];
+    this->setg(begin, begin, begin + this->current->size());
+    return traits_type::to_int_type(*this->gptr());
+}
+
+/*
+ * pos_type seekoff(off, dir, which)
+ *
+ * Only supports querying the current position (i.e. tellg()), which is
+ * the number of decompressed bytes consumed so far
+ *
+ */
+CompressedStreambuf::pos_type CompressedStreambuf::seekoff(off_type off, std::ios_base::seekdir dir,
+                                                           std::ios_base::openmode which) {
+    if(off != 0 || dir != std::ios_base::cur || !(which & std::ios_base::in)) {
+        return pos_type(off_type(-1));
+    }
+    return pos_type(off_type(this->delivered + (this->gptr() - this->eback())));
+}
+
+/*
+ * void run()
+ *
+ * Body of the worker thread
+ *
+ */
+void CompressedStreambuf::run() {
+    bool ok = (this->codec == CODEC_GZIP) ? this->run_gzip() : this->run_xz();
+
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->finished = true;
+    this->failed = !ok;
+    this->cv_filled.notify_all();
+}
+
+/*
+ * bool run_gzip()
+ *
+ * Inflate a gzip (or zlib) file, including files that consist of several
+ * concatenated gzip members
+ *
+ */
+bool CompressedStreambuf::run_gzip() {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if(inflateInit2(&zs, 15 + 32) != Z_OK) {   // 32: detect gzip or zlib header
+        return false;
+    }
+
+    std::vector<unsigned char> in(input_size);
+    std::vector<char>* out = new std::vector<char>(chunk_size);
+    size_t used = 0;
+    int ret = Z_OK;
+    bool ok = true;
+
+    while(true) {
+        if(zs.avail_in == 0) {
+            size_t n = fread(&in[0], 1, in.size(), this->file);
+            if(n == 0) {
+                ok = (ret == Z_STREAM_END) && !ferror(this->file);
+                break;
+            }
+            zs.next_in = &in[0];
+            zs.avail_in = n;
+        }
+
+        if(ret == Z_STREAM_END) {
+            inflateReset(&zs);  // the next gzip member follows
+        }
+
+        zs.next_out = reinterpret_cast<Bytef*>(&(*out)[used]);
+        zs.avail_out = chunk_size - used;
+        ret = inflate(&zs, Z_NO_FLUSH);
+        if(ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            ok = false;
+            break;
+        }
+
+        used = chunk_size - zs.avail_out;
+        if(used == chunk_size) {
+            if(!this->push(out)) {
+                out = NULL;
+                break;
+            }
+            out = new std::vector<char>(chunk_size);
+            used = 0;
+        }
+    }
+    inflateEnd(&zs);
+
+    if(out != NULL) {
+        out->resize(used);
+        if(used > 0) {
+            this->push(out);
+        } else {
+            delete out;
+        }
+    }
+
+    return ok;
+}
+
+/*
+ * bool run_xz()
+ *
+ * Decompress an xz file (possibly consisting of concatenated streams)
+ *
+ */
+bool CompressedStreambuf::run_xz() {
+    lzma_stream strm = LZMA_STREAM_INIT;
+    if(lzma_stream_decoder(&strm, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK) {
+        return false;
+    }
+
+    std::vector<unsigned char> in(input_size);
+    std::vector<char>* out = new std::vector<char>(chunk_size);
+    size_t used = 0;
+    lzma_action action = LZMA_RUN;
+    bool ok = true;
+
+    while(true) {
+        if(strm.avail_in == 0 && action == LZMA_RUN) {
+            size_t n = fread(&in[0], 1, in.size(), this->file);
+            if(n < in.size()) {
+                if(ferror(this->file)) {
+                    ok = false;
+                    break;
+                }
+                action = LZMA_FINISH;
+            }
+            strm.next_in = &in[0];
+            strm.avail_in = n;
+        }
+
+        strm.next_out = reinterpret_cast<uint8_t*>(&(*out)[used]);
+        strm.avail_out = chunk_size - used;
+        lzma_ret ret = lzma_code(&strm, action);
+
+        used = chunk_size - strm.avail_out;
+        if(used == chunk_size) {
+            if(!this->push(out)) {
+                out = NULL;
+                break;
+            }
+            out = new std::vector<char>(chunk_size);
+            used = 0;
+        }
+
+        if(ret == LZMA_STREAM_END) {
+            break;
+        }
+        if(ret != LZMA_OK) {
+            ok = false;
+            break;
+        }
+    }
+    lzma_end(&strm);
+
+    if(out != NULL) {
+        out->resize(used);
+        if(used > 0) {
+            this->push(out);
+        } else {
+            delete out;
+        }
+    }
+
+    return ok;
+}
+
+/*
+ * bool push(chunk)
+ *
+ * Queue a decompressed chunk, waiting while the reader is too far behind.
+ * Takes ownership of the chunk. Returns false when the reader has gone
+ * away and the worker should stop.
+ *
+ */
+bool CompressedStreambuf::push(std::vector<char>* chunk) {
+    std::unique_lock<std::mutex> lock(this->mtx);
+    while(this->queue.size() >= max_queued && !this->stop) {
+        this->cv_drained.wait(lock);
+    }
+    if(this->stop) {
+        delete chunk;
+        return false;
+    }
+    this->queue.push_back(chunk);
+    this->cv_filled.notify_one();
+    return true;
+}
+
+/*
+ * Constructor
+ *
+ * Creates a closed stream; see open()
+ *
+ */
+CompressedStream::CompressedStream() : std::istream(NULL) {
+    this->rdbuf(&this->buf);
+}
+
+/*
+ * bool open(filename, codec)
+ *
+ * Open a compressed file for reading
+ *
+ */
+bool CompressedStream::open(const std::string &filename, CompressedStreambuf::Codec codec) {
+    if(!this->buf.open(filename, codec)) {
+        this->setstate(std::ios_base::failbit);
+        return false;
+    }
+    this->clear();
+    return true;
+}
+
+bool CompressedStream::has_failed() {
+    return this->buf.has_failed();
+}
+
+CompressedStreambuf::Codec CompressedStream::detect(const std::string &filename) {
+    return CompressedStreambuf::detect(filename);
+}
@@ -0,0 +1,136 @@
+/**************************************************************************
+ *   cube_reader.cpp                                                      *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#include "cube_reader.h"
+
+#include <cstdlib>
+#include <sstream>
+
+static const double bohr = 0.529177210903; // angstrom
+
+/*
+ * bool read_header(infile, header, debug)
+ *
+ * Read everything up to the first value. The unit cell is set to the
+ * box spanned by the grid points, i.e. (n-1) steps along each axis, so
+ * that the first and the last point of every axis map onto the faces of
+ * the cell. Returns false for malformed headers and for files with more
+ * than one value per point (several orbitals), which are not supported.
+ *
+ */
+bool CubeReader::read_header(std::istream &infile, GridHeader &header, bool debug) {
+    if(debug) std::cout << "Reading cube header...\t\t\t";
+    std::string line;
+    std::getline(infile, line); // two comment lines
+    std::getline(infile, line);
+
+    std::getline(infile, line);
+    std::istringstream atomline(line);
+    int natoms = 0;
+    double origin[3];
+    atomline >> natoms >> origin[0] >> origin[1] >> origin[2];
+    if(!atomline) {
+        if(debug) std::cout << "[Failed]" << std::endl;
+        return false;
+    }
+    int nval = 1;
+    if(!(atomline >> nval)) {
+        nval = 1;
+    }
+
+    double unit = bohr;
+    for(unsigned int i=0; i<3; i++) {
+        std::getline(infile, line);
+        std::istringstream axisline(line);
+        int n = 0;
+        double v[3];
+        axisline >> n >> v[0] >> v[1] >> v[2];
+        if(!axisline || std::abs(n) < 2) {
+            if(debug) std::cout << "[Failed]" << std::endl;
+            return false;
+        }
+        if(i == 0 && n < 0) {
+            unit = 1.0; // negative counts denote angstrom
+        }
+
+        header.grid_dimensions[i] = std::abs(n);
+        for(unsigned int j=0; j<3; j++) {
+            header.mat[i][j] = v[j] * unit * double(std::abs(n) - 1);
+        }
+    }
+    for(unsigned int j=0; j<3; j++) {
+        header.origin[j] = origin[j] * unit;
+    }
+    header.scalar = 1.0;
+    header.closed_grid = true;
+
+    // one line per atom: atomic number, charge and position; consecutive
+    // atoms of the same element are counted together
+    int last = -1;
+    for(int a=0; a<std::abs(natoms); a++) {
+        std::getline(infile, line);
+        int z = atoi(line.c_str());
+        if(z != last) {
+            header.nrat.push_back(0);
+            last = z;
+        }
+        header.nrat.back()++;
+    }
+
+    // orbital files list the orbitals in front of the data
+    int norbitals = 1;
+    if(natoms < 0) {
+        std::getline(infile, line);
+        norbitals = atoi(line.c_str());
+    }
+
+    if(!infile || norbitals != 1 || nval != 1) {
+        if(debug) std::cout << "[Failed]" << std::endl;
+        if(norbitals != 1 || nval != 1) {
+            std::cerr << "ERROR: Cube files with more than one value per point are not supported" << std::endl;
+        }
+        return false;
+    }
+
+    if(debug) std::cout << "[Done]" << std::endl;
+    if(debug) std::cout << "GRID: " << header.grid_dimensions[0] << "x" <<
+                                       header.grid_dimensions[1] << "x" <<
+                                       header.grid_dimensions[2] << std::endl;
+    return true;
+}
+
+/*
+ * GridLayout get_layout(header)
+ *
+ * Every row along z is a record; there is a single block
+ *
+ */
+GridLayout CubeReader::get_layout(const GridHeader &header) const {
+    GridLayout layout;
+    layout.record = header.grid_dimensions[2];
+    layout.z_fastest = true;
+    layout.spin_blocks = false;
+    return layout;
+}
+
+const char* CubeReader::get_name() const {
+    return "Gaussian cube";
+}
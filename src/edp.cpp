@@ -32,10 +32,14 @@
  */
 
 #include <iostream>
+#include <fstream>
+#include <mutex>
 #include <tclap/CmdLine.h> // parsing command line arguments
 #include "mathtools.h"
 #include "scalar_field.h"
 #include "planeprojector.h"
+#include "profiler.h"
+#include "job_list.h"
 
 int main(int argc, char *argv[]) {
     // command line grabbing
@@ -45,9 +49,9 @@ int main(int argc, char *argv[]) {
         //**************************************
         // declare values to be parsed
         //**************************************
-        TCLAP::ValueArg<std::string> arg_output_filename("o","filename","Filename to print to",true,"test.png","string");
+        TCLAP::ValueArg<std::string> arg_output_filename("o","filename","Filename to print to",false,"test.png","string");
         cmd.add(arg_output_filename);
-        TCLAP::ValueArg<std::string> arg_sp("p","starting_point","Start point of cutting plane",true,"(0.5,0.5,0.5)","3d-vector");
+        TCLAP::ValueArg<std::string> arg_sp("p","starting_point","Start point of cutting plane",false,"(0.5,0.5,0.5)","3d-vector");
         cmd.add(arg_sp);
         TCLAP::ValueArg<std::string> arg_v("v","vector1","Plane Vector 1",true,"(1,0,0)","3d-vector");
         cmd.add(arg_v);
@@ -55,22 +59,129 @@ int main(int argc, char *argv[]) {
         cmd.add(arg_w);
         TCLAP::ValueArg<unsigned int> arg_s("s","scale","Scaling in px/angstrom",true, 200,"unsigned integer");
         cmd.add(arg_s);
-        TCLAP::ValueArg<std::string> arg_input_filename("i","input","Input file (i.e. CHGCAR)",true,"CHGCAR","filename");
+        TCLAP::MultiArg<std::string> arg_input_filename("i","input","Input file (i.e. CHGCAR, - for standard input), repeat for several files; name=file names the grid for the expression (default A, B, C, ...)",true,"filename");
         cmd.add(arg_input_filename);
+        TCLAP::ValueArg<std::string> arg_expression("e","expression","Element-wise expression over the input files, i.e. \"AB - A - B\" (default: the first file)",false,"","string");
+        cmd.add(arg_expression);
         TCLAP::SwitchArg arg_negative("n","negative_values","CHGCAR can contain negative values", cmd, false);
+        TCLAP::ValueArg<unsigned int> arg_threads("t","threads","Number of threads for reading and extracting the plane (0 = all cores)",false,0,"unsigned integer");
+        cmd.add(arg_threads);
+        std::vector<std::string> spin_modes;
+        spin_modes.push_back("total");
+        spin_modes.push_back("up");
+        spin_modes.push_back("down");
+        spin_modes.push_back("magnetization");
+        TCLAP::ValuesConstraint<std::string> spin_constraint(spin_modes);
+        TCLAP::ValueArg<std::string> arg_spin("","spin","Density to plot for spin polarized files",false,"total",&spin_constraint);
+        cmd.add(arg_spin);
+        TCLAP::SwitchArg arg_cache("c","cache","Keep a binary copy of the grid next to the input file for faster reloading", cmd, false);
+        TCLAP::SwitchArg arg_roi("","roi","Only load the part of the grid the cutting plane passes through", cmd, false);
+        TCLAP::SwitchArg arg_periodic("","periodic","Repeat the unit cell periodically instead of leaving the space around it blank", cmd, false);
+        std::vector<std::string> precisions;
+        precisions.push_back("fp32");
+        precisions.push_back("fp16");
+        precisions.push_back("q16");
+        TCLAP::ValuesConstraint<std::string> precision_constraint(precisions);
+        TCLAP::ValueArg<std::string> arg_precision("","precision","Precision of the grid in memory",false,"fp32",&precision_constraint);
+        cmd.add(arg_precision);
+        std::vector<std::string> layouts;
+        layouts.push_back("linear");
+        layouts.push_back("brick");
+        TCLAP::ValuesConstraint<std::string> layout_constraint(layouts);
+        TCLAP::ValueArg<std::string> arg_layout("","layout","Order of a fp32 grid in memory (brick: 8x8x8 blocks, faster for oblique planes on large grids)",false,"linear",&layout_constraint);
+        cmd.add(arg_layout);
+        std::vector<std::string> interpolations;
+        interpolations.push_back("linear");
+        interpolations.push_back("cubic");
+        TCLAP::ValuesConstraint<std::string> interpolation_constraint(interpolations);
+        TCLAP::ValueArg<std::string> arg_interpolation("","interpolation","Interpolation between the grid points (cubic: smooth B-spline, prefiltered once)",false,"linear",&interpolation_constraint);
+        cmd.add(arg_interpolation);
+        std::vector<std::string> formats;
+        formats.push_back("auto");
+        formats.push_back("vasp");
+        formats.push_back("cube");
+        TCLAP::ValuesConstraint<std::string> format_constraint(formats);
+        TCLAP::ValueArg<std::string> arg_format("","format","Format of the input files (CHGCAR, LOCPOT, ELFCAR and PARCHG are vasp)",false,"auto",&format_constraint);
+        cmd.add(arg_format);
+        std::vector<unsigned int> png_levels;
+        for(unsigned int l=0; l<=9; l++) {
+            png_levels.push_back(l);
+        }
+        TCLAP::ValuesConstraint<unsigned int> png_level_constraint(png_levels);
+        TCLAP::ValueArg<unsigned int> arg_png_level("","png_level","Compression level of the image (0: store only, 1: fastest, 9: smallest)",false,6,&png_level_constraint);
+        cmd.add(arg_png_level);
+        std::vector<std::string> png_filters;
+        png_filters.push_back("none");
+        png_filters.push_back("sub");
+        png_filters.push_back("up");
+        png_filters.push_back("average");
+        png_filters.push_back("paeth");
+        png_filters.push_back("adaptive");
+        TCLAP::ValuesConstraint<std::string> png_filter_constraint(png_filters);
+        TCLAP::ValueArg<std::string> arg_png_filter("","png_filter","Row filter of the image (none: fastest and best for the color bands of a plot; adaptive: the best one for every row)",false,"none",&png_filter_constraint);
+        cmd.add(arg_png_filter);
+        TCLAP::ValueArg<std::string> arg_dump("","dump","Also write the values of the plane to <prefix>_real and <prefix>_log (<prefix>_<frame>_real and _log with --jobs)",false,"","prefix");
+        cmd.add(arg_dump);
+        std::vector<std::string> dump_formats;
+        dump_formats.push_back("npy");
+        dump_formats.push_back("raw");
+        TCLAP::ValuesConstraint<std::string> dump_constraint(dump_formats);
+        TCLAP::ValueArg<std::string> arg_dump_format("","dump_format","Format of the values of the plane (npy: NumPy array, raw: float32 after a 64 byte header)",false,"npy",&dump_constraint);
+        cmd.add(arg_dump_format);
+        TCLAP::ValueArg<std::string> arg_jobs("","jobs","Render many frames from the same input: a file (- for standard input) with a line \"output point [vector1 vector2 [scale]]\" per frame, the command line gives the rest",false,"","filename");
+        cmd.add(arg_jobs);
+        std::vector<std::string> profile_formats;
+        profile_formats.push_back("text");
+        profile_formats.push_back("json");
+        TCLAP::ValuesConstraint<std::string> profile_constraint(profile_formats);
+        TCLAP::SwitchArg arg_profile("","profile","Report time, throughput, memory and hardware counters of every phase", cmd, false);
+        TCLAP::ValueArg<std::string> arg_profile_format("","profile_format","Format of the profile",false,"text",&profile_constraint);
+        cmd.add(arg_profile_format);
+        TCLAP::ValueArg<std::string> arg_profile_output("","profile_output","File to write the profile to (default: standard output)",false,"","filename");
+        cmd.add(arg_profile_output);
 
         cmd.parse(argc, argv);
 
         //**************************************
         // parsing values
         //**************************************
-        std::string input_filename = arg_input_filename.getValue();
+        std::vector<std::string> input_names;
+        std::vector<std::string> input_filenames;
+        for(unsigned int i=0; i<arg_input_filename.getValue().size(); i++) {
+            std::string input = arg_input_filename.getValue()[i];
+            size_t eq = input.find('=');
+            if(eq != std::string::npos) {
+                input_names.push_back(input.substr(0, eq));
+                input_filenames.push_back(input.substr(eq + 1));
+            } else {
+                input_names.push_back(std::string(1, char('A' + i % 26)) + (i < 26 ? "" : std::to_string(i / 26)));
+                input_filenames.push_back(input);
+            }
+        }
+
+        GridExpression expression;
+        bool use_expression = arg_expression.isSet();
+        if(use_expression && !expression.parse(arg_expression.getValue(), input_names)) {
+            return -1;
+        }
+        if(!use_expression && input_filenames.size() > 1) {
+            std::cerr << "ERROR: Several input files need an expression (-e) to combine them" << std::endl;
+            return -1;
+        }
         std::string output_filename = arg_output_filename.getValue();
+        std::string jobs_filename = arg_jobs.getValue();
+        bool use_jobs = arg_jobs.isSet();
+        if(!use_jobs && (!arg_output_filename.isSet() || !arg_sp.isSet())) {
+            std::cerr << "ERROR: An output file (-o) and a starting point (-p) are needed without --jobs" << std::endl;
+            return -1;
+        }
 
         pcrecpp::RE re("^([0-9.-]+),([0-9.-]+),([0-9.-]+)$");
         std::string sp = arg_sp.getValue();
-        float sp_in[3];
-        re.FullMatch(sp.c_str() , &sp_in[0], &sp_in[1], &sp_in[2]);
+        float sp_in[3] = {0, 0, 0};
+        if(arg_sp.isSet()) {
+            re.FullMatch(sp.c_str() , &sp_in[0], &sp_in[1], &sp_in[2]);
+        }
         Vector s(sp_in[0],sp_in[1],sp_in[2]);
 
         std::string v = arg_v.getValue();
@@ -87,6 +198,88 @@ int main(int argc, char *argv[]) {
 
         bool negative_values = arg_negative.getValue();
 
+        unsigned int threads = arg_threads.getValue();
+        bool use_cache = arg_cache.getValue();
+        bool use_roi = arg_roi.getValue();
+        bool periodic = arg_periodic.getValue();
+
+        int png_level = arg_png_level.getValue();
+        PngWriter::Filter png_filter = PngWriter::FILTER_NONE;
+        if(arg_png_filter.getValue() == "adaptive") {
+            png_filter = PngWriter::FILTER_ADAPTIVE;
+        } else if(arg_png_filter.getValue() == "sub") {
+            png_filter = PngWriter::FILTER_SUB;
+        } else if(arg_png_filter.getValue() == "up") {
+            png_filter = PngWriter::FILTER_UP;
+        } else if(arg_png_filter.getValue() == "average") {
+            png_filter = PngWriter::FILTER_AVERAGE;
+        } else if(arg_png_filter.getValue() == "paeth") {
+            png_filter = PngWriter::FILTER_PAETH;
+        }
+
+        std::string dump_prefix = arg_dump.getValue();
+        PlaneWriter::Format dump_format = (arg_dump_format.getValue() == "raw") ?
+                                          PlaneWriter::FORMAT_RAW :
+                                          PlaneWriter::FORMAT_NPY;
+
+        bool use_profile = arg_profile.getValue();
+        bool profile_json = (arg_profile_format.getValue() == "json");
+        std::string profile_output = arg_profile_output.getValue();
+
+        ScalarField::SpinMode spin_mode = ScalarField::SPIN_TOTAL;
+        if(arg_spin.getValue() == "up") {
+            spin_mode = ScalarField::SPIN_UP;
+        } else if(arg_spin.getValue() == "down") {
+            spin_mode = ScalarField::SPIN_DOWN;
+        } else if(arg_spin.getValue() == "magnetization") {
+            spin_mode = ScalarField::SPIN_MAGNETIZATION;
+        }
+
+        GridStorage::Precision precision = GridStorage::PRECISION_FP32;
+        if(arg_precision.getValue() == "fp16") {
+            precision = GridStorage::PRECISION_FP16;
+        } else if(arg_precision.getValue() == "q16") {
+            precision = GridStorage::PRECISION_Q16;
+        }
+        bool use_bricks = (arg_layout.getValue() == "brick");
+        ScalarField::Interpolation interpolation = (arg_interpolation.getValue() == "cubic") ?
+                                                   ScalarField::INTERPOLATION_CUBIC :
+                                                   ScalarField::INTERPOLATION_LINEAR;
+
+        // the frames of a job file are read from the same field
+        JobList jobs;
+        JobList::Job defaults;
+        defaults.output = output_filename;
+        defaults.s = s;
+        defaults.v1 = v1;
+        defaults.v2 = v2;
+        defaults.scale = scale;
+        if(use_jobs) {
+            if(!jobs.read(jobs_filename, defaults)) {
+                return -1;
+            }
+        } else {
+            jobs.add(defaults);
+        }
+        if(use_roi && use_jobs) {
+            std::cout << "Reading whole grids: --roi does not apply to --jobs" << std::endl;
+            use_roi = false;
+        }
+
+        // the inputs of an expression are read without the margin the
+        // B-spline prefilter needs around the plane
+        if(use_roi && use_expression && interpolation == ScalarField::INTERPOLATION_CUBIC) {
+            std::cout << "Reading whole grids: --roi does not apply to cubic interpolation of an expression" << std::endl;
+            use_roi = false;
+        }
+
+        GridReader::Format format = GridReader::FORMAT_AUTO;
+        if(arg_format.getValue() == "vasp") {
+            format = GridReader::FORMAT_VASP;
+        } else if(arg_format.getValue() == "cube") {
+            format = GridReader::FORMAT_CUBE;
+        }
+
         //**************************************
         // start running the program
         //**************************************
@@ -94,11 +287,11 @@ int main(int argc, char *argv[]) {
 
         std::cout << "Lattice v1: " << v_in[0] << "," << v_in[1] << "," << v_in[2] << std::endl;
         std::cout << "Lattice v2: " << w_in[0] << "," << w_in[1] << "," << w_in[2] << std::endl;
-        std::cout << "Start point: " << sp_in[0] << "," << sp_in[1] << "," << sp_in[2] << std::endl;
-
-        // read in field
-        ScalarField sf(input_filename.c_str());
-        sf.read(true);
+        if(use_jobs) {
+            std::cout << "Frames: " << jobs.size() << " from " << jobs_filename << std::endl;
+        } else {
+            std::cout << "Start point: " << sp_in[0] << "," << sp_in[1] << "," << sp_in[2] << std::endl;
+        }
 
         // define intervals in Angstrom
         float interval = 20.0;
@@ -107,15 +300,173 @@ int main(int argc, char *argv[]) {
         float lj = -interval;
         float hj = interval;
 
+        // the part of the plane that is going to be sampled
+        Vector n1 = v1;
+        Vector n2 = v2;
+        n1.normalize();
+        n2.normalize();
+        XYZ corner, edge1, edge2;
+        corner.x = s[0] + n1[0] * li + n2[0] * lj;
+        corner.y = s[1] + n1[1] * li + n2[1] * lj;
+        corner.z = s[2] + n1[2] * li + n2[2] * lj;
+        edge1.x = n1[0] * (hi - li);
+        edge1.y = n1[1] * (hi - li);
+        edge1.z = n1[2] * (hi - li);
+        edge2.x = n2[0] * (hj - lj);
+        edge2.y = n2[1] * (hj - lj);
+        edge2.z = n2[2] * (hj - lj);
+
+        Profiler profiler;
+
+        // one pool of threads prefilters the grids and renders the planes
+        ThreadPool pool(threads);
+
+        // read in fields
+        std::vector<ScalarField*> fields;
+        for(unsigned int i=0; i<input_filenames.size(); i++) {
+            ScalarField* field = new ScalarField(input_filenames[i].c_str());
+            field->set_threads(threads);
+            field->set_thread_pool(&pool);
+            field->set_cache(use_cache);
+            field->set_spin_mode(spin_mode);
+            field->set_format(format);
+            field->set_periodic(periodic);
+            if(use_roi) {
+                field->set_region(corner, edge1, edge2);
+            }
+            if(!use_expression) {
+                field->set_precision(precision);
+                field->set_bricks(use_bricks);
+                field->set_interpolation(interpolation);
+            }
+            // the other inputs of an expression are parsed while it is
+            // evaluated, if their files allow it, into the grid of the first
+            if(use_profile) profiler.start("read");
+            bool loaded = true;
+            if(i == 0 || !use_expression || !field->open_values(true)) {
+                loaded = field->read(true);
+            }
+            if(use_profile) profiler.stop("read", field->get_bytes_read(), field->get_gridsize(), "values");
+            fields.push_back(field);
+            if(!loaded) {
+                for(unsigned int j=0; j<fields.size(); j++) {
+                    delete fields[j];
+                }
+                return -1;
+            }
+        }
+
+        // combine all fields into the first one and release the others
+        ScalarField &sf = *fields[0];
+        bool evaluated = true;
+        if(use_expression) {
+            sf.set_precision(precision);
+            sf.set_bricks(use_bricks);
+            sf.set_interpolation(interpolation);
+            if(use_profile) profiler.start("evaluate");
+            evaluated = sf.evaluate(expression, fields, true);
+            if(use_profile) profiler.stop("evaluate", 0, size_t(sf.get_gridsize()) * fields.size(), "values");
+        }
+        for(unsigned int i=1; i<fields.size(); i++) {
+            delete fields[i];
+        }
+        if(!evaluated) {
+            delete fields[0];
+            return -1;
+        }
+
         float color_interval = 5;
+        unsigned int bins = int(color_interval + 1)*2;
+
+        ColorScheme scheme(-color_interval, color_interval);
+        bool written = true;
+        if(!use_jobs) {
+            PlaneProjector pp(&sf, &scheme, -color_interval, color_interval);
+            pp.set_thread_pool(&pool);
+            if(use_profile) {
+                pp.set_profiler(&profiler);
+            }
+            pp.set_png(png_level, png_filter);
+            pp.set_keep_planes(!dump_prefix.empty());
+            pp.set_plane(v1, v2, s, scale, li, hi, lj, hj);
+            pp.render(bins, negative_values);
+            written = pp.write(output_filename);
+            if(!dump_prefix.empty()) {
+                written = pp.write_planes(dump_prefix, dump_format) && written;
+            }
+        } else {
+            // with a frame for every thread the frames run at once, each
+            // on a single thread; otherwise one after the other, each on
+            // all threads. A projector keeps its image (and planes) from
+            // frame to frame and is handed to the next range of frames.
+            bool concurrent = (pool.get_threads() > 1 && jobs.size() >= pool.get_threads());
+            std::cout << "Rendering " << jobs.size() << " frames " << (concurrent ? "at once" : "one by one")
+                      << " on " << pool.get_threads() << " thread(s)" << std::endl;
+            std::mutex mtx;
+            std::vector<PlaneProjector*> projectors;
+            std::vector<PlaneProjector*> idle;
+            unsigned int done = 0;
+            size_t pixels = 0;
+            ThreadPool::Body render_frames = [&](unsigned int begin, unsigned int end) {
+                PlaneProjector* pp;
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    if(idle.empty()) {
+                        pp = new PlaneProjector(&sf, &scheme, -color_interval, color_interval);
+                        pp->set_thread_pool(concurrent ? NULL : &pool);
+                        pp->set_verbose(false);
+                        pp->set_png(png_level, png_filter);
+                        pp->set_keep_planes(!dump_prefix.empty());
+                        projectors.push_back(pp);
+                    } else {
+                        pp = idle.back();
+                        idle.pop_back();
+                    }
+                }
+                for(unsigned int k=begin; k<end; k++) {
+                    const JobList::Job &job = jobs[k];
+                    pp->set_plane(job.v1, job.v2, job.s, job.scale, li, hi, lj, hj);
+                    pp->render(bins, negative_values);
+                    bool ok = pp->write(job.output);
+                    if(!dump_prefix.empty()) {
+                        ok = pp->write_planes(dump_prefix + "_" + std::to_string(k), dump_format) && ok;
+                    }
+                    std::lock_guard<std::mutex> lock(mtx);
+                    written = written && ok;
+                    done++;
+                    pixels += pp->get_pixels();
+                    std::cout << "[" << done << "/" << jobs.size() << "] " << job.output << std::endl;
+                }
+                std::lock_guard<std::mutex> lock(mtx);
+                idle.push_back(pp);
+            };
+
+            if(use_profile) profiler.start("jobs");
+            if(concurrent) {
+                pool.parallel_for(jobs.size(), 1, render_frames);
+            } else {
+                render_frames(0, jobs.size());
+            }
+            if(use_profile) profiler.stop("jobs", 0, pixels, "pixels");
+            for(unsigned int i=0; i<projectors.size(); i++) {
+                delete projectors[i];
+            }
+        }
 
-        PlaneProjector pp(&sf, -color_interval, color_interval);
-        pp.extract(v1, v2, s, scale, li, hi, lj, hj, negative_values);
-        pp.plot();
-        pp.isolines(int(color_interval + 1)*2, negative_values);
-        pp.write(output_filename);
+        if(use_profile) {
+            if(profile_output.empty()) {
+                profiler.report(std::cout, profile_json);
+            } else {
+                std::ofstream out(profile_output.c_str());
+                profiler.report(out, profile_json);
+                if(!out) {
+                    std::cerr << "ERROR: Cannot write profile to " << profile_output << std::endl;
+                }
+            }
+        }
 
-        return 0;
+        delete fields[0];
+        return written ? 0 : -1;
     } catch (TCLAP::ArgException &e) {
         std::cerr << "error: " << e.error() <<
                      " for arg " << e.argId() << std::endl;
@@ -0,0 +1,213 @@
+/**************************************************************************
+ *   float_parser.cpp                                                     *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+#include "float_parser.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+// exact powers of ten that fit in a double
+static const double pow10_table[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/*
+ * bool parse(p, end, val)
+ *
+ * Skip to the next token in [p,end), convert it and advance p past it.
+ * Returns false when there is no further token or when the token is not
+ * a valid number (in which case p is left behind the offending token).
+ *
+ */
+bool FloatParser::parse(const char* &p, const char* end, float* val) {
+    while(p < end && !is_token_char(*p)) {
+        p++;
+    }
+    if(p == end) {
+        return false;
+    }
+
+    const char* begin = p;
+    while(p < end && is_token_char(*p)) {
+        p++;
+    }
+
+    return convert(begin, p, val);
+}
+
+/*
+ * size_t parse_range(p, end, out, n)
+ *
+ * Parse at most n numbers from [p,end) straight into out. Returns the
+ * number of values that were stored; p points behind the last token
+ * that was consumed.
+ *
+ */
+size_t FloatParser::parse_range(const char* &p, const char* end, float* out, size_t n) {
+    size_t i = 0;
+    while(i < n && parse(p, end, &out[i])) {
+        i++;
+    }
+    return i;
+}
+
+/*
+ * size_t count_tokens(p, end)
+ *
+ * Count the number of tokens in [p,end) without converting them
+ *
+ */
+size_t FloatParser::count_tokens(const char* p, const char* end) {
+    size_t n = 0;
+    bool in_token = false;
+    for(; p < end; p++) {
+        bool t = is_token_char(*p);
+        if(t && !in_token) {
+            n++;
+        }
+        in_token = t;
+    }
+    return n;
+}
+
+/*
+ * bool convert(begin, end, val)
+ *
+ * Convert a single token of the form [+-]ddd[.ddd][(E|e)[+-]ddd].
+ *
+ * As long as the decimal mantissa fits in 53 bits and the decimal exponent
+ * is at most 22 in magnitude, both are exactly representable as a double
+ * and a single multiplication or division gives the correctly rounded
+ * double, i.e. the same double strtod() returns. All other input goes
+ * through strtod() itself.
+ *
+ */
+bool FloatParser::convert(const char* begin, const char* end, float* val) {
+    const char* p = begin;
+
+    bool negative = false;
+    if(*p == '-' || *p == '+') {
+        negative = (*p == '-');
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0;    // significant digits in the mantissa
+    int exponent = 0;  // decimal exponent correction from the fraction
+    bool any = false;
+
+    for(; p < end && *p >= '0' && *p <= '9'; p++) {
+        any = true;
+        if(mantissa == 0 && *p == '0') {
+            continue;
+        }
+        mantissa = mantissa * 10 + (*p - '0');
+        digits++;
+    }
+
+    if(p < end && *p == '.') {
+        p++;
+        for(; p < end && *p >= '0' && *p <= '9'; p++) {
+            any = true;
+            exponent--;
+            if(mantissa == 0 && *p == '0') {
+                continue;
+            }
+            mantissa = mantissa * 10 + (*p - '0');
+            digits++;
+        }
+    }
+
+    if(!any || digits > 15) {
+        return convert_slow(begin, end, val);
+    }
+
+    if(p < end && (*p == 'E' || *p == 'e')) {
+        p++;
+        bool negexp = false;
+        if(p < end && (*p == '-' || *p == '+')) {
+            negexp = (*p == '-');
+            p++;
+        }
+        if(p == end || end - p > 4) {
+            return convert_slow(begin, end, val);
+        }
+        int e = 0;
+        for(; p < end && *p >= '0' && *p <= '9'; p++) {
+            e = e * 10 + (*p - '0');
+        }
+        exponent += negexp ? -e : e;
+    }
+
+    // anything left over is not part of a plain number
+    if(p != end) {
+        return convert_slow(begin, end, val);
+    }
+
+    if(mantissa == 0) {
+        *val = negative ? -0.0f : 0.0f;
+        return true;
+    }
+
+    if(exponent < -22 || exponent > 22) {
+        return convert_slow(begin, end, val);
+    }
+
+    double d = (double)mantissa;
+    if(exponent < 0) {
+        d /= pow10_table[-exponent];
+    } else {
+        d *= pow10_table[exponent];
+    }
+
+    float f = (float)d;
+    *val = negative ? -f : f;
+    return true;
+}
+
+/*
+ * bool convert_slow(begin, end, val)
+ *
+ * Reference conversion through strtod(). The token has to be consumed
+ * completely and must not under- or overflow a double for the conversion
+ * to succeed.
+ *
+ */
+bool FloatParser::convert_slow(const char* begin, const char* end, float* val) {
+    char buf[128];
+    size_t n = end - begin;
+    if(n >= sizeof(buf)) {
+        return false;
+    }
+    memcpy(buf, begin, n);
+    buf[n] = '\0';
+
+    errno = 0;
+    char* stop;
+    double d = strtod(buf, &stop);
+    if(stop != buf + n || errno != 0) {
+        return false;
+    }
+    *val = (float)d;
+    return true;
+}
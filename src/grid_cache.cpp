@@ -0,0 +1,257 @@
+/**************************************************************************
+ *   grid_cache.cpp                                                       *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#include "grid_cache.h"
+
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char cache_magic[8] = {'E', 'D', 'P', 'C', 'A', 'C', 'H', 'E'};
+static const uint32_t cache_version = 3;
+static const uint32_t cache_byte_order = 0x01020304;
+static const size_t cache_alignment = 4096;     // the grid starts on a page boundary
+static const size_t hash_window = 64 * 1024;    // bytes hashed at head and tail
+
+/*
+ * Constructor
+ *
+ * Usage: GridCache cache("CHGCAR");
+ *
+ * The sidecar lives next to the source file, with the variant (if any)
+ * and ".edpcache" appended to its name. Nothing is read or written until
+ * load() or store() is called.
+ *
+ */
+GridCache::GridCache(const std::string &_source, const std::string &_variant) {
+    this->source = _source;
+    this->path = _source + (_variant.empty() ? "" : "." + _variant) + ".edpcache";
+    this->map = NULL;
+    memset(&this->header, 0, sizeof(this->header));
+}
+
+/*
+ * Destructor
+ *
+ * Releases the mapping of the sidecar (and thereby the grid returned by
+ * get_grid())
+ *
+ */
+GridCache::~GridCache() {
+    delete this->map;
+}
+
+/*
+ * bool load()
+ *
+ * Map the sidecar and verify that it belongs to the current version of
+ * the source file. Returns false if there is no valid sidecar.
+ *
+ */
+bool GridCache::load() {
+    GridCacheHeader fp;
+    if(!this->fingerprint(&fp)) {
+        return false;
+    }
+
+    delete this->map;
+    this->map = new MappedFile(this->path, true);
+    if(!this->map->is_open() || this->map->size() < sizeof(GridCacheHeader)) {
+        delete this->map;
+        this->map = NULL;
+        return false;
+    }
+
+    const char* data = this->map->data();
+    memcpy(&this->header, data, sizeof(GridCacheHeader));
+    const GridCacheHeader &h = this->header;
+
+    uint64_t meta_end = sizeof(GridCacheHeader) + uint64_t(h.nrat_count) * sizeof(uint32_t)
+                        + h.gridline_length;
+    uint64_t count = uint64_t(h.grid_dimensions[0]) * h.grid_dimensions[1] * h.grid_dimensions[2];
+
+    bool valid = memcmp(h.magic, cache_magic, sizeof(cache_magic)) == 0 &&
+                 h.version == cache_version &&
+                 h.byte_order == cache_byte_order &&
+                 h.source_size == fp.source_size &&
+                 h.source_mtime_sec == fp.source_mtime_sec &&
+                 h.source_mtime_nsec == fp.source_mtime_nsec &&
+                 h.source_hash == fp.source_hash &&
+                 h.data_count == count &&
+                 h.data_offset >= meta_end &&
+                 h.data_offset % sizeof(float) == 0 &&
+                 h.data_offset + h.data_count * sizeof(float) <= this->map->size();
+
+    if(!valid) {
+        delete this->map;
+        this->map = NULL;
+        return false;
+    }
+
+    const char* p = data + sizeof(GridCacheHeader);
+    this->nrat.clear();
+    for(unsigned int i=0; i<h.nrat_count; i++) {
+        uint32_t val;
+        memcpy(&val, p, sizeof(uint32_t));
+        this->nrat.push_back(val);
+        p += sizeof(uint32_t);
+    }
+    this->gridline.assign(p, h.gridline_length);
+
+    return true;
+}
+
+/*
+ * bool store(header, nrat, gridline, grid)
+ *
+ * Write a new sidecar for the source file. The fields describing the
+ * grid (scalar, mat, origin, grid_dimensions and vasp5_input) have to be set
+ * by the caller; everything else is filled in here.
+ *
+ * The sidecar is first written to a temporary file and then renamed, so
+ * that concurrent runs never see a partially written cache. Returns false
+ * when the sidecar could not be written (e.g. read-only directory).
+ *
+ */
+bool GridCache::store(GridCacheHeader _header, const std::vector<unsigned int> &_nrat,
+                      const std::string &_gridline, const float* grid) {
+    if(!this->fingerprint(&_header)) {
+        return false;
+    }
+
+    memcpy(_header.magic, cache_magic, sizeof(cache_magic));
+    _header.version = cache_version;
+    _header.byte_order = cache_byte_order;
+    _header.nrat_count = _nrat.size();
+    _header.gridline_length = _gridline.size();
+    _header.data_count = uint64_t(_header.grid_dimensions[0]) * _header.grid_dimensions[1] *
+                         _header.grid_dimensions[2];
+
+    uint64_t meta_end = sizeof(GridCacheHeader) + _nrat.size() * sizeof(uint32_t)
+                        + _gridline.size();
+    _header.data_offset = (meta_end + cache_alignment - 1) / cache_alignment * cache_alignment;
+
+    std::stringstream tmpname;
+    tmpname << this->path << ".tmp." << getpid();
+
+    std::ofstream out(tmpname.str().c_str(), std::ios::binary);
+    if(!out.is_open()) {
+        return false;
+    }
+
+    out.write(reinterpret_cast<const char*>(&_header), sizeof(GridCacheHeader));
+    for(unsigned int i=0; i<_nrat.size(); i++) {
+        uint32_t val = _nrat[i];
+        out.write(reinterpret_cast<const char*>(&val), sizeof(uint32_t));
+    }
+    out.write(_gridline.data(), _gridline.size());
+    std::vector<char> padding(_header.data_offset - meta_end, 0);
+    if(!padding.empty()) {
+        out.write(&padding[0], padding.size());
+    }
+    out.write(reinterpret_cast<const char*>(grid), _header.data_count * sizeof(float));
+    out.close();
+
+    if(out.fail() || rename(tmpname.str().c_str(), this->path.c_str()) != 0) {
+        unlink(tmpname.str().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+const GridCacheHeader& GridCache::get_header() const {
+    return this->header;
+}
+
+const std::vector<unsigned int>& GridCache::get_nrat() const {
+    return this->nrat;
+}
+
+const std::string& GridCache::get_gridline() const {
+    return this->gridline;
+}
+
+/*
+ * float* get_grid()
+ *
+ * Pointer to the grid inside the (copy-on-write) mapping of the sidecar.
+ * Only valid after a successful load() and as long as this object lives.
+ *
+ */
+float* GridCache::get_grid() {
+    if(this->map == NULL) {
+        return NULL;
+    }
+    return reinterpret_cast<float*>(this->map->writable_data() + this->header.data_offset);
+}
+
+const std::string& GridCache::get_path() const {
+    return this->path;
+}
+
+/*
+ * bool fingerprint(hdr)
+ *
+ * Fill in the fingerprint of the source file: its size, its modification
+ * time and an FNV-1a hash over the first and last bytes of the file
+ *
+ */
+bool GridCache::fingerprint(GridCacheHeader* hdr) const {
+    struct stat st;
+    if(stat(this->source.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    hdr->source_size = st.st_size;
+    hdr->source_mtime_sec = st.st_mtim.tv_sec;
+    hdr->source_mtime_nsec = st.st_mtim.tv_nsec;
+
+    std::ifstream infile(this->source.c_str(), std::ios::binary);
+    if(!infile.is_open()) {
+        return false;
+    }
+
+    std::vector<char> buf(hash_window);
+    uint64_t hash = 14695981039346656037ULL;
+    for(unsigned int pass=0; pass<2; pass++) {
+        uint64_t start = 0;
+        if(pass == 1) {
+            if(hdr->source_size <= hash_window) {
+                break;  // the whole file has been hashed already
+            }
+            start = hdr->source_size - hash_window;
+        }
+        infile.seekg(start);
+        infile.read(&buf[0], buf.size());
+        std::streamsize n = infile.gcount();
+        for(std::streamsize i=0; i<n; i++) {
+            hash ^= (unsigned char)buf[i];
+            hash *= 1099511628211ULL;
+        }
+        infile.clear();
+    }
+    hdr->source_hash = hash;
+
+    return true;
+}
@@ -0,0 +1,314 @@
+/**************************************************************************
+ *   grid_expression.cpp                                                  *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#include "grid_expression.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+const size_t GridExpression::block_size;
+
+GridExpression::GridExpression() :
+    depth(0),
+    pos(0),
+    sp(0) {
+}
+
+/*
+ * bool parse(text, names)
+ *
+ * Compile an expression in which the grids are referred to by names (the
+ * index of a name in names is the index of the grid in evaluate()).
+ * Prints an error and returns false when the expression is invalid.
+ *
+ */
+bool GridExpression::parse(const std::string &_text, const std::vector<std::string> &_names) {
+    this->text = _text;
+    this->names = _names;
+    this->code.clear();
+    this->constants.clear();
+    this->depth = 0;
+    this->pos = 0;
+    this->sp = 0;
+
+    if(!this->parse_sum()) {
+        return false;
+    }
+    this->skip_space();
+    if(this->pos != this->text.size()) {
+        return this->fail("unexpected character");
+    }
+    return true;
+}
+
+/*
+ * void evaluate(grids, out, n, pool)
+ *
+ * Evaluate the expression for the first n points of the grids and store
+ * the result in out, on the threads of the pool (the calling thread only
+ * when there is none). out may be one of the grids.
+ *
+ */
+void GridExpression::evaluate(const std::vector<const float*> &grids, float* out, size_t n, ThreadPool* pool) const {
+    const size_t nblocks = (n + block_size - 1) / block_size;
+    if(pool == NULL || pool->get_threads() == 1 || nblocks < 2) {
+        this->evaluate_range(grids, out, 0, n);
+        return;
+    }
+
+    pool->parallel_for(unsigned(nblocks), 16, [&](unsigned int begin, unsigned int end) {
+        this->evaluate_range(grids, out, size_t(begin) * block_size, std::min(n, size_t(end) * block_size));
+    });
+}
+
+/*
+ * const std::string& get_text()
+ *
+ * The expression as it was parsed
+ *
+ */
+const std::string& GridExpression::get_text() const {
+    return this->text;
+}
+
+/*
+ * bool parse_sum()
+ *
+ * sum := product (('+'|'-') product)*
+ *
+ */
+bool GridExpression::parse_sum() {
+    if(!this->parse_product()) {
+        return false;
+    }
+    while(true) {
+        this->skip_space();
+        if(this->pos == this->text.size() || (this->text[this->pos] != '+' && this->text[this->pos] != '-')) {
+            return true;
+        }
+        const char c = this->text[this->pos++];
+        if(!this->parse_product()) {
+            return false;
+        }
+        this->emit(c == '+' ? Op::ADD : Op::SUB, 0);
+    }
+}
+
+/*
+ * bool parse_product()
+ *
+ * product := factor (('*'|'/') factor)*
+ *
+ */
+bool GridExpression::parse_product() {
+    if(!this->parse_factor()) {
+        return false;
+    }
+    while(true) {
+        this->skip_space();
+        if(this->pos == this->text.size() || (this->text[this->pos] != '*' && this->text[this->pos] != '/')) {
+            return true;
+        }
+        const char c = this->text[this->pos++];
+        if(!this->parse_factor()) {
+            return false;
+        }
+        this->emit(c == '*' ? Op::MUL : Op::DIV, 0);
+    }
+}
+
+/*
+ * bool parse_factor()
+ *
+ * factor := ('+'|'-') factor | number | name | '(' sum ')'
+ *
+ */
+bool GridExpression::parse_factor() {
+    this->skip_space();
+    if(this->pos == this->text.size()) {
+        return this->fail("unexpected end");
+    }
+
+    const char c = this->text[this->pos];
+    if(c == '+' || c == '-') {
+        this->pos++;
+        if(!this->parse_factor()) {
+            return false;
+        }
+        if(c == '-') {
+            this->emit(Op::NEG, 0);
+        }
+        return true;
+    }
+
+    if(c == '(') {
+        this->pos++;
+        if(!this->parse_sum()) {
+            return false;
+        }
+        this->skip_space();
+        if(this->pos == this->text.size() || this->text[this->pos] != ')') {
+            return this->fail("missing ')'");
+        }
+        this->pos++;
+        return true;
+    }
+
+    if(isdigit((unsigned char)c) || c == '.') {
+        const char* begin = this->text.c_str() + this->pos;
+        char* stop;
+        double val = strtod(begin, &stop);
+        if(stop == begin) {
+            return this->fail("invalid number");
+        }
+        this->pos += stop - begin;
+        this->constants.push_back(float(val));
+        this->emit(Op::PUSH_CONST, this->constants.size() - 1);
+        return true;
+    }
+
+    if(isalpha((unsigned char)c) || c == '_') {
+        size_t end = this->pos;
+        while(end < this->text.size() && (isalnum((unsigned char)this->text[end]) || this->text[end] == '_')) {
+            end++;
+        }
+        const std::string name = this->text.substr(this->pos, end - this->pos);
+        std::vector<std::string>::const_iterator it = std::find(this->names.begin(), this->names.end(), name);
+        if(it == this->names.end()) {
+            return this->fail("unknown grid '" + name + "'");
+        }
+        this->pos = end;
+        this->emit(Op::PUSH_GRID, it - this->names.begin());
+        return true;
+    }
+
+    return this->fail("unexpected character");
+}
+
+/*
+ * void emit(code, index)
+ *
+ * Append an operation and keep track of the stack depth
+ *
+ */
+void GridExpression::emit(Op::Code _code, unsigned int _index) {
+    Op op;
+    op.code = _code;
+    op.index = _index;
+    this->code.push_back(op);
+
+    if(_code == Op::PUSH_GRID || _code == Op::PUSH_CONST) {
+        this->sp++;
+        this->depth = std::max(this->depth, this->sp);
+    } else if(_code != Op::NEG) {
+        this->sp--;
+    }
+}
+
+void GridExpression::skip_space() {
+    while(this->pos < this->text.size() && isspace((unsigned char)this->text[this->pos])) {
+        this->pos++;
+    }
+}
+
+/*
+ * bool fail(msg)
+ *
+ * Report a syntax error at the current position; always returns false
+ *
+ */
+bool GridExpression::fail(const std::string &msg) const {
+    std::cerr << "ERROR: " << msg << " in expression \"" << this->text
+              << "\" at position " << this->pos + 1 << std::endl;
+    return false;
+}
+
+/*
+ * void evaluate_range(grids, out, begin, end)
+ *
+ * Run the code block by block over the points [begin,end). The stack
+ * holds pointers, so grids are read in place; only intermediate results
+ * go to a per-thread scratch block. The result of a block is written
+ * after all of its operands have been read, which makes it safe for out
+ * to be one of the grids.
+ *
+ */
+void GridExpression::evaluate_range(const std::vector<const float*> &grids, float* out, size_t begin, size_t end) const {
+    std::vector<float> scratch(this->depth * block_size);
+    std::vector<float> blocks(this->constants.size() * block_size);
+    for(unsigned int c=0; c<this->constants.size(); c++) {
+        std::fill(blocks.begin() + c * block_size, blocks.begin() + (c + 1) * block_size, this->constants[c]);
+    }
+    std::vector<const float*> stack(this->depth);
+
+    for(size_t b=begin; b<end; b+=block_size) {
+        const size_t len = std::min(block_size, end - b);
+        unsigned int top = 0;
+
+        for(unsigned int o=0; o<this->code.size(); o++) {
+            const Op &op = this->code[o];
+            if(op.code == Op::PUSH_GRID) {
+                stack[top++] = grids[op.index] + b;
+                continue;
+            }
+            if(op.code == Op::PUSH_CONST) {
+                stack[top++] = &blocks[op.index * block_size];
+                continue;
+            }
+            if(op.code == Op::NEG) {
+                float* dst = &scratch[(top - 1) * block_size];
+                const float* x = stack[top - 1];
+                for(size_t i=0; i<len; i++) {
+                    dst[i] = -x[i];
+                }
+                stack[top - 1] = dst;
+                continue;
+            }
+
+            float* dst = &scratch[(top - 2) * block_size];
+            const float* x = stack[top - 2];
+            const float* y = stack[top - 1];
+            switch(op.code) {
+                case Op::ADD:
+                    for(size_t i=0; i<len; i++) dst[i] = x[i] + y[i];
+                    break;
+                case Op::SUB:
+                    for(size_t i=0; i<len; i++) dst[i] = x[i] - y[i];
+                    break;
+                case Op::MUL:
+                    for(size_t i=0; i<len; i++) dst[i] = x[i] * y[i];
+                    break;
+                default:
+                    for(size_t i=0; i<len; i++) dst[i] = x[i] / y[i];
+                    break;
+            }
+            stack[top - 2] = dst;
+            top--;
+        }
+
+        if(stack[0] != out + b) {
+            memcpy(out + b, stack[0], len * sizeof(float));
+        }
+    }
+}
@@ -0,0 +1,517 @@
+/**************************************************************************
+ *   grid_parser.cpp                                                      *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#include "grid_parser.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <thread>
+
+/*
+ * const char* parse_block(begin, end, out, n, nthreads, record)
+ *
+ * Parse n values from the data block starting at begin (the first byte
+ * after the grid dimension line) into out, using nthreads threads. Every
+ * record of the given number of values starts on a new line; 0 means
+ * that the block is a single record.
+ *
+ * Returns a pointer to the first byte after the data block, or NULL when
+ * the block does not have a fixed number of values per line. In the latter
+ * case the caller has to fall back to a serial read.
+ *
+ */
+const char* GridParser::parse_block(const char* begin, const char* end,
+                                    float* out, size_t n, unsigned int nthreads,
+                                    size_t record) {
+    if(n == 0) {
+        return begin;
+    }
+
+    const char* first_end = next_line(begin, end);
+    size_t vpl = FloatParser::count_tokens(begin, first_end);
+    if(vpl == 0) {
+        return NULL;
+    }
+    if(record == 0 || record > n) {
+        record = n;
+    }
+    size_t nlines = block_lines(n, vpl, record);
+
+    if(nthreads < 1) {
+        nthreads = 1;
+    }
+    if(nthreads > nlines) {
+        nthreads = nlines;
+    }
+    std::vector<Part> parts(nthreads);
+
+    // VASP writes fixed width lines, so the end of the block is most likely
+    // nlines times the length of the first line further; this guess is
+    // verified by counting the lines and otherwise replaced by a full scan
+    // (which is always needed when records end on shorter lines)
+    const char* block_end = NULL;
+    size_t linelen = first_end - begin;
+    if(linelen * nlines <= size_t(end - begin) && begin[linelen * nlines - 1] == '\n') {
+        block_end = begin + linelen * nlines;
+        split(begin, block_end, &parts[0], nthreads);
+        count_parts(&parts[0], nthreads);
+    }
+
+    size_t total = 0;
+    for(unsigned int t=0; t<nthreads; t++) {
+        total += parts[t].lines;
+    }
+
+    if(block_end == NULL || total != nlines) {
+        block_end = find_block_end(begin, end, nlines);
+        if(block_end == NULL) {
+            return NULL;
+        }
+        split(begin, block_end, &parts[0], nthreads);
+        count_parts(&parts[0], nthreads);
+    }
+
+    // parse all parts; the first value of each part follows from the
+    // number of lines in front of it
+    std::vector<std::thread> threads;
+    size_t first_line = 0;
+    for(unsigned int t=0; t<nthreads; t++) {
+        size_t first = line_values(first_line, vpl, record);
+        first_line += parts[t].lines;
+        size_t expected = 0;
+        if(first < n) {
+            expected = std::min(line_values(first_line, vpl, record), n) - first;
+        }
+
+        Part* part = &parts[t];
+        bool last = (t == nthreads - 1);
+        float* dest = out + first;
+        auto work = [part, dest, expected, last]() {
+            const char* p = part->begin;
+            size_t got = FloatParser::parse_range(p, part->end, dest, expected);
+            part->ok = (got == expected) &&
+                       (last || FloatParser::count_tokens(p, part->end) == 0);
+        };
+
+        if(nthreads == 1) {
+            work();
+        } else {
+            threads.push_back(std::thread(work));
+        }
+    }
+    for(unsigned int t=0; t<threads.size(); t++) {
+        threads[t].join();
+    }
+
+    for(unsigned int t=0; t<nthreads; t++) {
+        if(!parts[t].ok) {
+            return NULL;
+        }
+    }
+
+    return block_end;
+}
+
+/*
+ * const char* skip_block(begin, end, n, record)
+ *
+ * Returns a pointer to the first byte after a data block of n values
+ * starting at begin without parsing it, or NULL when the file ends first
+ *
+ */
+const char* GridParser::skip_block(const char* begin, const char* end, size_t n,
+                                   size_t record) {
+    if(n == 0) {
+        return begin;
+    }
+
+    const char* first_end = next_line(begin, end);
+    size_t vpl = FloatParser::count_tokens(begin, first_end);
+    if(vpl == 0) {
+        return NULL;
+    }
+    if(record == 0 || record > n) {
+        record = n;
+    }
+
+    return find_block_end(begin, end, block_lines(n, vpl, record));
+}
+
+/*
+ * const char* parse_slice(begin, end, out, first, count, n, nthreads)
+ *
+ * Parse only the values [first,first+count) of a data block of n values
+ * (a single record) starting at begin into out, using nthreads threads.
+ *
+ * VASP writes fixed width lines. When the block ends where fixed width
+ * lines would make it end, the lines in front of the slice are skipped by
+ * their width without reading them; otherwise they are counted.
+ *
+ * Returns a pointer to the first byte after the data block, or NULL when
+ * the block is too short or malformed.
+ *
+ */
+const char* GridParser::parse_slice(const char* begin, const char* end, float* out,
+                                    size_t first, size_t count, size_t n,
+                                    unsigned int nthreads) {
+    if(n == 0 || first + count > n) {
+        return NULL;
+    }
+
+    // the first line of the slice may start with values we do not need
+    size_t vpl = 0;
+    const char* p = seek_value(begin, end, first, n, &vpl);
+    if(p == NULL) {
+        return NULL;
+    }
+    if(count > 0 && first % vpl != 0) {
+        const char* line_end = next_line(p, end);
+        float skipped[64];
+        size_t skip = first % vpl;
+        size_t take = std::min(count, vpl - skip);
+        if(skip > 64 ||
+           FloatParser::parse_range(p, line_end, skipped, skip) != skip ||
+           FloatParser::parse_range(p, line_end, out, take) != take) {
+            return NULL;
+        }
+        p = line_end;
+        out += take;
+        count -= take;
+    }
+
+    // the rest of the slice starts on a line of its own
+    if(count > 0 && parse_block(p, end, out, count, nthreads) == NULL) {
+        return NULL;
+    }
+
+    p = seek_line(begin, end, block_lines(n, vpl, n) - 1, get_stride(begin, end, n, vpl));
+    return (p != NULL && p < end) ? next_line(p, end) : NULL;
+}
+
+/*
+ * const char* seek_value(begin, end, first, n, vpl)
+ *
+ * Start of the line that holds value first of a data block of n values
+ * (a single record) starting at begin; vpl is set to the number of values
+ * per line. Lines are skipped by their width when the block has fixed
+ * width lines (see parse_slice()). Returns NULL when the block is too
+ * short or malformed.
+ *
+ */
+const char* GridParser::seek_value(const char* begin, const char* end, size_t first,
+                                   size_t n, size_t* vpl) {
+    if(n == 0 || first > n) {
+        return NULL;
+    }
+
+    *vpl = FloatParser::count_tokens(begin, next_line(begin, end));
+    if(*vpl == 0) {
+        return NULL;
+    }
+    return seek_line(begin, end, first / *vpl, get_stride(begin, end, n, *vpl));
+}
+
+/*
+ * const char* find_line(begin, end, line)
+ *
+ * Search [begin,end) for a line that equals line and return a pointer to
+ * the start of the line after it, or NULL when there is no such line.
+ * Used to locate the second (magnetization) block of spin polarized files,
+ * which is preceded by a copy of the grid dimension line.
+ *
+ */
+const char* GridParser::find_line(const char* begin, const char* end, const std::string &line) {
+    const char* p = begin;
+    while(p < end) {
+        const char* q = next_line(p, end);
+        size_t len = q - p;
+        if(len > 0 && p[len - 1] == '\n') {
+            len--;
+        }
+        if(len == line.size() && memcmp(p, line.data(), len) == 0) {
+            return q;
+        }
+        p = q;
+    }
+    return NULL;
+}
+
+/*
+ * size_t block_lines(n, vpl, record)
+ *
+ * Number of lines taken by n values, given vpl values per line and a new
+ * line at the start of every record
+ *
+ */
+size_t GridParser::block_lines(size_t n, size_t vpl, size_t record) {
+    const size_t lpr = (record + vpl - 1) / vpl; // lines per record
+    return n / record * lpr + (n % record + vpl - 1) / vpl;
+}
+
+/*
+ * size_t line_values(lines, vpl, record)
+ *
+ * Number of values in the first lines of a block
+ *
+ */
+size_t GridParser::line_values(size_t lines, size_t vpl, size_t record) {
+    const size_t lpr = (record + vpl - 1) / vpl;
+    return lines / lpr * record + std::min(lines % lpr * vpl, record);
+}
+
+/*
+ * const char* next_line(p, end)
+ *
+ * Returns the start of the line following p (or end)
+ *
+ */
+const char* GridParser::next_line(const char* p, const char* end) {
+    const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+    return nl != NULL ? nl + 1 : end;
+}
+
+/*
+ * size_t count_lines(p, end)
+ *
+ * Count the number of (possibly unterminated) lines in [p,end)
+ *
+ */
+size_t GridParser::count_lines(const char* p, const char* end) {
+    size_t n = 0;
+    while(p < end) {
+        p = next_line(p, end);
+        n++;
+    }
+    return n;
+}
+
+/*
+ * const char* find_block_end(begin, end, nlines)
+ *
+ * Returns the position behind the nlines-th line following begin, or NULL
+ * when the file ends before that
+ *
+ */
+const char* GridParser::find_block_end(const char* begin, const char* end, size_t nlines) {
+    const char* p = begin;
+    for(size_t i=0; i<nlines; i++) {
+        if(p == end) {
+            return NULL;
+        }
+        p = next_line(p, end);
+    }
+    return p;
+}
+
+/*
+ * const char* seek_line(begin, end, line, stride)
+ *
+ * Returns the start of the given line of the block at begin, either by
+ * taking every line to be stride bytes long or, for a stride of 0, by
+ * counting the lines. Returns NULL when the file ends before that line.
+ *
+ */
+const char* GridParser::seek_line(const char* begin, const char* end, size_t line, size_t stride) {
+    if(stride == 0) {
+        return find_block_end(begin, end, line);
+    }
+    return line * stride <= size_t(end - begin) ? begin + line * stride : NULL;
+}
+
+/*
+ * size_t get_stride(begin, end, n, vpl)
+ *
+ * Width of the lines of a single record block of n values when all its
+ * lines are as wide as the first one and the block ends where such lines
+ * would make it end (the last line holds the remaining values and may be
+ * shorter), otherwise 0
+ *
+ */
+size_t GridParser::get_stride(const char* begin, const char* end, size_t n, size_t vpl) {
+    const size_t nlines = block_lines(n, vpl, n);
+    const size_t width = next_line(begin, end) - begin;
+    const size_t last = (nlines - 1) * width;
+    if(last < size_t(end - begin) && (last == 0 || begin[last - 1] == '\n') &&
+       FloatParser::count_tokens(begin + last, next_line(begin + last, end)) == n - (nlines - 1) * vpl) {
+        return width;
+    }
+    return 0;
+}
+
+/*
+ * void split(begin, end, parts, nparts)
+ *
+ * Split [begin,end) in nparts ranges of roughly equal size that all start
+ * at the beginning of a line
+ *
+ */
+void GridParser::split(const char* begin, const char* end, Part* parts, unsigned int nparts) {
+    size_t size = end - begin;
+    const char* start = begin;
+    for(unsigned int t=0; t<nparts; t++) {
+        parts[t].begin = start;
+        if(t == nparts - 1) {
+            parts[t].end = end;
+        } else {
+            const char* cut = begin + size / nparts * (t + 1);
+            cut = cut > start ? next_line(cut - 1, end) : start;
+            parts[t].end = cut;
+        }
+        parts[t].lines = 0;
+        parts[t].ok = false;
+        start = parts[t].end;
+    }
+}
+
+/*
+ * void count_parts(parts, nparts)
+ *
+ * Count the lines in each of the parts, one thread per part
+ *
+ */
+void GridParser::count_parts(Part* parts, unsigned int nparts) {
+    std::vector<std::thread> threads;
+    for(unsigned int t=0; t<nparts; t++) {
+        Part* part = &parts[t];
+        auto work = [part]() {
+            part->lines = count_lines(part->begin, part->end);
+        };
+        if(nparts == 1) {
+            work();
+        } else {
+            threads.push_back(std::thread(work));
+        }
+    }
+    for(unsigned int t=0; t<threads.size(); t++) {
+        threads[t].join();
+    }
+}
+
+BlockStream::BlockStream() {
+    this->pos = NULL;
+    this->end = NULL;
+    this->left = 0;
+    this->vpl = 0;
+    this->nline = 0;
+    this->used = 0;
+}
+
+/*
+ * bool open(begin, end, n, first)
+ *
+ * Start reading at value first of the data block of n values (a single
+ * record) at begin. Returns false when the block is too short or its
+ * lines are too long.
+ *
+ */
+bool BlockStream::open(const char* begin, const char* _end, size_t n, size_t first) {
+    this->end = _end;
+    this->nline = 0;
+    this->used = 0;
+    this->pos = GridParser::seek_value(begin, _end, first, n, &this->vpl);
+    if(this->pos == NULL || this->vpl > 64) {
+        return false;
+    }
+    this->left = n - first / this->vpl * this->vpl;
+
+    // the first line may start with values in front of the slice
+    if(first % this->vpl != 0) {
+        if(!this->read_line()) {
+            return false;
+        }
+        this->used = first % this->vpl;
+    }
+    return true;
+}
+
+/*
+ * bool read(out, count, nthreads)
+ *
+ * Parse the next count values into out. Returns false when the block ends
+ * before them or is malformed.
+ *
+ */
+bool BlockStream::read(float* out, size_t count, unsigned int nthreads) {
+    if(count > this->left + this->nline - this->used) {
+        return false;
+    }
+
+    // the rest of the line of the previous piece
+    const size_t rest = std::min(count, this->nline - this->used);
+    std::copy(this->line + this->used, this->line + this->used + rest, out);
+    this->used += rest;
+    out += rest;
+    count -= rest;
+
+    // whole lines
+    const size_t whole = count / this->vpl * this->vpl;
+    if(whole > 0) {
+        this->pos = GridParser::parse_block(this->pos, this->end, out, whole, nthreads);
+        if(this->pos == NULL) {
+            return false;
+        }
+        this->left -= whole;
+        out += whole;
+        count -= whole;
+    }
+
+    // the start of the next line
+    if(count > 0) {
+        if(!this->read_line()) {
+            return false;
+        }
+        std::copy(this->line, this->line + count, out);
+        this->used = count;
+    }
+    return true;
+}
+
+/*
+ * const char* get_position()
+ *
+ * Start of the part of the block that has not been parsed yet
+ *
+ */
+const char* BlockStream::get_position() const {
+    return this->pos;
+}
+
+/*
+ * bool read_line()
+ *
+ * Parse the line at pos (vpl values, or the rest of the block) into line
+ *
+ */
+bool BlockStream::read_line() {
+    const size_t k = std::min(this->vpl, this->left);
+    const char* nl = static_cast<const char*>(memchr(this->pos, '\n', this->end - this->pos));
+    const char* line_end = (nl != NULL) ? nl + 1 : this->end;
+    const char* p = this->pos;
+    if(k == 0 || FloatParser::parse_range(p, line_end, this->line, k) != k) {
+        return false;
+    }
+    this->pos = line_end;
+    this->left -= k;
+    this->nline = k;
+    this->used = 0;
+    return true;
+}
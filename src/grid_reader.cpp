@@ -0,0 +1,143 @@
+/**************************************************************************
+ *   grid_reader.cpp                                                      *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#include "grid_reader.h"
+#include "vasp_reader.h"
+#include "cube_reader.h"
+#include "compressed_stream.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+
+GridHeader::GridHeader() :
+    scalar(-1),
+    vasp5_input(false),
+    closed_grid(false) {
+    for(unsigned int i=0; i<3; i++) {
+        for(unsigned int j=0; j<3; j++) {
+            this->mat[i][j] = 0.0;
+        }
+        this->origin[i] = 0.0;
+        this->grid_dimensions[i] = 0;
+    }
+}
+
+GridReader::~GridReader() {
+}
+
+/*
+ * Format detect(filename)
+ *
+ * Determine the format of a (possibly compressed) file from its first
+ * lines. A cube file has an integer and three coordinates on the lines
+ * with the number of atoms and the three axes, where VASP files have
+ * three coordinates for the lattice vectors. Anything that is not a cube
+ * file is taken to be a VASP file, as is anything that is not a regular
+ * file (peeking into a pipe would consume its data).
+ *
+ */
+GridReader::Format GridReader::detect(const std::string &filename) {
+    struct stat st;
+    if(stat(filename.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return FORMAT_VASP;
+    }
+
+    CompressedStreambuf::Codec codec = CompressedStream::detect(filename);
+    std::ifstream plainfile;
+    CompressedStream packedfile;
+    if(codec == CompressedStreambuf::CODEC_NONE) {
+        plainfile.open(filename.c_str(), std::ios::binary);
+    } else {
+        packedfile.open(filename, codec);
+    }
+    std::istream &infile = (codec == CompressedStreambuf::CODEC_NONE) ?
+                           static_cast<std::istream&>(plainfile) : packedfile;
+
+    std::vector<std::string> lines;
+    std::string line;
+    while(lines.size() < 6 && std::getline(infile, line)) {
+        lines.push_back(line);
+    }
+    if(lines.size() < 6) {
+        return FORMAT_VASP;
+    }
+
+    // atoms and origin, optionally followed by the number of values per point
+    if(!is_cube_line(lines[2], 4, 5)) {
+        return FORMAT_VASP;
+    }
+    for(unsigned int i=3; i<6; i++) {
+        if(!is_cube_line(lines[i], 4, 4)) {
+            return FORMAT_VASP;
+        }
+    }
+    return FORMAT_CUBE;
+}
+
+/*
+ * GridReader* create(format)
+ *
+ * Construct the reader for a format; the caller owns the reader
+ *
+ */
+GridReader* GridReader::create(Format format) {
+    switch(format) {
+        case FORMAT_CUBE:
+            return new CubeReader();
+        default:
+            return new VaspReader();
+    }
+}
+
+/*
+ * bool is_cube_line(line, min_tokens, max_tokens)
+ *
+ * Whether a line consists of an integer followed by numbers, with the
+ * number of fields in [min_tokens,max_tokens]
+ *
+ */
+bool GridReader::is_cube_line(const std::string &line, size_t min_tokens, size_t max_tokens) {
+    std::istringstream ss(line);
+    std::vector<std::string> tokens;
+    std::string token;
+    while(ss >> token) {
+        tokens.push_back(token);
+    }
+    if(tokens.size() < min_tokens || tokens.size() > max_tokens) {
+        return false;
+    }
+
+    const std::string &first = tokens[0];
+    size_t start = (first[0] == '-' || first[0] == '+') ? 1 : 0;
+    if(start == first.size() || first.find_first_not_of("0123456789", start) != std::string::npos) {
+        return false;
+    }
+    for(unsigned int i=1; i<tokens.size(); i++) {
+        char* stop;
+        strtod(tokens[i].c_str(), &stop);
+        if(*stop != '\0') {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,240 @@
+/**************************************************************************
+ *   grid_storage.cpp                                                     *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#include "grid_storage.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+GridStorage::GridStorage(Precision _precision, const unsigned int _dims[3]) :
+    precision(_precision),
+    data(NULL),
+    brick_offset(NULL),
+    brick_step(NULL),
+    fp16_scale(1.0f),
+    max_error(0.0f) {
+    this->size = 1;
+    for(unsigned int i=0; i<3; i++) {
+        this->dims[i] = _dims[i];
+        this->bricks[i] = (_dims[i] + (1u << brick_bits) - 1) >> brick_bits;
+        this->size *= _dims[i];
+    }
+
+    this->data = new uint16_t[this->size];
+    if(this->precision == PRECISION_Q16) {
+        const size_t nbricks = size_t(this->bricks[0]) * this->bricks[1] * this->bricks[2];
+        this->brick_offset = new float[nbricks];
+        this->brick_step = new float[nbricks];
+    }
+}
+
+GridStorage::~GridStorage() {
+    delete[] this->data;
+    delete[] this->brick_offset;
+    delete[] this->brick_step;
+}
+
+/*
+ * void encode(grid, nthreads)
+ *
+ * Fill the storage from a float grid of the same dimensions (stored k-major
+ * as in ScalarField), working on layers of bricks in parallel
+ *
+ */
+void GridStorage::encode(const float* grid, unsigned int nthreads) {
+    if(this->precision == PRECISION_FP16) {
+        // the largest magnitude is scaled to [2^14,2^15), well below the
+        // largest half (65504), which also lifts small grids out of the
+        // subnormal range
+        float m = 0.0f;
+        for(size_t i=0; i<this->size; i++) {
+            m = std::max(m, std::fabs(grid[i]));
+        }
+        int ex = 0;
+        std::frexp(m, &ex);
+        this->fp16_scale = (m > 0.0f) ? std::ldexp(1.0f, ex - 15) : 1.0f;
+    }
+
+    const unsigned int layers = this->bricks[2];
+    nthreads = std::max(1u, std::min(nthreads, layers));
+    std::vector<float> errors(nthreads, 0.0f);
+    std::vector<std::thread> threads;
+    for(unsigned int t=0; t<nthreads; t++) {
+        unsigned int kbegin = (layers * t / nthreads) << brick_bits;
+        unsigned int kend = std::min(this->dims[2], (layers * (t + 1) / nthreads) << brick_bits);
+        if(this->precision == PRECISION_FP16) {
+            threads.push_back(std::thread(&GridStorage::encode_fp16, this, grid, kbegin, kend, &errors[t]));
+        } else {
+            threads.push_back(std::thread(&GridStorage::encode_q16, this, grid, kbegin, kend, &errors[t]));
+        }
+    }
+
+    this->max_error = 0.0f;
+    for(unsigned int t=0; t<nthreads; t++) {
+        threads[t].join();
+        this->max_error = std::max(this->max_error, errors[t]);
+    }
+}
+
+/*
+ * size_t get_bytes()
+ *
+ * Memory taken by the storage
+ *
+ */
+size_t GridStorage::get_bytes() const {
+    size_t bytes = this->size * sizeof(uint16_t);
+    if(this->precision == PRECISION_Q16) {
+        bytes += size_t(this->bricks[0]) * this->bricks[1] * this->bricks[2] * 2 * sizeof(float);
+    }
+    return bytes;
+}
+
+/*
+ * float get_max_error()
+ *
+ * Largest absolute difference between a decoded and an original value
+ *
+ */
+float GridStorage::get_max_error() const {
+    return this->max_error;
+}
+
+/*
+ * const char* get_name(precision)
+ *
+ * Name of a precision as used on the command line
+ *
+ */
+const char* GridStorage::get_name(Precision _precision) {
+    switch(_precision) {
+        case PRECISION_FP16:
+            return "fp16";
+        case PRECISION_Q16:
+            return "q16";
+        default:
+            return "fp32";
+    }
+}
+
+/*
+ * void encode_fp16(grid, kbegin, kend, err)
+ *
+ * Convert the layers [kbegin,kend) to half precision and store the
+ * largest deviation in err
+ *
+ */
+void GridStorage::encode_fp16(const float* grid, unsigned int kbegin, unsigned int kend, float* err) {
+    const float inv_scale = 1.0f / this->fp16_scale; // exact, a power of two
+    const size_t begin = size_t(kbegin) * this->dims[0] * this->dims[1];
+    const size_t end = size_t(kend) * this->dims[0] * this->dims[1];
+
+    float e = 0.0f;
+    for(size_t idx=begin; idx<end; idx++) {
+        uint16_t h = float_to_half(grid[idx] * inv_scale);
+        this->data[idx] = h;
+        e = std::max(e, std::fabs(half_to_float(h) * this->fp16_scale - grid[idx]));
+    }
+    *err = e;
+}
+
+/*
+ * void encode_q16(grid, kbegin, kend, err)
+ *
+ * Quantize all bricks in the layers [kbegin,kend) between their minimum and
+ * maximum and store the largest deviation in err
+ *
+ */
+void GridStorage::encode_q16(const float* grid, unsigned int kbegin, unsigned int kend, float* err) {
+    const unsigned int edge = 1u << brick_bits;
+    const size_t nx = this->dims[0];
+    const size_t nxy = nx * this->dims[1];
+
+    float e = 0.0f;
+    for(unsigned int k0=kbegin; k0<kend; k0+=edge) {
+        const unsigned int k1 = std::min(k0 + edge, kend);
+        for(unsigned int j0=0; j0<this->dims[1]; j0+=edge) {
+            const unsigned int j1 = std::min(j0 + edge, this->dims[1]);
+            for(unsigned int i0=0; i0<this->dims[0]; i0+=edge) {
+                const unsigned int i1 = std::min(i0 + edge, this->dims[0]);
+
+                float lo = grid[k0 * nxy + j0 * nx + i0];
+                float hi = lo;
+                for(unsigned int k=k0; k<k1; k++) {
+                    for(unsigned int j=j0; j<j1; j++) {
+                        const float* row = grid + k * nxy + j * nx;
+                        for(unsigned int i=i0; i<i1; i++) {
+                            lo = std::min(lo, row[i]);
+                            hi = std::max(hi, row[i]);
+                        }
+                    }
+                }
+
+                const size_t b = this->get_brick(i0, j0, k0);
+                const float step = (hi - lo) / 65535.0f;
+                this->brick_offset[b] = lo;
+                this->brick_step[b] = step;
+
+                for(unsigned int k=k0; k<k1; k++) {
+                    for(unsigned int j=j0; j<j1; j++) {
+                        const float* row = grid + k * nxy + j * nx;
+                        uint16_t* out = this->data + k * nxy + j * nx;
+                        for(unsigned int i=i0; i<i1; i++) {
+                            long q = (step > 0.0f) ? lrintf((row[i] - lo) / step) : 0;
+                            out[i] = uint16_t(std::min(65535L, std::max(0L, q)));
+                            e = std::max(e, std::fabs(lo + float(out[i]) * step - row[i]));
+                        }
+                    }
+                }
+            }
+        }
+    }
+    *err = e;
+}
+
+/*
+ * uint16_t float_to_half(f)
+ *
+ * Round a float to the nearest half (ties to even). Multiplying by 2^-112
+ * moves the exponent into the range of a half, after which the upper bits
+ * of the float are the half. Values beyond the range of a half saturate.
+ *
+ */
+uint16_t GridStorage::float_to_half(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    const uint16_t sign = (x >> 16) & 0x8000;
+    x &= 0x7FFFFFFF;
+
+    float a;
+    memcpy(&a, &x, sizeof(a));
+    a *= 1.925929944387236e-34f; // 2^-112
+    uint32_t b;
+    memcpy(&b, &a, sizeof(b));
+
+    b = (b + 0x0FFF + ((b >> 13) & 1)) >> 13;
+    if(b > 0x7BFF) {
+        b = 0x7BFF; // largest finite half
+    }
+    return sign | uint16_t(b);
+}
@@ -0,0 +1,116 @@
+/**************************************************************************
+ *   job_list.cpp                                                         *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#include "job_list.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <pcrecpp.h>
+
+/*
+ * bool read(filename, defaults)
+ *
+ * Add the frames of a job file (- for standard input); defaults gives the
+ * fields a line leaves out
+ *
+ */
+bool JobList::read(const std::string &filename, const Job &defaults) {
+    std::ifstream file;
+    if(filename != "-") {
+        file.open(filename.c_str());
+        if(!file.is_open()) {
+            std::cerr << "ERROR: Cannot open job file " << filename << std::endl;
+            return false;
+        }
+    }
+    std::istream &in = (filename == "-") ? std::cin : file;
+
+    std::string line;
+    unsigned int lineno = 0;
+    size_t first = this->jobs.size();
+    while(std::getline(in, line)) {
+        lineno++;
+        std::istringstream fields(line);
+        std::string output, s, v1, v2, scale, rest;
+        if(!(fields >> output) || output[0] == '#') {
+            continue;
+        }
+        fields >> s >> v1 >> v2 >> scale >> rest;
+
+        Job job = defaults;
+        job.output = output;
+        bool ok = !s.empty() && rest.empty() && parse_vector(s, &job.s) &&
+                  (v1.empty() || parse_vector(v1, &job.v1)) &&
+                  (v1.empty() == v2.empty()) &&
+                  (v2.empty() || parse_vector(v2, &job.v2));
+        if(ok && !scale.empty()) {
+            std::istringstream number(scale);
+            ok = (number >> job.scale) && number.eof() && job.scale > 0;
+        }
+        if(!ok) {
+            std::cerr << "ERROR: Cannot read line " << lineno << " of job file " << filename
+                      << " (expected: output point [vector1 vector2 [scale]]): " << line << std::endl;
+            return false;
+        }
+        this->jobs.push_back(job);
+    }
+
+    if(this->jobs.size() == first) {
+        std::cerr << "ERROR: No jobs in " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/*
+ * void add(job)
+ *
+ * Add a single frame
+ *
+ */
+void JobList::add(const Job &job) {
+    this->jobs.push_back(job);
+}
+
+size_t JobList::size() const {
+    return this->jobs.size();
+}
+
+const JobList::Job& JobList::operator[](size_t i) const {
+    return this->jobs[i];
+}
+
+/*
+ * bool parse_vector(text, v)
+ *
+ * Read a vector given as x,y,z
+ *
+ */
+bool JobList::parse_vector(const std::string &text, Vector* v) {
+    static const pcrecpp::RE re("^([0-9.eE+-]+),([0-9.eE+-]+),([0-9.eE+-]+)$");
+    float x, y, z;
+    if(!re.FullMatch(text, &x, &y, &z)) {
+        return false;
+    }
+    *v = Vector(x, y, z);
+    return true;
+}
@@ -0,0 +1,118 @@
+/**************************************************************************
+ *   mapped_file.cpp                                                      *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#include "mapped_file.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+
+/*
+ * Constructor
+ *
+ * Maps the complete file into memory. Only regular files can be mapped;
+ * for anything else (pipes, missing files, empty files) is_open() returns
+ * false and the caller has to fall back to stream based reading.
+ *
+ */
+MappedFile::MappedFile(const std::string &_filename, bool _copy_on_write) {
+    this->ptr = NULL;
+    this->length = 0;
+    this->copy_on_write = _copy_on_write;
+
+    int fd = open(_filename.c_str(), O_RDONLY);
+    if(fd < 0) {
+        return;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        int prot = this->copy_on_write ? (PROT_READ | PROT_WRITE) : PROT_READ;
+        void* addr = mmap(NULL, st.st_size, prot, MAP_PRIVATE, fd, 0);
+        if(addr != MAP_FAILED) {
+            this->ptr = static_cast<char*>(addr);
+            this->length = st.st_size;
+            // read-only maps are used for text that is parsed front to back
+            if(!this->copy_on_write) {
+                madvise(addr, this->length, MADV_SEQUENTIAL);
+            }
+        }
+    }
+
+    // the mapping stays valid after closing the descriptor
+    close(fd);
+}
+
+/*
+ * Destructor
+ *
+ * Releases the mapping
+ *
+ */
+MappedFile::~MappedFile() {
+    if(this->ptr != NULL) {
+        munmap(this->ptr, this->length);
+    }
+}
+
+bool MappedFile::is_open() const {
+    return this->ptr != NULL;
+}
+
+const char* MappedFile::data() const {
+    return this->ptr;
+}
+
+/*
+ * char* writable_data()
+ *
+ * Returns a writable pointer for copy-on-write mappings and NULL otherwise
+ *
+ */
+char* MappedFile::writable_data() {
+    return this->copy_on_write ? this->ptr : NULL;
+}
+
+size_t MappedFile::size() const {
+    return this->length;
+}
+
+/*
+ * void release(offset)
+ *
+ * Drop the pages of a read-only mapping in front of offset from the
+ * memory of the process, i.e. the part of a file that has been parsed
+ * while the rest is still being read. They stay in the page cache and
+ * are read again if they are touched.
+ *
+ */
+void MappedFile::release(size_t offset) {
+    if(this->ptr == NULL || this->copy_on_write) {
+        return;
+    }
+    const size_t page = sysconf(_SC_PAGESIZE);
+    offset = std::min(offset, this->length) / page * page;
+    if(offset > 0) {
+        madvise(this->ptr, offset, MADV_DONTNEED);
+    }
+}
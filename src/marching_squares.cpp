@@ -0,0 +1,221 @@
+/**************************************************************************
+ *   marching_squares.cpp                                                 *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#include "marching_squares.h"
+
+#include <algorithm>
+
+// pairs of edges (0: top, 1: right, 2: bottom, 3: left) joined by the
+// segments of a cell, by which of its corners (bit 0: top left, 1: top
+// right, 2: bottom right, 3: bottom left) lie above the level; -1 ends the
+// list. The saddles 5 and 10 take the first form if the center of the
+// cell lies above the level and the second one otherwise.
+static const int cases[16][4] = {
+    {-1, -1, -1, -1}, { 3,  0, -1, -1}, { 0,  1, -1, -1}, { 3,  1, -1, -1},
+    { 1,  2, -1, -1}, { 0,  1,  2,  3}, { 0,  2, -1, -1}, { 3,  2, -1, -1},
+    { 2,  3, -1, -1}, { 0,  2, -1, -1}, { 3,  0,  1,  2}, { 1,  2, -1, -1},
+    { 1,  3, -1, -1}, { 0,  1, -1, -1}, { 3,  0, -1, -1}, {-1, -1, -1, -1}
+};
+static const int saddles[16][4] = {
+    {-1, -1, -1, -1}, {-1, -1, -1, -1}, {-1, -1, -1, -1}, {-1, -1, -1, -1},
+    {-1, -1, -1, -1}, { 3,  0,  1,  2}, {-1, -1, -1, -1}, {-1, -1, -1, -1},
+    {-1, -1, -1, -1}, {-1, -1, -1, -1}, { 0,  1,  2,  3}, {-1, -1, -1, -1},
+    {-1, -1, -1, -1}, {-1, -1, -1, -1}, {-1, -1, -1, -1}, {-1, -1, -1, -1}
+};
+
+/*
+ * void trace_cells(values, stride, x0, y0, w, h, nx, levels, segments)
+ *
+ * Append the segments of the w x h cells with their top left corner at
+ * (x0, y0) up to (x0 + w - 1, y0 + h - 1) of an image nx pixels wide to
+ * segments. The values of the pixels (x0, y0) up to (x0 + w, y0 + h) are
+ * given rows of stride floats apart, starting at values.
+ *
+ */
+void MarchingSquares::trace_cells(const float* values, size_t stride, unsigned int x0, unsigned int y0,
+                                  unsigned int w, unsigned int h, unsigned int nx,
+                                  const std::vector<float> &levels, std::vector<Segment> &segments) {
+    if(levels.empty()) {
+        return;
+    }
+    for(unsigned int y=0; y<h; y++) {
+        const unsigned int j = y0 + y;
+        const float* top = values + y * stride;
+        const float* bottom = top + stride;
+        for(unsigned int x=0; x<w; x++) {
+            const unsigned int i = x0 + x;
+            const float v[4] = {top[x], top[x+1], bottom[x+1], bottom[x]};
+            const float lo = std::min(std::min(v[0], v[1]), std::min(v[2], v[3]));
+            const float hi = std::max(std::max(v[0], v[1]), std::max(v[2], v[3]));
+
+            // the levels strictly between the lowest and highest corner
+            std::vector<float>::const_iterator it = std::upper_bound(levels.begin(), levels.end(), lo);
+            for(; it != levels.end() && *it < hi; ++it) {
+                const float level = *it;
+                const unsigned int c = (v[0] > level ? 1 : 0) | (v[1] > level ? 2 : 0) |
+                                       (v[2] > level ? 4 : 0) | (v[3] > level ? 8 : 0);
+                const int* pairs = cases[c];
+                if(c == 5 || c == 10) {
+                    if((v[0] + v[1] + v[2] + v[3]) * 0.25f <= level) {
+                        pairs = saddles[c];
+                    }
+                }
+
+                for(unsigned int p=0; p<4 && pairs[p] >= 0; p+=2) {
+                    Segment seg;
+                    seg.level = uint32_t(it - levels.begin());
+                    for(unsigned int e=0; e<2; e++) {
+                        // every edge runs from its top or left point, so that
+                        // both cells on it find the same end point
+                        float t;
+                        switch(pairs[p + e]) {
+                            case 0:     // top
+                                t = (level - v[0]) / (v[1] - v[0]);
+                                seg.edge[e] = 2 * uint32_t(j * nx + i);
+                                seg.x[e] = float(i) + t + 0.5f;
+                                seg.y[e] = float(j) + 0.5f;
+                                break;
+                            case 1:     // right
+                                t = (level - v[1]) / (v[2] - v[1]);
+                                seg.edge[e] = 2 * uint32_t(j * nx + i + 1) + 1;
+                                seg.x[e] = float(i + 1) + 0.5f;
+                                seg.y[e] = float(j) + t + 0.5f;
+                                break;
+                            case 2:     // bottom
+                                t = (level - v[3]) / (v[2] - v[3]);
+                                seg.edge[e] = 2 * uint32_t((j + 1) * nx + i);
+                                seg.x[e] = float(i) + t + 0.5f;
+                                seg.y[e] = float(j + 1) + 0.5f;
+                                break;
+                            default:    // left
+                                t = (level - v[0]) / (v[3] - v[0]);
+                                seg.edge[e] = 2 * uint32_t(j * nx + i) + 1;
+                                seg.x[e] = float(i) + 0.5f;
+                                seg.y[e] = float(j) + t + 0.5f;
+                                break;
+                        }
+                    }
+                    segments.push_back(seg);
+                }
+            }
+        }
+    }
+}
+
+/*
+ * void join(blocks, nlevels, pool, lines)
+ *
+ * Join the segments of all blocks of cells into polylines, one list per
+ * level; the levels are joined in parallel
+ *
+ */
+void MarchingSquares::join(const std::vector<std::vector<Segment> > &blocks, unsigned int nlevels,
+                           ThreadPool* pool, std::vector<std::vector<Polyline> > &lines) {
+    lines.assign(nlevels, std::vector<Polyline>());
+
+    // gather the segments per level, in the order of the blocks
+    std::vector<std::vector<Segment> > per_level(nlevels);
+    for(unsigned int b=0; b<blocks.size(); b++) {
+        for(size_t s=0; s<blocks[b].size(); s++) {
+            per_level[blocks[b][s].level].push_back(blocks[b][s]);
+        }
+    }
+
+    ThreadPool::Body join_levels = [&](unsigned int begin, unsigned int end) {
+        for(unsigned int l=begin; l<end; l++) {
+            join_level(per_level[l], lines[l]);
+        }
+    };
+    if(pool != NULL) {
+        pool->parallel_for(nlevels, 1, join_levels);
+    } else {
+        join_levels(0, nlevels);
+    }
+}
+
+/*
+ * void join_level(segments, lines)
+ *
+ * Join the segments of a single level into polylines. An edge carries at
+ * most one point of a level, shared by the (at most two) segments that
+ * end on it.
+ *
+ */
+void MarchingSquares::join_level(const std::vector<Segment> &segments, std::vector<Polyline> &lines) {
+    const size_t n = segments.size();
+
+    // pair up the ends (2 * segment + end) on the same edge
+    std::vector<std::pair<uint32_t, uint32_t> > ends(2 * n);
+    for(size_t s=0; s<n; s++) {
+        ends[2 * s] = std::make_pair(segments[s].edge[0], uint32_t(2 * s));
+        ends[2 * s + 1] = std::make_pair(segments[s].edge[1], uint32_t(2 * s + 1));
+    }
+    std::sort(ends.begin(), ends.end());
+    std::vector<int64_t> partner(2 * n, -1);
+    for(size_t e=0; e+1<ends.size(); e++) {
+        if(ends[e].first == ends[e+1].first) {
+            partner[ends[e].second] = ends[e+1].second;
+            partner[ends[e+1].second] = ends[e].second;
+            e++;
+        }
+    }
+
+    // walk from the free ends first, what is left are closed loops
+    std::vector<bool> used(n, false);
+    for(unsigned int pass=0; pass<2; pass++) {
+        for(size_t s=0; s<n; s++) {
+            if(used[s]) {
+                continue;
+            }
+            uint32_t end = 2 * s;
+            if(pass == 0) {
+                if(partner[end] >= 0) {
+                    end++;
+                    if(partner[end] >= 0) {
+                        continue;
+                    }
+                }
+            }
+
+            Polyline line;
+            line.closed = (pass == 1);
+            line.points.push_back(segments[end / 2].x[end % 2]);
+            line.points.push_back(segments[end / 2].y[end % 2]);
+            while(true) {
+                const Segment &seg = segments[end / 2];
+                used[end / 2] = true;
+                end ^= 1;   // over to the other end of the segment
+                const int64_t next = partner[end];
+                if(next < 0 || used[next / 2]) {
+                    if(!line.closed) {
+                        line.points.push_back(seg.x[end % 2]);
+                        line.points.push_back(seg.y[end % 2]);
+                    }
+                    break;
+                }
+                line.points.push_back(seg.x[end % 2]);
+                line.points.push_back(seg.y[end % 2]);
+                end = uint32_t(next);
+            }
+            lines.push_back(line);
+        }
+    }
+}
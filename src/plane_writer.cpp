@@ -0,0 +1,150 @@
+/**************************************************************************
+ *   plane_writer.cpp                                                     *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#include "plane_writer.h"
+
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+/*
+ * bool write_npy(filename, values, nx, ny)
+ *
+ * Write the ny rows of nx values as a NumPy array file
+ *
+ */
+bool PlaneWriter::write_npy(const std::string &filename, const float* values, unsigned int nx, unsigned int ny) {
+    const uint32_t one = 1;
+    const bool little_endian = (*reinterpret_cast<const unsigned char*>(&one) == 1);
+
+    std::ostringstream dict;
+    dict << "{'descr': '" << (little_endian ? '<' : '>') << "f4', 'fortran_order': False, 'shape': ("
+         << ny << ", " << nx << "), }";
+    std::string text = dict.str();
+
+    // magic, version and length take 10 bytes; the values start on a
+    // multiple of 64 bytes after a newline
+    size_t length = (10 + text.size() + 1 + 63) / 64 * 64 - 10;
+    text.append(length - text.size() - 1, ' ');
+    text.push_back('\n');
+
+    std::string header("\x93NUMPY\x01\x00", 8);
+    header.push_back(char(length & 0xFF));
+    header.push_back(char(length >> 8));
+    header += text;
+
+    return write_file(filename, header.data(), header.size(), values, size_t(nx) * ny);
+}
+
+/*
+ * bool write_raw(filename, values, nx, ny, origin, dx, dy, log_scale)
+ *
+ * Write the ny rows of nx values after a RawHeader that places them in
+ * space
+ *
+ */
+bool PlaneWriter::write_raw(const std::string &filename, const float* values, unsigned int nx, unsigned int ny,
+                            const XYZ &origin, const XYZ &dx, const XYZ &dy, bool log_scale) {
+    RawHeader header;
+    memcpy(header.magic, "EDPPLANE", 8);
+    header.byte_order = 0x01020304;
+    header.header_size = sizeof(RawHeader);
+    header.nx = nx;
+    header.ny = ny;
+    header.origin[0] = origin.x;
+    header.origin[1] = origin.y;
+    header.origin[2] = origin.z;
+    header.dx[0] = dx.x;
+    header.dx[1] = dx.y;
+    header.dx[2] = dx.z;
+    header.dy[0] = dy.x;
+    header.dy[1] = dy.y;
+    header.dy[2] = dy.z;
+    header.log_scale = log_scale ? 1 : 0;
+
+    return write_file(filename, &header, sizeof(RawHeader), values, size_t(nx) * ny);
+}
+
+/*
+ * const char* get_extension(format)
+ *
+ * Extension of the files of a format
+ *
+ */
+const char* PlaneWriter::get_extension(Format format) {
+    return (format == FORMAT_NPY) ? ".npy" : ".raw";
+}
+
+/*
+ * bool write_file(filename, header, header_size, values, n)
+ *
+ * Write the header and the n values by gathered writes straight from
+ * their memory
+ *
+ */
+bool PlaneWriter::write_file(const std::string &filename, const void* header, size_t header_size,
+                             const float* values, size_t n) {
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) {
+        std::cerr << "ERROR: Cannot open " << filename << " for writing" << std::endl;
+        return false;
+    }
+
+    struct iovec iov[2];
+    iov[0].iov_base = const_cast<void*>(header);
+    iov[0].iov_len = header_size;
+    iov[1].iov_base = const_cast<float*>(values);
+    iov[1].iov_len = n * sizeof(float);
+
+    // a write can be cut short (i.e. beyond 2 GiB), continue after it
+    struct iovec* pending = iov;
+    int count = 2;
+    bool ok = true;
+    while(count > 0) {
+        ssize_t written = writev(fd, pending, count);
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            ok = false;
+            break;
+        }
+        while(count > 0 && size_t(written) >= pending->iov_len) {
+            written -= pending->iov_len;
+            pending++;
+            count--;
+        }
+        if(count > 0) {
+            pending->iov_base = static_cast<char*>(pending->iov_base) + written;
+            pending->iov_len -= written;
+        }
+    }
+
+    ok = (close(fd) == 0) && ok;
+    if(!ok) {
+        std::cerr << "ERROR: Cannot write " << filename << std::endl;
+    }
+    return ok;
+}
@@ -19,201 +19,395 @@
  **************************************************************************/
 
  #include "planeprojector.h"
+#include <sys/stat.h>
+#include <algorithm>
 
+const unsigned int PlaneProjector::tile_width;
+const unsigned int PlaneProjector::tile_rows;
 
 PlaneProjector::PlaneProjector(ScalarField* _sf, float _min, float _max) {
+    this->init(_sf, _min, _max);
+    this->scheme = new ColorScheme(_min,_max);
+    this->own_scheme = true;
+}
+
+/*
+ * PlaneProjector(sf, scheme, min, max)
+ *
+ * Projector that colors by a scheme shared with other projectors (i.e.
+ * the ones rendering the frames of a job file) instead of one of its own
+ *
+ */
+PlaneProjector::PlaneProjector(ScalarField* _sf, const ColorScheme* _scheme, float _min, float _max) {
+    this->init(_sf, _min, _max);
+    this->scheme = _scheme;
+    this->own_scheme = false;
+}
+
+void PlaneProjector::init(ScalarField* _sf, float _min, float _max) {
     this->min = _min;
     this->max = _max;
-    this->scheme = new ColorScheme(_min,_max);
     this->sf = _sf;
+    this->plt = NULL;
+    this->profiler = NULL;
+    this->pool = NULL;
+    this->keep_planes = false;
+    this->planegrid_real = NULL;
+    this->planegrid_log = NULL;
+    this->plane_size = 0;
+    this->verbose = true;
+    this->png_level = 6;
+    this->png_filter = PngWriter::FILTER_NONE;
 }
 
-void PlaneProjector::extract(Vector _v1, Vector _v2, Vector _s, float _scale, float li, float hi, float lj, float hj, bool negative_values) {
+/*
+ * void set_profiler(profiler)
+ *
+ * Time the phases of the projection (render, isolines and write)
+ * with the given profiler
+ *
+ */
+void PlaneProjector::set_profiler(Profiler* _profiler) {
+    this->profiler = _profiler;
+}
+
+/*
+ * void set_thread_pool(pool)
+ *
+ * Render the tiles of the plane on the threads of the given pool instead
+ * of the calling thread only
+ *
+ */
+void PlaneProjector::set_thread_pool(ThreadPool* _pool) {
+    this->pool = _pool;
+}
+
+/*
+ * void set_verbose(verbose)
+ *
+ * Report the size, kernel and files of every frame on standard output
+ * (on by default)
+ *
+ */
+void PlaneProjector::set_verbose(bool _verbose) {
+    this->verbose = _verbose;
+}
+
+/*
+ * void set_keep_planes(keep_planes)
+ *
+ * Also store the values of the plane (real and on the logarithmic scale)
+ * while rendering, for write_planes()
+ *
+ */
+void PlaneProjector::set_keep_planes(bool _keep_planes) {
+    this->keep_planes = _keep_planes;
+}
+
+/*
+ * void set_png(level, filter)
+ *
+ * Compression level (0: none, 1: fastest, 9: smallest) and row filter of
+ * the image file
+ *
+ */
+void PlaneProjector::set_png(int _level, PngWriter::Filter _filter) {
+    this->png_level = _level;
+    this->png_filter = _filter;
+}
+
+/*
+ * void set_plane(v1, v2, s, scale, li, hi, lj, hj)
+ *
+ * Set the plane through s spanned by v1 and v2 and the window [li,hi] x
+ * [lj,hj] (in Angstrom along v1 and v2) at scale pixels per Angstrom. The
+ * image becomes the rectangle around the part of the window inside the
+ * unit cell, which follows from the crossings of the rows with the faces
+ * of the cell, so nothing outside it is sampled or stored.
+ *
+ */
+void PlaneProjector::set_plane(Vector _v1, Vector _v2, Vector _s, float _scale, float li, float hi, float lj, float hj) {
 
     //only use normalized vectors
     _v1.normalize();
     _v2.normalize();
+    this->v1 = _v1;
+    this->v2 = _v2;
+    this->s = _s;
+    this->scale = _scale;
 
-    this->ix = int((hi - li) * _scale);
-    this->iy = int((hj - lj) * _scale);
-
-    std::cout << "Creating " << this->ix << "x" << this->iy << "px image..." << std::endl;
-
-    this->planegrid_log =  new float[this->ix * this->iy];
-    this->planegrid_real =  new float[this->ix * this->iy];
-
-    for(int i=0; i<this->ix; i++) {
-        for(int j=0; j<this->iy; j++) {
-            float x = _v1[0] * float(i - this->ix / 2) / _scale + _v2[0] * float(j - this->iy / 2) / _scale + _s[0];
-            float y = _v1[1] * float(i - this->ix / 2) / _scale + _v2[1] * float(j - this->iy / 2) / _scale + _s[1];
-            float z = _v1[2] * float(i - this->ix / 2) / _scale + _v2[2] * float(j - this->iy / 2) / _scale + _s[2];
-            float val = this->sf->get_value_interp(x,y,z);
-            if(negative_values) {
-                if(val < -10) {
-                    this->planegrid_log[j * this->ix + i] = -log10(-val);
-                } else if(val > 10) {
-                    this->planegrid_log[j * this->ix + i] = log10(val);
-                } else {
-                    this->planegrid_log[j * this->ix + i] = val / 10.0;
-                }
-            } else {
-                this->planegrid_log[j * this->ix + i] = log10(val);
-            }
-            this->planegrid_real[j * this->ix + i] = val;
+    // pixels of the whole window, centered on the starting point
+    this->wx = int((hi - li) * _scale);
+    this->wy = int((hj - lj) * _scale);
+
+    const XYZ step = this->get_step();
+    unsigned int min_x = this->wx, max_x = 0, min_y = this->wy, max_y = 0;
+    for(int j=0; j<this->wy; j++) {
+        unsigned int begin, end;
+        this->sf->get_span(this->get_row_start(j), step, this->wx, &begin, &end);
+        if(begin < end) {
+            min_x = std::min(min_x, begin);
+            max_x = std::max(max_x, end);
+            min_y = std::min(min_y, (unsigned int)j);
+            max_y = j + 1;
         }
     }
+    if(min_y >= max_y) {
+        std::cerr << "WARNING: the cutting plane does not pass through the unit cell" << std::endl;
+        min_x = min_y = 0;
+        max_x = this->wx;
+        max_y = this->wy;
+    }
 
-    this->cut_and_recast_plane();
-}
+    this->left = min_x;
+    this->top = min_y;
+    this->ix = max_x - min_x;
+    this->iy = max_y - min_y;
 
-void PlaneProjector::isolines(unsigned int bins, bool negative_values) {
-    float binsize = (this->max - this->min) / float(bins + 1);
-    if(negative_values) {
-        for(float val = this->min; val < this->max; val += binsize) {
-            if(val < -1) {
-                this->draw_isoline(-pow(10,-val));
-            }
-            if(val > 1) {
-                this->draw_isoline(pow(10,val));
-            }
-        }
-        this->draw_isoline(0);
-    } else {
-        for(float val = this->min; val < this->max; val += binsize) {
-            this->draw_isoline(pow(10,val));
-        }
-        this->draw_isoline(0);
+    if(this->verbose) {
+        std::cout << "Clipping to [" << min_x << ":" << max_x
+                  << "] x [" << min_y << ":" << max_y << "]" << std::endl;
     }
 }
 
-void PlaneProjector::draw_isoline(float val) {
-    for(unsigned int i=1; i<uint(this->ix-1); i++) {
-        for(unsigned int j=1; j<uint(this->iy-1); j++) {
-            if(this->is_crossing(i,j,val)) {
-                this->plt->draw_filled_rectangle(i,j, 1, 1, Color(0,0,0));
-            }
-        }
+/*
+ * void render(bins, negative_values)
+ *
+ * Draw the plane with isolines at bins levels (see get_levels()). The
+ * image is made tile by tile: the values of a tile are interpolated, put
+ * on the logarithmic scale, colored and written to the image, and its
+ * cells are traced for isolines, while they are still in cache. No plane
+ * of values is stored; a tile also samples one row and one column beyond
+ * it, for the cells on its border. The isolines are then joined and
+ * stroked on top of the image. Only with set_keep_planes() the values
+ * are also copied to whole planes.
+ *
+ */
+void PlaneProjector::render(unsigned int bins, bool negative_values) {
+    if(this->verbose) {
+        std::cout << "Creating " << this->ix << "x" << this->iy << "px image..." << std::endl;
+        std::cout << "Interpolating with the " << Trilinear::get_name(Trilinear::get_kernel()) << " kernel on "
+                  << (this->pool != NULL ? this->pool->get_threads() : 1) << " thread(s)" << std::endl;
     }
-}
 
-bool PlaneProjector::is_crossing(const unsigned int &i, const unsigned int &j, const float &val) {
-    if(this->planegrid_real[(j-1) * this->ix + (i)] < val && this->planegrid_real[(j+1) * this->ix + (i)] > val) {
-        return true;
-    }
-    if(this->planegrid_real[(j-1) * this->ix + (i)] > val && this->planegrid_real[(j+1) * this->ix + (i)] < val) {
-        return true;
-    }
-    if(this->planegrid_real[(j) * this->ix + (i-1)] > val && this->planegrid_real[(j) * this->ix + (i+1)] < val) {
-        return true;
-    }
-    if(this->planegrid_real[(j) * this->ix + (i-1)] < val && this->planegrid_real[(j) * this->ix + (i+1)] > val) {
-        return true;
-    }
-    return false;
-}
+    if(this->profiler) this->profiler->start("render");
+    const std::vector<float> levels = this->get_levels(bins, negative_values);
+    const XYZ step = this->get_step();
+    const unsigned int nx = this->ix;
+    const unsigned int ny = this->iy;
+    const unsigned int ntx = (nx + tile_width - 1) / tile_width;
+    const unsigned int nty = (ny + tile_rows - 1) / tile_rows;
+    std::vector<std::vector<MarchingSquares::Segment> > segments(ntx * nty);
 
-void PlaneProjector::cut_and_recast_plane() {
-    unsigned int min_x = 0;
-    unsigned int max_x = this->ix;
-    unsigned int min_y = 0;
-    unsigned int max_y = this->iy;
+    // the image and planes of the previous frame are reused if they have
+    // the same size; the tiles overwrite every pixel
+    if(this->plt == NULL || this->plt->get_width() != nx || this->plt->get_height() != ny) {
+        delete this->plt;
+        this->plt = new Plotter(nx, ny);
+    }
+    this->plt->begin_raster();
 
-    // determine min_x
-    for(unsigned int i=0; i<uint(this->ix); i++) {
-        bool line = false;
-        for(unsigned int j=0; j<uint(this->iy); j++) {
-            if(this->planegrid_real[(j) * this->ix + i] != 0.0) {
-                line = true;
-            }
-        }
-        if(line) {
-            min_x = i;
-            break;
-        }
+    if(this->keep_planes && this->plane_size != size_t(nx) * ny) {
+        delete[] this->planegrid_real;
+        delete[] this->planegrid_log;
+        this->plane_size = size_t(nx) * ny;
+        this->planegrid_real = new float[this->plane_size];
+        this->planegrid_log = new float[this->plane_size];
     }
 
-    // determine max_x
-    for(unsigned int i=uint(this->ix); i>0; i--) {
-        bool line = false;
-        for(unsigned int j=0; j<uint(this->iy); j++) {
-            if(this->planegrid_real[(j) * this->ix + i] != 0.0) {
-                line = true;
+    // tiles through the middle of the cell are expensive and tiles near
+    // its corners are not, so the pool balances them by stealing
+    ThreadPool::Body render_tiles = [&](unsigned int begin, unsigned int end) {
+        const size_t stride = tile_width + 1;
+        std::vector<float> values(stride * (tile_rows + 1));
+        std::vector<float> logs(tile_width);
+        for(unsigned int t=begin; t<end; t++) {
+            const unsigned int x0 = (t % ntx) * tile_width;
+            const unsigned int y0 = (t / ntx) * tile_rows;
+            const unsigned int w = std::min(tile_width, nx - x0);
+            const unsigned int h = std::min(tile_rows, ny - y0);
+            const unsigned int sw = std::min(w + 1, nx - x0);
+            const unsigned int sh = std::min(h + 1, ny - y0);
+            for(unsigned int y=0; y<sh; y++) {
+                float* row = &values[y * stride];
+                this->sf->sample_span(this->get_row_start(this->top + y0 + y), step,
+                                      this->left + x0, this->left + x0 + sw, row);
+                if(y < h) {
+                    float* log_row = &logs[0];
+                    if(this->keep_planes) {
+                        std::copy(row, row + w, this->planegrid_real + size_t(y0 + y) * nx + x0);
+                        log_row = this->planegrid_log + size_t(y0 + y) * nx + x0;
+                    }
+                    ColorMap::log_scale(row, w, negative_values, log_row);
+                    this->scheme->get_pixels(log_row, w, this->plt->get_raster_row(y0 + y) + x0);
+                }
             }
+            MarchingSquares::trace_cells(&values[0], stride, x0, y0, sw - 1, sh - 1, nx, levels, segments[t]);
         }
-        if(line) {
-            max_x = i;
-            break;
-        }
+    };
+    if(this->pool != NULL) {
+        this->pool->parallel_for(ntx * nty, 1, render_tiles);
+    } else {
+        render_tiles(0, ntx * nty);
     }
+    this->plt->end_raster();
 
-    // determine min_y
-    for(unsigned int j=0; j<uint(this->iy); j++) {
-        bool line = false;
-        for(unsigned int i=0; i<uint(this->ix); i++) {
-            if(this->planegrid_real[(j) * this->ix + i] != 0.0) {
-                line = true;
-            }
-        }
-        if(line) {
-            min_y = j;
-            break;
-        }
+    if(this->profiler) {
+        this->profiler->stop("render", 0, size_t(nx) * ny, "pixels");
+        this->profiler->start("isolines");
     }
 
-    // determine max_y
-    for(unsigned int j=uint(this->iy-1); j>0; j--) {
-        bool line = false;
-        for(unsigned int i=0; i<uint(this->ix); i++) {
-            if(this->planegrid_real[(j) * this->ix + i] != 0.0) {
-                line = true;
-            }
-        }
-        if(line) {
-            max_y = j;
-            break;
+    // every level is stroked as one path
+    std::vector<std::vector<MarchingSquares::Polyline> > lines;
+    MarchingSquares::join(segments, levels.size(), this->pool, lines);
+    for(unsigned int l=0; l<lines.size(); l++) {
+        for(unsigned int p=0; p<lines[l].size(); p++) {
+            const MarchingSquares::Polyline &line = lines[l][p];
+            this->plt->add_polyline(&line.points[0], line.points.size() / 2, line.closed);
         }
+        this->plt->stroke_path(Color(0,0,0), 1.0);
     }
+    if(this->profiler) this->profiler->stop("isolines", 0, size_t(nx) * ny, "pixels");
+}
 
-    unsigned int nx = max_x - min_x;
-    unsigned int ny = max_y - min_y;
+/*
+ * size_t get_pixels()
+ *
+ * Number of pixels of the image
+ *
+ */
+size_t PlaneProjector::get_pixels() const {
+    return size_t(this->ix) * this->iy;
+}
+
+/*
+ * XYZ get_row_start(j)
+ *
+ * Position of the first pixel of row j of the window
+ *
+ */
+XYZ PlaneProjector::get_row_start(int j) const {
+    XYZ start;
+    start.x = this->v1[0] * float(-(this->wx / 2)) / this->scale + this->v2[0] * float(j - this->wy / 2) / this->scale + this->s[0];
+    start.y = this->v1[1] * float(-(this->wx / 2)) / this->scale + this->v2[1] * float(j - this->wy / 2) / this->scale + this->s[1];
+    start.z = this->v1[2] * float(-(this->wx / 2)) / this->scale + this->v2[2] * float(j - this->wy / 2) / this->scale + this->s[2];
+    return start;
+}
 
-    std::cout << "Recasting to [" << min_x << ":" << max_x
-              << "] x [" << min_y << ":" << max_y << "]" << std::endl;
+/*
+ * XYZ get_step()
+ *
+ * Distance between two pixels along a row
+ *
+ */
+XYZ PlaneProjector::get_step() const {
+    XYZ step;
+    step.x = this->v1[0] / this->scale;
+    step.y = this->v1[1] / this->scale;
+    step.z = this->v1[2] / this->scale;
+    return step;
+}
 
-    // recasting
-    float* newgrid_log = new float[nx * ny];
-    float* newgrid_real = new float[nx * ny];
-    for(unsigned int i=0; i<nx; i++) {
-        for(unsigned int j=0; j<ny; j++) {
-            newgrid_log[j * nx + i] = this->planegrid_log[(j + min_y) * this->ix + (i + min_x)];
-            newgrid_real[j * nx + i] = this->planegrid_real[(j + min_y) * this->ix + (i + min_x)];
+/*
+ * std::vector<float> get_levels(bins, negative_values)
+ *
+ * Values of the isolines (sorted): bins steps over the logarithmic color
+ * scale, and zero
+ *
+ */
+std::vector<float> PlaneProjector::get_levels(unsigned int bins, bool negative_values) const {
+    float binsize = (this->max - this->min) / float(bins + 1);
+    std::vector<float> levels;
+    if(negative_values) {
+        for(float val = this->min; val < this->max; val += binsize) {
+            if(val < -1) {
+                levels.push_back(-pow(10,-val));
+            }
+            if(val > 1) {
+                levels.push_back(pow(10,val));
+            }
+        }
+    } else {
+        for(float val = this->min; val < this->max; val += binsize) {
+            levels.push_back(pow(10,val));
         }
     }
+    levels.push_back(0);
+    std::sort(levels.begin(), levels.end());
+    levels.erase(std::unique(levels.begin(), levels.end()), levels.end());
+    return levels;
+}
 
-    delete[] this->planegrid_real;
-    delete[] this->planegrid_log;
-    this->planegrid_real = newgrid_real;
-    this->planegrid_log = newgrid_log;
-    this->ix = nx;
-    this->iy = ny;
-}
-
-void PlaneProjector::plot() {
-    this->plt = new Plotter(this->ix, this->iy);
-    for(unsigned int i=0; i<uint(this->ix); i++) {
-        for(unsigned int j=0; j<uint(this->iy); j++) {
-            this->plt->draw_filled_rectangle(i,j, 1, 1,
-                this->scheme->get_color(this->planegrid_log[j * this->ix + i]));
-        }
+/*
+ * bool write(filename)
+ *
+ * Write the image to a PNG file, compressed on the threads of the pool
+ *
+ */
+bool PlaneProjector::write(std::string filename) {
+    if(this->profiler) this->profiler->start("write");
+    PngWriter png(this->png_level, this->png_filter);
+    png.set_thread_pool(this->pool);
+    bool ok = this->plt->write(filename.c_str(), png);
+    if(this->profiler) {
+        struct stat st;
+        size_t bytes = (stat(filename.c_str(), &st) == 0) ? size_t(st.st_size) : 0;
+        this->profiler->stop("write", bytes, size_t(this->ix) * this->iy, "pixels");
     }
+    if(ok && this->verbose) {
+        std::cout << "Writing " << filename << std::endl;
+    }
+    return ok;
 }
 
-void PlaneProjector::write(std::string filename) {
-    plt->write(filename.c_str());
-    std::cout << "Writing " << filename << std::endl;
+/*
+ * bool write_planes(prefix, format)
+ *
+ * Write the values of the plane to prefix_real and prefix_log (with the
+ * extension of the format); needs set_keep_planes() before render()
+ *
+ */
+bool PlaneProjector::write_planes(const std::string &prefix, PlaneWriter::Format format) {
+    if(!this->keep_planes || this->planegrid_real == NULL) {
+        std::cerr << "ERROR: The values of the plane were not kept" << std::endl;
+        return false;
+    }
+
+    if(this->profiler) this->profiler->start("dump");
+    const std::string file_real = prefix + "_real" + PlaneWriter::get_extension(format);
+    const std::string file_log = prefix + "_log" + PlaneWriter::get_extension(format);
+    bool ok;
+    if(format == PlaneWriter::FORMAT_NPY) {
+        ok = PlaneWriter::write_npy(file_real, this->planegrid_real, this->ix, this->iy) &&
+             PlaneWriter::write_npy(file_log, this->planegrid_log, this->ix, this->iy);
+    } else {
+        const XYZ step = this->get_step();
+        XYZ origin = this->get_row_start(this->top);
+        origin.x += step.x * this->left;
+        origin.y += step.y * this->left;
+        origin.z += step.z * this->left;
+        XYZ down;
+        down.x = this->v2[0] / this->scale;
+        down.y = this->v2[1] / this->scale;
+        down.z = this->v2[2] / this->scale;
+        ok = PlaneWriter::write_raw(file_real, this->planegrid_real, this->ix, this->iy, origin, step, down, false) &&
+             PlaneWriter::write_raw(file_log, this->planegrid_log, this->ix, this->iy, origin, step, down, true);
+    }
+    if(this->profiler) {
+        this->profiler->stop("dump", 2 * sizeof(float) * size_t(this->ix) * this->iy,
+                             size_t(this->ix) * this->iy, "pixels");
+    }
+    if(ok && this->verbose) {
+        std::cout << "Writing " << file_real << " and " << file_log << std::endl;
+    }
+    return ok;
 }
 
 PlaneProjector::~PlaneProjector() {
-    delete[] this->planegrid_log;
+    if(this->own_scheme) {
+        delete this->scheme;
+    }
+    delete this->plt;
     delete[] this->planegrid_real;
+    delete[] this->planegrid_log;
 }
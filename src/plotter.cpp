@@ -21,8 +21,6 @@
 #include "plotter.h"
 
 Plotter::Plotter(const unsigned int &_width, const unsigned int &_height) {
-  this->scheme = new ColorScheme(0, 10);
-
   this->width = _width;
   this->height = _height;
 
@@ -32,6 +30,19 @@ Plotter::Plotter(const unsigned int &_width, const unsigned int &_height) {
   this->set_background(Color(255, 252, 213));
 }
 
+Plotter::~Plotter() {
+  cairo_destroy(this->cr);
+  cairo_surface_destroy(this->surface);
+}
+
+unsigned int Plotter::get_width() const {
+  return this->width;
+}
+
+unsigned int Plotter::get_height() const {
+  return this->height;
+}
+
 /*
  * Sets the background color of the image
  */
@@ -96,8 +107,67 @@ void Plotter::draw_empty_circle(float cx, float cy, float radius,
   cairo_stroke(this->cr);
 }
 
-void Plotter::write(const char* filename) {
-  cairo_surface_write_to_png(this->surface, filename);
+/*
+ * Add a polyline of n points (x0, y0, x1, y1, ...) to the current path,
+ * which is drawn by stroke_path(). A closed polyline connects its last
+ * point to the first one.
+ */
+void Plotter::add_polyline(const float* points, size_t n, bool closed) {
+  if(n == 0) {
+    return;
+  }
+  cairo_move_to(this->cr, points[0], points[1]);
+  for(size_t i=1; i<n; i++) {
+    cairo_line_to(this->cr, points[2*i], points[2*i+1]);
+  }
+  if(closed) {
+    cairo_close_path(this->cr);
+  }
+}
+
+/*
+ * Draw all polylines added since the last stroke as a single path
+ */
+void Plotter::stroke_path(const Color &_color, float line_width) {
+  cairo_set_source_rgb(this->cr, _color.get_r(), _color.get_g(), _color.get_b());
+  cairo_set_line_width(this->cr, line_width);
+  cairo_set_line_join(this->cr, CAIRO_LINE_JOIN_ROUND);
+  cairo_stroke(this->cr);
+}
+
+/*
+ * Give direct access to the pixels of the image, i.e. to fill the image
+ * pixel by pixel, which is much faster than a rectangle per pixel. Cairo
+ * drawing has to wait until end_raster() is called.
+ */
+void Plotter::begin_raster() {
+  cairo_surface_flush(this->surface);
+}
+
+/*
+ * Row j of the image as ARGB32 pixels (see Color::get_argb()); rows are
+ * apart by the stride of the surface, which can exceed the width
+ */
+uint32_t* Plotter::get_raster_row(unsigned int j) {
+  unsigned char* data = cairo_image_surface_get_data(this->surface);
+  return reinterpret_cast<uint32_t*>(data + size_t(j) * cairo_image_surface_get_stride(this->surface));
+}
+
+/*
+ * Hand the pixels back to Cairo after writing to them
+ */
+void Plotter::end_raster() {
+  cairo_surface_mark_dirty(this->surface);
+}
+
+/*
+ * Write the image to a PNG file by the given writer (its compression
+ * level and filter) instead of at the fixed settings of Cairo
+ */
+bool Plotter::write(const char* filename, const PngWriter &png) {
+  cairo_surface_flush(this->surface);
+  return png.write(filename, cairo_image_surface_get_data(this->surface), this->width, this->height,
+                   cairo_image_surface_get_stride(this->surface));
 }
 
 /**************************************************************************
@@ -121,6 +191,7 @@ ColorScheme::ColorScheme(const double &_low, const double &_high) {
   this->high = _high;
   this->construct_scheme();
   this->convert_scheme();
+  this->build_table();
 }
 
 /**
@@ -202,6 +273,46 @@ Color ColorScheme::get_color(const double &_value) {
   return Color(r*255,g*255,b*255);
 }
 
+/**
+ *
+ * Sample the colorscheme at equal steps from the lower to the upper
+ * boundary into a table of packed ARGB32 pixels, such that a plane is
+ * colored by table lookups only (see get_pixels)
+ *
+ */
+void ColorScheme::build_table() {
+  static const unsigned int size = 4096;
+  this->table.resize(size);
+  for(unsigned int i=0; i<size-1; i++) {
+    double value = this->low + (this->high - this->low) * double(i) / double(size - 1);
+    this->table[i] = this->get_color(value).get_argb();
+  }
+  this->table[size-1] = this->colors.back().get_argb();
+}
+
+/**
+ *
+ * Return the table of colors for ColorMap::lookup
+ *
+ */
+ColorMap::Table ColorScheme::get_table() const {
+  ColorMap::Table t;
+  t.colors = &this->table[0];
+  t.size = this->table.size();
+  t.low = this->low;
+  t.scale = (this->high > this->low) ? float((this->table.size() - 1) / (this->high - this->low)) : 0.0f;
+  return t;
+}
+
+/**
+ *
+ * Convert n values to pixels by the nearest colors in the table
+ *
+ */
+void ColorScheme::get_pixels(const float* values, size_t n, uint32_t* pixels) const {
+  ColorMap::lookup(this->get_table(), values, n, pixels);
+}
+
 /**
  *
  * Convert a single hexidecimal value to an integer
@@ -254,3 +365,13 @@ float Color::get_g() const {
 float Color::get_b() const {
   return this->b / 255.0f;
 }
+
+/**
+ *
+ * Return the color as an opaque ARGB32 pixel (native endian, as Cairo
+ * stores them in an image surface)
+ *
+ */
+uint32_t Color::get_argb() const {
+  return 0xFF000000u | (uint32_t(this->r & 0xFF) << 16) | (uint32_t(this->g & 0xFF) << 8) | uint32_t(this->b & 0xFF);
+}
@@ -0,0 +1,370 @@
+/**************************************************************************
+ *   png_writer.cpp                                                       *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#include "png_writer.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <zlib.h>
+
+const size_t PngWriter::strip_bytes;
+const size_t PngWriter::window;
+
+PngWriter::PngWriter(int _level, Filter _filter) {
+    this->level = _level;
+    this->filter = _filter;
+    this->pool = NULL;
+}
+
+/*
+ * void set_thread_pool(pool)
+ *
+ * Filter and deflate the strips of the image on the threads of the given
+ * pool instead of the calling thread only
+ *
+ */
+void PngWriter::set_thread_pool(ThreadPool* _pool) {
+    this->pool = _pool;
+}
+
+/*
+ * bool write(filename, data, width, height, stride)
+ *
+ * Write the ARGB32 image of width x height pixels at data, with rows
+ * stride bytes apart, to a PNG file
+ *
+ */
+bool PngWriter::write(const char* filename, const unsigned char* data, unsigned int width,
+                      unsigned int height, size_t stride) const {
+    if(width == 0 || height == 0) {
+        std::cerr << "ERROR: Cannot write an empty image to " << filename << std::endl;
+        return false;
+    }
+
+    // the plot is opaque unless the background was left transparent
+    unsigned int channels = 3;
+    for(unsigned int j=0; j<height && channels == 3; j++) {
+        const uint32_t* row = reinterpret_cast<const uint32_t*>(data + j * stride);
+        for(unsigned int i=0; i<width; i++) {
+            if((row[i] >> 24) != 0xFF) {
+                channels = 4;
+                break;
+            }
+        }
+    }
+
+    const size_t line = size_t(width) * channels + 1;      // filter type and row
+    const unsigned int rows = std::max(size_t(1), strip_bytes / line);
+    const unsigned int nstrips = (height + rows - 1) / rows;
+
+    FILE* f = fopen(filename, "wb");
+    if(f == NULL) {
+        std::cerr << "ERROR: Cannot open " << filename << " for writing" << std::endl;
+        return false;
+    }
+
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    fwrite(signature, 1, 8, f);
+
+    unsigned char ihdr[13];
+    for(int k=0; k<4; k++) {
+        ihdr[k] = (width >> (24 - 8 * k)) & 0xFF;
+        ihdr[4 + k] = (height >> (24 - 8 * k)) & 0xFF;
+    }
+    ihdr[8] = 8;                            // bits per sample
+    ihdr[9] = (channels == 3) ? 2 : 6;      // RGB or RGBA
+    ihdr[10] = 0;                           // deflate
+    ihdr[11] = 0;                           // adaptive filtering
+    ihdr[12] = 0;                           // not interlaced
+    write_chunk(f, "IHDR", ihdr, 13);
+
+    // zlib header (deflate, 32 KiB window, level hint) before the first strip
+    unsigned char cmf = 0x78;
+    unsigned char flg = (this->level < 2 ? 0 : this->level < 6 ? 1 : this->level == 6 ? 2 : 3) << 6;
+    flg += 31 - (cmf * 256 + flg) % 31;
+    const unsigned char header[2] = {cmf, flg};
+
+    // the strips are encoded a batch at a time and every compressed strip is
+    // released once its chunk is written, so only a batch is held in memory
+    const unsigned int batch = (this->pool != NULL) ? 2 * this->pool->get_threads() : 1;
+    std::vector<std::vector<unsigned char> > streams(batch);
+    std::vector<unsigned long> checksums(batch);
+    std::vector<size_t> lengths(batch);
+    std::vector<char> failed(batch);
+    uLong adler = adler32(0L, Z_NULL, 0);
+    for(unsigned int s0=0; s0<nstrips; s0+=batch) {
+        const unsigned int n = std::min(batch, nstrips - s0);
+        ThreadPool::Body encode_strips = [&](unsigned int begin, unsigned int end) {
+            for(unsigned int b=begin; b<end; b++) {
+                failed[b] = !this->encode_strip(data, width, height, stride, channels, (s0 + b) * rows, rows,
+                                                s0 + b + 1 == nstrips, streams[b], &checksums[b], &lengths[b]);
+            }
+        };
+        if(s0 == 0) {
+            streams[0].assign(header, header + 2);
+        }
+        if(this->pool != NULL) {
+            this->pool->parallel_for(n, 1, encode_strips);
+        } else {
+            encode_strips(0, n);
+        }
+
+        for(unsigned int b=0; b<n; b++) {
+            if(failed[b]) {
+                std::cerr << "ERROR: Cannot compress the image for " << filename << std::endl;
+                fclose(f);
+                return false;
+            }
+            adler = adler32_combine(adler, checksums[b], z_off_t(lengths[b]));
+            if(s0 + b + 1 == nstrips) {
+                // zlib trailer
+                for(int k=3; k>=0; k--) {
+                    streams[b].push_back((adler >> (8 * k)) & 0xFF);
+                }
+            }
+            write_chunk(f, "IDAT", &streams[b][0], streams[b].size());
+            std::vector<unsigned char>().swap(streams[b]);
+        }
+    }
+    write_chunk(f, "IEND", NULL, 0);
+
+    bool ok = !ferror(f);
+    ok = (fclose(f) == 0) && ok;
+    if(!ok) {
+        std::cerr << "ERROR: Cannot write " << filename << std::endl;
+    }
+    return ok;
+}
+
+/*
+ * void convert_row(in, width, channels, out)
+ *
+ * Turn a row of premultiplied ARGB32 pixels into RGB or RGBA bytes
+ *
+ */
+void PngWriter::convert_row(const uint32_t* in, unsigned int width, unsigned int channels, unsigned char* out) {
+    if(channels == 3) {
+        for(unsigned int i=0; i<width; i++) {
+            out[3*i]   = (in[i] >> 16) & 0xFF;
+            out[3*i+1] = (in[i] >> 8) & 0xFF;
+            out[3*i+2] = in[i] & 0xFF;
+        }
+        return;
+    }
+
+    for(unsigned int i=0; i<width; i++) {
+        const unsigned int a = in[i] >> 24;
+        unsigned int r = (in[i] >> 16) & 0xFF;
+        unsigned int g = (in[i] >> 8) & 0xFF;
+        unsigned int b = in[i] & 0xFF;
+        if(a == 0) {
+            r = g = b = 0;
+        } else if(a != 0xFF) {
+            r = (r * 255 + a / 2) / a;
+            g = (g * 255 + a / 2) / a;
+            b = (b * 255 + a / 2) / a;
+        }
+        out[4*i]   = r;
+        out[4*i+1] = g;
+        out[4*i+2] = b;
+        out[4*i+3] = a;
+    }
+}
+
+/*
+ * void filter_row(row, prev, n, bpp, f, trial, out)
+ *
+ * Write the filter type and the n filtered bytes of row (given the
+ * previous row, zero for the first one) to out; FILTER_ADAPTIVE tries the
+ * filters in trial (n + 1 bytes)
+ *
+ */
+void PngWriter::filter_row(const unsigned char* row, const unsigned char* prev, size_t n,
+                           unsigned int bpp, Filter f, unsigned char* trial, unsigned char* out) {
+    if(f == FILTER_ADAPTIVE) {
+        unsigned long best = 0;
+        for(int t=FILTER_NONE; t<=FILTER_PAETH; t++) {
+            unsigned char* dest = (t == FILTER_NONE) ? out : trial;
+            filter_row(row, prev, n, bpp, Filter(t), NULL, dest);
+            unsigned long cost = get_cost(dest, n + 1);
+            if(t == FILTER_NONE) {
+                best = cost;
+            } else if(cost < best) {
+                best = cost;
+                memcpy(out, dest, n + 1);
+            }
+        }
+        return;
+    }
+
+    out[0] = (unsigned char)f;
+    unsigned char* o = out + 1;
+    switch(f) {
+        case FILTER_SUB:
+            for(size_t i=0; i<n; i++) {
+                o[i] = row[i] - (i >= bpp ? row[i - bpp] : 0);
+            }
+            break;
+        case FILTER_UP:
+            for(size_t i=0; i<n; i++) {
+                o[i] = row[i] - prev[i];
+            }
+            break;
+        case FILTER_AVERAGE:
+            for(size_t i=0; i<n; i++) {
+                o[i] = row[i] - (((i >= bpp ? row[i - bpp] : 0) + prev[i]) >> 1);
+            }
+            break;
+        case FILTER_PAETH:
+            for(size_t i=0; i<n; i++) {
+                const int a = (i >= bpp) ? row[i - bpp] : 0;
+                const int b = prev[i];
+                const int c = (i >= bpp) ? prev[i - bpp] : 0;
+                const int pa = std::abs(b - c);
+                const int pb = std::abs(a - c);
+                const int pc = std::abs(a + b - 2 * c);
+                o[i] = row[i] - ((pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c);
+            }
+            break;
+        default:
+            memcpy(o, row, n);
+            break;
+    }
+}
+
+/*
+ * unsigned long get_cost(line, n)
+ *
+ * Sum of the absolute values of the filtered bytes (as signed bytes)
+ *
+ */
+unsigned long PngWriter::get_cost(const unsigned char* line, size_t n) {
+    unsigned long sum = 0;
+    for(size_t i=1; i<n; i++) {
+        sum += (line[i] < 128) ? line[i] : 256 - line[i];
+    }
+    return sum;
+}
+
+/*
+ * bool encode_strip(data, width, height, stride, channels, j0, rows, last, out, checksum, length)
+ *
+ * Filter the rows j0 up to j0 + rows of the image and append their deflate
+ * stream to out; the filtered rows within the window before j0 are redone
+ * to prime deflate. Returns the adler32 checksum and the number of the
+ * filtered bytes of the strip.
+ *
+ */
+bool PngWriter::encode_strip(const unsigned char* data, unsigned int width, unsigned int height, size_t stride,
+                             unsigned int channels, unsigned int j0, unsigned int rows, bool last,
+                             std::vector<unsigned char> &out, unsigned long* checksum, size_t* length) const {
+    const size_t rowbytes = size_t(width) * channels;
+    const size_t line = rowbytes + 1;
+    const unsigned int j1 = std::min(height, j0 + rows);
+    const unsigned int h0 = (this->level > 0) ? j0 - std::min(size_t(j0), (window + line - 1) / line) : j0;
+
+    std::vector<unsigned char> filtered(line * (j1 - h0));
+    std::vector<unsigned char> cur(rowbytes), prev(rowbytes, 0), trial(line);
+    if(h0 > 0) {
+        convert_row(reinterpret_cast<const uint32_t*>(data + (h0 - 1) * stride), width, channels, &prev[0]);
+    }
+    for(unsigned int j=h0; j<j1; j++) {
+        convert_row(reinterpret_cast<const uint32_t*>(data + j * stride), width, channels, &cur[0]);
+        filter_row(&cur[0], &prev[0], rowbytes, channels, this->filter, &trial[0], &filtered[(j - h0) * line]);
+        cur.swap(prev);
+    }
+
+    const size_t history = (j0 - h0) * line;
+    *length = filtered.size() - history;
+    *checksum = adler32(adler32(0L, Z_NULL, 0), &filtered[history], uInt(*length));
+    return this->deflate_strip(&filtered[history], &filtered[0] + filtered.size(),
+                               std::min(history, window), last, out);
+}
+
+/*
+ * bool deflate_strip(begin, end, history, last, out)
+ *
+ * Deflate the bytes [begin, end) to a raw deflate stream appended to out,
+ * with the history bytes before begin as dictionary. The stream of the last strip is
+ * finished, the others end on a byte boundary by a sync flush.
+ *
+ */
+bool PngWriter::deflate_strip(const unsigned char* begin, const unsigned char* end, size_t history,
+                              bool last, std::vector<unsigned char> &out) const {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    int strategy = (this->filter == FILTER_NONE) ? Z_DEFAULT_STRATEGY : Z_FILTERED;
+    if(deflateInit2(&zs, this->level, Z_DEFLATED, -15, 8, strategy) != Z_OK) {
+        return false;
+    }
+    if(history > 0 && this->level > 0) {
+        deflateSetDictionary(&zs, begin - history, uInt(history));
+    }
+
+    const size_t n = end - begin;
+    size_t done = out.size();
+    out.resize(done + deflateBound(&zs, n) + 16);
+    zs.next_in = const_cast<Bytef*>(begin);
+    zs.avail_in = uInt(n);
+    int ret;
+    do {
+        if(done == out.size()) {
+            out.resize(out.size() * 2);
+        }
+        zs.next_out = &out[done];
+        zs.avail_out = uInt(out.size() - done);
+        ret = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+        done = out.size() - zs.avail_out;
+    } while(ret == Z_OK && zs.avail_out == 0);
+    deflateEnd(&zs);
+    out.resize(done);
+
+    return last ? (ret == Z_STREAM_END) : (ret == Z_OK || ret == Z_BUF_ERROR);
+}
+
+/*
+ * void write_chunk(f, type, data, n)
+ *
+ * Write a chunk: length, type, the n bytes of data and the CRC of type
+ * and data
+ *
+ */
+void PngWriter::write_chunk(FILE* f, const char* type, const unsigned char* data, size_t n) {
+    unsigned char length[4] = {
+        (unsigned char)(n >> 24), (unsigned char)(n >> 16), (unsigned char)(n >> 8), (unsigned char)n
+    };
+    uLong crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, reinterpret_cast<const Bytef*>(type), 4);
+    if(n > 0) {
+        crc = crc32(crc, data, uInt(n));
+    }
+    unsigned char check[4] = {
+        (unsigned char)(crc >> 24), (unsigned char)(crc >> 16), (unsigned char)(crc >> 8), (unsigned char)crc
+    };
+    fwrite(length, 1, 4, f);
+    fwrite(type, 1, 4, f);
+    if(n > 0) {
+        fwrite(data, 1, n, f);
+    }
+    fwrite(check, 1, 4, f);
+}
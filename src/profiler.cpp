@@ -0,0 +1,261 @@
+/**************************************************************************
+ *   profiler.cpp                                                         *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#include "profiler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/*
+ * Constructor
+ *
+ * Opens the hardware counters; without permission to do so only wall
+ * time, throughput and memory are reported
+ *
+ */
+Profiler::Profiler() {
+    this->cycles_start = 0;
+    this->misses_start = 0;
+    this->fd_cycles = open_counter(PERF_COUNT_HW_CPU_CYCLES);
+    this->fd_misses = open_counter(PERF_COUNT_HW_CACHE_MISSES);
+    if(this->fd_cycles < 0 || this->fd_misses < 0) {
+        if(this->fd_cycles >= 0) close(this->fd_cycles);
+        if(this->fd_misses >= 0) close(this->fd_misses);
+        this->fd_cycles = -1;
+        this->fd_misses = -1;
+    }
+}
+
+/*
+ * Destructor
+ *
+ * Closes the hardware counters
+ *
+ */
+Profiler::~Profiler() {
+    if(this->fd_cycles >= 0) close(this->fd_cycles);
+    if(this->fd_misses >= 0) close(this->fd_misses);
+}
+
+/*
+ * void start(name)
+ *
+ * Start timing a phase
+ *
+ */
+void Profiler::start(const std::string &name) {
+    this->current = name;
+    this->cycles_start = read_counter(this->fd_cycles);
+    this->misses_start = read_counter(this->fd_misses);
+    this->started = std::chrono::steady_clock::now();
+}
+
+/*
+ * void stop(name, bytes, count, unit)
+ *
+ * Finish the running phase, which went through bytes bytes of data and
+ * count items of the given unit
+ *
+ */
+void Profiler::stop(const std::string &name, size_t bytes, size_t count, const std::string &unit) {
+    Phase phase;
+    phase.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - this->started).count();
+    phase.cycles = read_counter(this->fd_cycles) - this->cycles_start;
+    phase.cache_misses = read_counter(this->fd_misses) - this->misses_start;
+    phase.name = name;
+    phase.bytes = bytes;
+    phase.count = count;
+    phase.unit = unit;
+    phase.peak_rss = get_peak_rss();
+    if(name != this->current) {
+        std::cerr << "ERROR: Profiler phase " << name << " was never started" << std::endl;
+        return;
+    }
+    this->current.clear();
+    this->phases.push_back(phase);
+}
+
+/*
+ * void report(out, json)
+ *
+ * Write all phases either as a table or as a JSON object
+ *
+ */
+void Profiler::report(std::ostream &out, bool json) const {
+    std::ios_base::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    if(json) {
+        this->report_json(out);
+    } else {
+        this->report_text(out);
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+bool Profiler::has_counters() const {
+    return this->fd_cycles >= 0;
+}
+
+/*
+ * int open_counter(config)
+ *
+ * Open a hardware counter for user space events of this process and all
+ * threads it starts from now on. Counts of threads are added to the
+ * counter when they exit. Returns -1 when the counter is not available.
+ *
+ */
+int Profiler::open_counter(uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    long fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    return fd < 0 ? -1 : int(fd);
+}
+
+uint64_t Profiler::read_counter(int fd) {
+    uint64_t value = 0;
+    if(fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value)) {
+        return 0;
+    }
+    return value;
+}
+
+/*
+ * long get_peak_rss()
+ *
+ * Peak resident set size of the process so far in KiB
+ *
+ */
+long Profiler::get_peak_rss() {
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    return usage.ru_maxrss;
+}
+
+/*
+ * void report_text(out)
+ *
+ * One line per phase with the wall time, throughput and counters
+ *
+ */
+void Profiler::report_text(std::ostream &out) const {
+    double total = 0.0;
+    long peak = 0;
+
+    out << "Profile:" << std::endl;
+    out << std::left << std::setw(12) << "phase" << std::right
+        << std::setw(12) << "time [s]" << std::setw(14) << "MiB/s"
+        << std::setw(22) << "items/s";
+    if(this->has_counters()) {
+        out << std::setw(16) << "cycles" << std::setw(16) << "cache misses";
+    }
+    out << std::setw(14) << "peak RSS" << std::endl;
+
+    for(unsigned int i=0; i<this->phases.size(); i++) {
+        const Phase &p = this->phases[i];
+        std::ostringstream rate;
+        if(p.count > 0 && p.seconds > 0) {
+            rate << std::fixed << std::setprecision(2) << double(p.count) / p.seconds / 1e6
+                 << " M" << p.unit << "/s";
+        } else {
+            rate << "-";
+        }
+        std::ostringstream bandwidth;
+        if(p.bytes > 0 && p.seconds > 0) {
+            bandwidth << std::fixed << std::setprecision(1) << double(p.bytes) / p.seconds / (1024.0 * 1024.0);
+        } else {
+            bandwidth << "-";
+        }
+
+        out << std::left << std::setw(12) << p.name << std::right
+            << std::setw(12) << std::fixed << std::setprecision(4) << p.seconds
+            << std::setw(14) << bandwidth.str() << std::setw(22) << rate.str();
+        if(this->has_counters()) {
+            out << std::setw(16) << p.cycles << std::setw(16) << p.cache_misses;
+        }
+        out << std::setw(10) << p.peak_rss / 1024 << " MiB" << std::endl;
+
+        total += p.seconds;
+        peak = std::max(peak, p.peak_rss);
+    }
+
+    out << std::left << std::setw(12) << "total" << std::right
+        << std::setw(12) << std::fixed << std::setprecision(4) << total << std::endl;
+    out << "Peak RSS: " << peak << " KiB" << std::endl;
+    if(!this->has_counters()) {
+        out << "Hardware counters are not available (see /proc/sys/kernel/perf_event_paranoid)" << std::endl;
+    }
+}
+
+/*
+ * void report_json(out)
+ *
+ * All phases as a JSON object; counters that are not available are null
+ *
+ */
+void Profiler::report_json(std::ostream &out) const {
+    double total = 0.0;
+    long peak = 0;
+
+    out << "{" << std::endl << "  \"phases\": [" << std::endl;
+    for(unsigned int i=0; i<this->phases.size(); i++) {
+        const Phase &p = this->phases[i];
+        out << "    {\"name\": \"" << p.name << "\""
+            << ", \"seconds\": " << std::setprecision(9) << p.seconds
+            << ", \"bytes\": " << p.bytes
+            << ", \"bytes_per_second\": " << (p.seconds > 0 ? double(p.bytes) / p.seconds : 0.0)
+            << ", \"count\": " << p.count
+            << ", \"unit\": \"" << p.unit << "\""
+            << ", \"count_per_second\": " << (p.seconds > 0 ? double(p.count) / p.seconds : 0.0);
+        if(this->has_counters()) {
+            out << ", \"cycles\": " << p.cycles << ", \"cache_misses\": " << p.cache_misses;
+        } else {
+            out << ", \"cycles\": null, \"cache_misses\": null";
+        }
+        out << ", \"peak_rss_kib\": " << p.peak_rss << "}"
+            << (i + 1 < this->phases.size() ? "," : "") << std::endl;
+
+        total += p.seconds;
+        peak = std::max(peak, p.peak_rss);
+    }
+    out << "  ]," << std::endl;
+    out << "  \"total_seconds\": " << total << "," << std::endl;
+    out << "  \"peak_rss_kib\": " << peak << "," << std::endl;
+    out << "  \"hardware_counters\": " << (this->has_counters() ? "true" : "false") << std::endl;
+    out << "}" << std::endl;
+}
@@ -19,6 +19,10 @@
  **************************************************************************/
 
 #include "scalar_field.h"
+#include <chrono>
+#include <cstring>
+
+const size_t ScalarField::eval_chunk;
 
 /*
  * Default constructor
@@ -32,6 +36,40 @@ ScalarField::ScalarField(const std::string &_filename) {
   this->filename = _filename;
   this->scalar = -1;
   this->vasp5_input = false;
+  this->closed_grid = false;
+  this->periodic = false;
+  this->gridptr = NULL;
+  this->gridptr2 = NULL;
+  this->gridsize = 0;
+  this->nthreads = std::max(1u, std::thread::hardware_concurrency());
+  this->pool = NULL;
+  this->use_cache = false;
+  this->cache = NULL;
+  this->spin_mode = SPIN_TOTAL;
+  this->precision = GridStorage::PRECISION_FP32;
+  this->storage = NULL;
+  this->use_bricks = false;
+  this->bricks = NULL;
+  this->interpolation = INTERPOLATION_LINEAR;
+  this->prefiltered = false;
+  this->format = GridReader::FORMAT_AUTO;
+  this->layout.record = 0;
+  this->layout.z_fastest = false;
+  this->layout.spin_blocks = false;
+  this->use_region = false;
+  // no grid until read() has taken the header of the file
+  for(unsigned int i=0; i<3; i++) {
+    this->origin[i] = 0.0;
+    this->grid_dimensions[i] = 0;
+    for(unsigned int j=0; j<3; j++) {
+      this->mat[i][j] = 0.0;
+      this->imat[i][j] = 0.0;
+    }
+  }
+  this->slabs[0] = 0;
+  this->slabs[1] = 0;
+  this->bytes_read = 0;
+  this->stream_file = NULL;
 }
 
 /*
@@ -41,8 +79,15 @@ ScalarField::ScalarField(const std::string &_filename) {
  *
  */
 ScalarField::~ScalarField() {
-  delete[] this->gridptr;
+  if(this->cache != NULL) {
+    delete this->cache; // the grid lives inside the mapping of the cache
+  } else {
+    delete[] this->gridptr;
+  }
   delete[] this->gridptr2;
+  delete this->storage;
+  delete this->bricks;
+  delete this->stream_file;
 }
 
 /*
@@ -87,334 +132,1418 @@ void ScalarField::output() const {
 }
 
 /*
- * void read(bool debug)
+ * bool read(bool debug)
+ *
+ * Wrapper function that reads in the CHGCAR file
  *
- * Wrapper function that reads in the OUTCAR file
+ * The file is opened only once and walked from top to bottom; every
+ * read_* function continues where the previous one stopped. Returns
+ * false when the file cannot be read or does not hold the complete
+ * grid (or magnetization block); the field is then not to be used.
  *
  * Usage: sf.read(true);
  *
  */
-void ScalarField::read(bool debug) {
-  this->test_vasp5(debug);
-  this->read_scalar(debug);
-  this->read_matrix(debug);
-  this->read_atoms(debug);
-  this->read_grid_dimensions(debug);
-  this->read_grid(debug);
+bool ScalarField::read(bool debug) {
+  // standard input can neither be cached nor mapped
+  const bool from_stdin = (this->filename == "-");
+
+  if(this->use_cache && !from_stdin) {
+    // a cached coefficient grid spares both parsing and prefiltering
+    this->prefiltered = (this->interpolation == INTERPOLATION_CUBIC);
+    bool cached = this->read_cache(debug);
+    if(!cached && this->prefiltered) {
+      this->prefiltered = false;
+      cached = this->read_cache(debug);
+    }
+    if(cached) {
+      if(this->prefilter_grid(debug)) {
+        this->write_cache(debug);
+      }
+      this->compact_grid(debug);
+      this->arrange_grid(debug);
+      return true;
+    }
+  }
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  // compressed files are inflated on the fly by a background thread
+  CompressedStreambuf::Codec codec = from_stdin ? CompressedStreambuf::CODEC_NONE :
+                                     CompressedStream::detect(this->filename);
+  std::ifstream plainfile;
+  CompressedStream packedfile;
+  if(from_stdin) {
+    if(debug) std::cout << "Reading from standard input" << std::endl;
+  } else if(codec == CompressedStreambuf::CODEC_NONE) {
+    plainfile.open(this->filename.c_str(), std::ios::binary);
+  } else {
+    if(debug) std::cout << "Decompressing " << (codec == CompressedStreambuf::CODEC_GZIP ? "gzip" : "xz")
+                        << " input on the fly" << std::endl;
+    packedfile.open(this->filename, codec);
+  }
+  std::istream &infile = from_stdin ? std::cin :
+                         (codec == CompressedStreambuf::CODEC_NONE) ?
+                         static_cast<std::istream&>(plainfile) : packedfile;
+  if(!infile) {
+    std::cerr << "ERROR: Cannot open " << this->filename << std::endl;
+    return false;
+  }
+
+  // pick the reader for the format of the file
+  GridReader::Format fmt = this->format;
+  if(fmt == GridReader::FORMAT_AUTO) {
+    fmt = from_stdin ? GridReader::FORMAT_VASP : GridReader::detect(this->filename);
+  }
+  GridReader* reader = GridReader::create(fmt);
+  if(debug) std::cout << "Reading " << reader->get_name() << " file" << std::endl;
+  GridHeader header;
+  bool header_ok = reader->read_header(infile, header, debug);
+  this->layout = reader->get_layout(header);
+  delete reader;
+  if(!header_ok) {
+    std::cerr << "ERROR: Cannot read the header of " << this->filename << std::endl;
+    return false;
+  }
+  this->set_header(header);
+
+  if(this->spin_mode != SPIN_TOTAL && !this->layout.spin_blocks) {
+    std::cerr << "ERROR: " << this->filename << " does not contain a magnetization block" << std::endl;
+    return false;
+  }
+
+  // when a region is set, only the slabs it passes through are kept. The
+  // data block of a VASP file runs slab by slab, so a mapped file is read
+  // from the first of these slabs onwards; other input is cropped later.
+  this->select_slabs(debug);
+  const unsigned int block = this->gridsize;
+  const bool seekable = codec == CompressedStreambuf::CODEC_NONE && !from_stdin &&
+                        this->layout.record == 0 && !this->layout.z_fastest;
+  if(seekable) {
+    this->gridsize = this->grid_dimensions[0] * this->grid_dimensions[1]
+                     * (this->slabs[1] - this->slabs[0]);
+  }
+
+  this->gridptr = new float[this->gridsize];
+  if(this->spin_mode == SPIN_UP || this->spin_mode == SPIN_DOWN) {
+    this->gridptr2 = new float[this->gridsize]; // magnetization density
+  }
+
+  // try the memory mapped parallel reader first and fall back to the
+  // pipelined stream reader (pipes, standard input and compressed files)
+  std::streamoff bytes = infile.tellg();
+  bool complete = false;
+  if(codec == CompressedStreambuf::CODEC_NONE && !from_stdin) {
+    complete = this->read_grid_mapped(bytes, debug);
+  }
+  if(!complete) {
+    if(this->gridsize != block) {
+      this->gridsize = block;
+      delete[] this->gridptr;
+      this->gridptr = new float[this->gridsize];
+      if(this->gridptr2 != NULL) {
+        delete[] this->gridptr2;
+        this->gridptr2 = new float[this->gridsize];
+      }
+    }
+
+    StreamPipeline pipe(infile, this->nthreads);
+    complete = this->read_grid(pipe, debug);
+
+    // determine how far we got into the (decompressed) file; pipes
+    // only tell how much the pipeline has taken from them
+    infile.clear();
+    bytes = infile.tellg();
+    if(bytes < 0) {
+      bytes = pipe.get_bytes_read();
+    }
+  }
+
+  if(codec != CompressedStreambuf::CODEC_NONE && packedfile.has_failed()) {
+    std::cerr << "ERROR: " << this->filename << " is corrupt or truncated" << std::endl;
+    complete = false;
+  }
+
+  // bring files that run over z fastest into the order of the grid
+  if(this->layout.z_fastest) {
+    this->transpose_grid();
+  }
+  this->crop_grid();
+
+  this->bytes_read = bytes > 0 ? size_t(bytes) : 0;
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  if(debug) {
+    std::cout << "Read " << bytes << " bytes in " << elapsed << " s ("
+              << (elapsed > 0 ? double(bytes) / elapsed / (1024.0 * 1024.0) : 0.0)
+              << " MiB/s)" << std::endl;
+  }
+
+  if(!complete) {
+    if(this->spin_mode != SPIN_TOTAL) {
+      std::cerr << "ERROR: " << this->filename << " does not contain a complete magnetization block" << std::endl;
+    } else {
+      std::cerr << "ERROR: " << this->filename << " does not contain a complete grid" << std::endl;
+    }
+    return false;
+  }
+  this->combine_spin();
+
+  // a cropped grid is no replacement for the file
+  const bool cacheable = this->use_cache && !from_stdin &&
+                         this->slabs[1] - this->slabs[0] == this->grid_dimensions[2];
+  if(cacheable) {
+    this->write_cache(debug);
+  }
+
+  // the coefficients of the B-spline go into a sidecar of their own
+  if(this->prefilter_grid(debug) && cacheable) {
+    this->write_cache(debug);
+  }
+
+  this->compact_grid(debug);
+  this->arrange_grid(debug);
+  return true;
+}
+
+/*
+ * void set_spin_mode(spin_mode)
+ *
+ * Select which density is taken from a spin polarized file:
+ *
+ * SPIN_TOTAL:         the first block (spin up + spin down), default
+ * SPIN_MAGNETIZATION: the second block (spin up - spin down)
+ * SPIN_UP:            half the sum of both blocks
+ * SPIN_DOWN:          half the difference of both blocks
+ *
+ * The second block is only allocated and parsed when it is needed.
+ *
+ */
+void ScalarField::set_spin_mode(SpinMode _spin_mode) {
+  this->spin_mode = _spin_mode;
+}
+
+/*
+ * void combine_spin()
+ *
+ * Turn total and magnetization density into the spin up or spin down
+ * density and release the magnetization block
+ *
+ */
+void ScalarField::combine_spin() {
+  if(this->gridptr2 == NULL) {
+    return;
+  }
+
+  const float sign = (this->spin_mode == SPIN_DOWN) ? -1.0f : 1.0f;
+  for(unsigned int i=0; i<this->gridsize; i++) {
+    this->gridptr[i] = 0.5f * (this->gridptr[i] + sign * this->gridptr2[i]);
+  }
+
+  delete[] this->gridptr2;
+  this->gridptr2 = NULL;
+}
+
+/*
+ * bool open_values(debug)
+ *
+ * Read only the header of the file and leave the grid values to be parsed
+ * piece by piece by read_values(), i.e. while evaluate() runs over them,
+ * so the grid of this field is never held in memory.
+ *
+ * This needs a plain (uncompressed) file with a single record data block
+ * and the total density: VASP files, but not cube files, standard input
+ * or the spin up and down densities, which combine two blocks. Fields
+ * with a cache are read from it instead. Returns false when the field has
+ * to be read by read().
+ *
+ */
+bool ScalarField::open_values(bool debug) {
+  if(this->filename == "-" || this->use_cache || this->spin_mode != SPIN_TOTAL ||
+     CompressedStream::detect(this->filename) != CompressedStreambuf::CODEC_NONE) {
+    return false;
+  }
+
+  std::ifstream infile(this->filename.c_str(), std::ios::binary);
+  if(!infile) {
+    return false;
+  }
+  GridReader::Format fmt = this->format;
+  if(fmt == GridReader::FORMAT_AUTO) {
+    fmt = GridReader::detect(this->filename);
+  }
+  GridReader* reader = GridReader::create(fmt);
+  GridHeader header;
+  bool header_ok = reader->read_header(infile, header, false);
+  GridLayout stream_layout = reader->get_layout(header);
+  delete reader;
+  std::streamoff offset = infile.tellg();
+  if(!header_ok || stream_layout.record != 0 || stream_layout.z_fastest || offset < 0) {
+    return false;
+  }
+
+  MappedFile* mf = new MappedFile(this->filename);
+  if(!mf->is_open() || size_t(offset) > mf->size()) {
+    delete mf;
+    return false;
+  }
+
+  this->layout = stream_layout;
+  this->set_header(header);
+  this->select_slabs(debug);
+  const size_t slab = size_t(this->grid_dimensions[0]) * this->grid_dimensions[1];
+  if(!this->stream.open(mf->data() + offset, mf->data() + mf->size(), this->gridsize, slab * this->slabs[0])) {
+    delete mf;
+    return false;
+  }
+  this->gridsize = slab * (this->slabs[1] - this->slabs[0]);
+  this->stream_file = mf;
+  this->bytes_read = mf->size();
+
+  if(debug) std::cout << "Streaming the grid values of " << this->filename << std::endl;
+  return true;
+}
+
+/*
+ * bool read_values(out, count)
+ *
+ * Parse the next count grid values of a field opened by open_values()
+ *
+ */
+bool ScalarField::read_values(float* out, size_t count) {
+  if(this->stream_file == NULL || !this->stream.read(out, count, this->nthreads)) {
+    std::cerr << "ERROR: Cannot read the grid values of " << this->filename << std::endl;
+    return false;
+  }
+  this->stream_file->release(this->stream.get_position() - this->stream_file->data());
+  return true;
+}
+
+/*
+ * bool evaluate(expression, fields, debug)
+ *
+ * Replace the grid by the element-wise result of an expression over the
+ * grids of fields (this field may be one of them) in a single pass. All
+ * grids must have the same dimensions; this field has to be read at full
+ * precision, as do the fields that are not streamed. The values of the
+ * fields opened by open_values() are parsed eval_chunk at a time, right
+ * before the result of those grid points, so besides the result only the
+ * grids of fields that could not be streamed are held in memory. The
+ * result is then kept at the selected precision.
+ *
+ * Usage: sf_ab.read(true);
+ *        sf_a.open_values(true);
+ *        sf_ab.evaluate(expr, fields, true); // fields = {&sf_ab, &sf_a, ...}
+ *
+ */
+bool ScalarField::evaluate(const GridExpression &expression, const std::vector<ScalarField*> &fields, bool debug) {
+  std::vector<const float*> grids;
+  bool streamed = false;
+  for(unsigned int f=0; f<fields.size(); f++) {
+    const bool stream_field = (fields[f] != this && fields[f]->stream_file != NULL);
+    streamed = streamed || stream_field;
+    if((fields[f]->gridptr == NULL && !stream_field) || this->gridptr == NULL) {
+      std::cerr << "ERROR: " << fields[f]->filename << " has no grid at full precision" << std::endl;
+      return false;
+    }
+    if(fields[f]->bricks != NULL || this->bricks != NULL ||
+       fields[f]->prefiltered || this->prefiltered) {
+      std::cerr << "ERROR: " << fields[f]->filename << " has no grid of plain values" << std::endl;
+      return false;
+    }
+    for(unsigned int i=0; i<3; i++) {
+      if(fields[f]->grid_dimensions[i] != this->grid_dimensions[i]) {
+        std::cerr << "ERROR: The grid of " << fields[f]->filename << " ("
+                  << fields[f]->grid_dimensions[0] << "x" << fields[f]->grid_dimensions[1] << "x" << fields[f]->grid_dimensions[2]
+                  << ") does not match the grid of " << this->filename << " ("
+                  << this->grid_dimensions[0] << "x" << this->grid_dimensions[1] << "x" << this->grid_dimensions[2]
+                  << ")" << std::endl;
+        return false;
+      }
+    }
+    if(fields[f]->slabs[0] != this->slabs[0] || fields[f]->slabs[1] != this->slabs[1]) {
+      std::cerr << "ERROR: " << fields[f]->filename << " and " << this->filename
+                << " do not hold the same part of the grid" << std::endl;
+      return false;
+    }
+    grids.push_back(stream_field ? NULL : fields[f]->gridptr);
+  }
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  if(!streamed) {
+    expression.evaluate(grids, this->gridptr, this->gridsize, this->pool);
+  } else {
+    std::vector<std::vector<float> > values(fields.size());
+    std::vector<const float*> chunk(fields.size());
+    for(size_t first=0; first<this->gridsize; first+=eval_chunk) {
+      const size_t n = std::min(size_t(eval_chunk), this->gridsize - first);
+      for(unsigned int f=0; f<fields.size(); f++) {
+        if(grids[f] != NULL) {
+          chunk[f] = grids[f] + first;
+          continue;
+        }
+        values[f].resize(n);
+        if(!fields[f]->read_values(&values[f][0], n)) {
+          return false;
+        }
+        chunk[f] = &values[f][0];
+      }
+      expression.evaluate(chunk, this->gridptr + first, n, this->pool);
+    }
+    for(unsigned int f=0; f<fields.size(); f++) {
+      if(grids[f] == NULL) {
+        delete fields[f]->stream_file;
+        fields[f]->stream_file = NULL;
+      }
+    }
+  }
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  if(debug) {
+    std::cout << "Evaluated " << expression.get_text() << " over " << this->gridsize
+              << " grid points in " << elapsed << " s" << std::endl;
+  }
+
+  this->prefilter_grid(debug);
+  this->compact_grid(debug);
+  this->arrange_grid(debug);
+  return true;
+}
+
+/*
+ * size_t get_bytes_read()
+ *
+ * Number of bytes the last read() took from the input file (or the cache)
+ *
+ */
+size_t ScalarField::get_bytes_read() const {
+  return this->bytes_read;
+}
+
+/*
+ * unsigned int get_gridsize()
+ *
+ * Number of grid points held in memory
+ *
+ */
+unsigned int ScalarField::get_gridsize() const {
+  return this->gridsize;
 }
 
 /*
- * void test_vasp5(bool debug)
+ * void set_precision(precision)
  *
- * Test if the input file is a VASP5 output file
+ * Select how the grid is kept in memory after reading, see GridStorage.
+ * The file is always parsed (and cached) at full precision; a compact
+ * grid halves the memory of the field at the expense of a small error
+ * that read() reports.
  *
  */
-void ScalarField::test_vasp5(bool debug) {
-  if(debug) std::cout << "Testing VASP version: ";
-  std::ifstream infile(this->filename.c_str());
-  std::string line;
-  for(unsigned int i=0; i<5; i++) { // discard first two lines
-    std::getline(infile, line);
+void ScalarField::set_precision(GridStorage::Precision _precision) {
+  this->precision = _precision;
+}
+
+/*
+ * void compact_grid(debug)
+ *
+ * Move the grid into a compact GridStorage when a reduced precision has
+ * been selected and release the float grid
+ *
+ */
+void ScalarField::compact_grid(bool debug) {
+  if(this->precision == GridStorage::PRECISION_FP32 || this->gridptr == NULL) {
+    return;
+  }
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  const unsigned int dims[3] = {this->grid_dimensions[0], this->grid_dimensions[1],
+                                this->slabs[1] - this->slabs[0]};
+  this->storage = new GridStorage(this->precision, dims);
+  this->storage->encode(this->gridptr, this->nthreads);
+
+  if(debug) {
+    float lo = this->gridptr[0];
+    float hi = this->gridptr[0];
+    for(unsigned int i=1; i<this->gridsize; i++) {
+      lo = std::min(lo, this->gridptr[i]);
+      hi = std::max(hi, this->gridptr[i]);
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Stored grid as " << GridStorage::get_name(this->precision) << ": "
+              << double(this->storage->get_bytes()) / (1024.0 * 1024.0) << " MiB instead of "
+              << double(this->gridsize) * sizeof(float) / (1024.0 * 1024.0) << " MiB in "
+              << elapsed << " s" << std::endl;
+    std::cout << "Largest error " << this->storage->get_max_error() << " ("
+              << (hi > lo ? this->storage->get_max_error() / (hi - lo) : 0.0f)
+              << " of the value range)" << std::endl;
   }
-  std::getline(infile, line);
-  // check if this line contains atomic information (i.e. alpha-characters)
-  pcrecpp::RE re("^(.*[A-Za-z]+.*)$");
-  std::string ans;
-  if(re.FullMatch(line, &ans)) {
-    this->vasp5_input = true;
-    std::cout << "5" << std::endl;
+
+  if(this->cache != NULL) {
+    delete this->cache;
+    this->cache = NULL;
   } else {
-    std::cout << "4" << std::endl;
+    delete[] this->gridptr;
   }
+  this->gridptr = NULL;
 }
 
 /*
- * void read_scalar(bool debug)
+ * void set_bricks(use_bricks)
  *
- * Read the scalar value from the 2nd line of the
- * CHGCAR file. Note that all read_* functions can
- * be used seperately, although they may depend
- * on each other and have to be used in some
- * consecutive order as is done in the read()
- * wrapper function.
+ * Keep a full precision grid in the cache blocked order of BrickLayout
+ * after reading, which localizes the memory traffic of planes that are
+ * oblique to the lattice. Compact grids (see set_precision()) keep their
+ * own order.
  *
  */
-void ScalarField::read_scalar(bool debug) {
-  if(debug) std::cout << "Reading scalar...\t\t\t";
-  std::ifstream infile(this->filename.c_str());
-  std::string line;
-  std::getline(infile, line); // discard this line
+void ScalarField::set_bricks(bool _use_bricks) {
+  this->use_bricks = _use_bricks;
+}
 
-  std::getline(infile, line);
-  double val = -1;
-  pcrecpp::RE re("^\\s*([0-9.-]+)\\s*$");
-  re.FullMatch(line , &val);
-  this->scalar = val;
-  if(debug) std::cout << "[Done]" << std::endl;
+/*
+ * void arrange_grid(debug)
+ *
+ * Rearrange the float grid into bricks when they have been selected
+ *
+ */
+void ScalarField::arrange_grid(bool debug) {
+  if(!this->use_bricks || this->gridptr == NULL || this->bricks != NULL) {
+    return;
+  }
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  const unsigned int dims[3] = {this->grid_dimensions[0], this->grid_dimensions[1],
+                                this->slabs[1] - this->slabs[0]};
+  this->bricks = new BrickLayout(dims);
+  float* bricked = new float[this->bricks->get_size()];
+  this->bricks->arrange(this->gridptr, bricked, this->nthreads);
+
+  if(this->cache != NULL) {
+    delete this->cache;
+    this->cache = NULL;
+  } else {
+    delete[] this->gridptr;
+  }
+  this->gridptr = bricked;
+
+  if(debug) {
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Arranged grid into 8x8x8 bricks: "
+              << double(this->bricks->get_size()) * sizeof(float) / (1024.0 * 1024.0) << " MiB in "
+              << elapsed << " s" << std::endl;
+  }
 }
 
 /*
- * void read_matrix(bool debug)
+ * void set_interpolation(interpolation)
  *
- * Reads the matrix that defines the unit cell
- * in the CHGCAR file. The inverse of that matrix
- * is automatically constructed.
+ * Select how sample_row() and get_value_interp() interpolate between the
+ * grid points. For INTERPOLATION_CUBIC read() replaces the grid by the
+ * coefficients of the cubic B-spline through its values (see Tricubic),
+ * once, before the grid is compacted; with the cache enabled the
+ * coefficients are cached too. Both then evaluate the B-spline.
  *
- * Note that all read_* functions can
- * be used seperately, although they may depend
- * on each other and have to be used in some
- * consecutive order as is done in the read()
- * wrapper function.
+ */
+void ScalarField::set_interpolation(Interpolation _interpolation) {
+  this->interpolation = _interpolation;
+}
+
+/*
+ * bool prefilter_grid(debug)
+ *
+ * Turn the float grid into B-spline coefficients when cubic interpolation
+ * has been selected. The grid repeats along the axes of a periodic field
+ * and is reflected at its ends otherwise, as well as at the ends of a
+ * cropped grid. Returns whether the grid was filtered.
  *
  */
-void ScalarField::read_matrix(bool debug) {
-  if(debug) std::cout << "Reading unitcell matrix...\t\t";
-  std::ifstream infile(this->filename.c_str());
-  std::string line;
-  for(unsigned int i=0; i<2; i++) { // discard first two lines
-    std::getline(infile, line);
+bool ScalarField::prefilter_grid(bool debug) {
+  if(this->interpolation != INTERPOLATION_CUBIC || this->prefiltered || this->gridptr == NULL) {
+    return false;
   }
 
-  // setup match pattern
-  pcrecpp::RE re("^\\s*([0-9.-]+)\\s+([0-9.-]+)\\s+([0-9.-]+)\\s*$");
-  for(unsigned int i=0; i<3; i++) {
-    std::getline(infile, line);
-    re.FullMatch(line , &mat[i][0], &mat[i][1], &mat[i][2]);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  const unsigned int dims[3] = {this->grid_dimensions[0], this->grid_dimensions[1],
+                                this->slabs[1] - this->slabs[0]};
+  const bool repeat[3] = {this->periodic, this->periodic,
+                          this->periodic && dims[2] == this->grid_dimensions[2]};
+  Tricubic::prefilter(this->gridptr, dims, repeat, this->pool);
+  this->prefiltered = true;
+
+  if(debug) {
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Prefiltered grid for cubic interpolation in " << elapsed << " s" << std::endl;
   }
+  return true;
+}
 
+/*
+ * void set_cache(use_cache)
+ *
+ * Enable or disable the binary grid cache. When enabled, read() takes
+ * the grid from a valid sidecar next to the input file if there is one,
+ * and otherwise writes such a sidecar after parsing the file.
+ *
+ */
+void ScalarField::set_cache(bool _use_cache) {
+  this->use_cache = _use_cache;
+}
+
+/*
+ * bool read_cache(debug)
+ *
+ * Take header and grid from the binary sidecar of the input file. The
+ * grid is not copied; gridptr points into the mapping of the sidecar.
+ * Returns false when there is no sidecar or when it is outdated.
+ *
+ */
+bool ScalarField::read_cache(bool debug) {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  GridCache* c = new GridCache(this->filename, this->cache_variant());
+  if(!c->load()) {
+    if(debug) std::cout << "No valid grid cache found at " << c->get_path() << std::endl;
+    delete c;
+    return false;
+  }
+
+  const GridCacheHeader &h = c->get_header();
+  this->scalar = h.scalar;
   for(unsigned int i=0; i<3; i++) {
     for(unsigned int j=0; j<3; j++) {
-      this->mat[i][j] *= this->scalar;
+      this->mat[i][j] = h.mat[i][j];
     }
+    this->origin[i] = h.origin[i];
+    this->grid_dimensions[i] = h.grid_dimensions[i];
   }
-
-  // also construct inverse matrix
   this->calculate_inverse();
+  this->slabs[0] = 0;
+  this->slabs[1] = this->grid_dimensions[2];
+  this->vasp5_input = h.vasp5_input != 0;
+  this->closed_grid = h.closed_grid != 0;
+  this->nrat = c->get_nrat();
+  this->gridline = c->get_gridline();
+  this->gridsize = h.data_count;
+  this->gridptr = c->get_grid();
+  this->cache = c;
+  this->bytes_read = size_t(this->gridsize) * sizeof(float);
 
-  if(debug) std::cout << "[Done]" << std::endl;
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  if(debug) {
+    std::cout << "Loaded " << this->grid_dimensions[0] << "x" << this->grid_dimensions[1]
+              << "x" << this->grid_dimensions[2] << " grid from cache " << c->get_path()
+              << " in " << elapsed << " s" << std::endl;
+  }
+
+  return true;
 }
 
 /*
- * void read_atoms(bool debug)
+ * void write_cache(debug)
  *
- * Read the number of atoms of each element. These
- * numbers are used to skip the required amount of
- * lines.
+ * Store header and grid in a binary sidecar next to the input file
  *
- * Note that all read_* functions can
- * be used seperately, although they may depend
- * on each other and have to be used in some
- * consecutive order as is done in the read()
- * wrapper function.
+ */
+void ScalarField::write_cache(bool debug) {
+  GridCacheHeader h;
+  memset(&h, 0, sizeof(h));
+  h.scalar = this->scalar;
+  for(unsigned int i=0; i<3; i++) {
+    for(unsigned int j=0; j<3; j++) {
+      h.mat[i][j] = this->mat[i][j];
+    }
+    h.origin[i] = this->origin[i];
+    h.grid_dimensions[i] = this->grid_dimensions[i];
+  }
+  h.vasp5_input = this->vasp5_input ? 1 : 0;
+  h.closed_grid = this->closed_grid ? 1 : 0;
+
+  GridCache c(this->filename, this->cache_variant());
+  if(debug) std::cout << "Writing grid cache " << c.get_path() << "...";
+  bool ok = c.store(h, this->nrat, this->gridline, this->gridptr);
+  if(debug) std::cout << (ok ? "[Done]" : "[Failed]") << std::endl;
+}
+
+/*
+ * std::string cache_variant()
+ *
+ * Every spin mode gets its own sidecar, as the cached grid is the
+ * density after combining the blocks. B-spline coefficients get another
+ * one, which depends on the boundary condition of the prefilter.
  *
  */
-void ScalarField::read_atoms(bool debug) {
-  if(debug) std::cout << "Reading atoms...\t\t\t";
-  std::ifstream infile(this->filename.c_str());
-  std::string line;
-  for(unsigned int i=0; i < (this->vasp5_input ? 6 : 5); i++) { // discard first two lines
-    std::getline(infile, line);
+std::string ScalarField::cache_variant() const {
+  std::string variant;
+  switch(this->spin_mode) {
+    case SPIN_UP:
+      variant = "up";
+      break;
+    case SPIN_DOWN:
+      variant = "down";
+      break;
+    case SPIN_MAGNETIZATION:
+      variant = "magnetization";
+      break;
+    default:
+      break;
   }
+  if(this->prefiltered) {
+    variant += std::string(variant.empty() ? "" : ".") + (this->periodic ? "bspline-periodic" : "bspline");
+  }
+  return variant;
+}
 
-  int val = 0;
-  std::getline(infile, line);
-  pcrecpp::RE re("([0-9]+)");
-  pcrecpp::StringPiece input(line);
-  while(re.FindAndConsume(&input, &val)) {
-    this->nrat.push_back(val);
+/*
+ * void set_threads(nthreads)
+ *
+ * Set the number of threads used for parsing the grid. A value of
+ * zero selects all available cores.
+ *
+ */
+void ScalarField::set_threads(unsigned int _nthreads) {
+  if(_nthreads == 0) {
+    _nthreads = std::max(1u, std::thread::hardware_concurrency());
   }
-  if(debug) std::cout << "[Done]" << std::endl;
+  this->nthreads = _nthreads;
+}
+
+/*
+ * void set_thread_pool(pool)
+ *
+ * Evaluate expressions and run the B-spline prefilter of cubic
+ * interpolation on the threads of the given pool instead of the calling
+ * thread only
+ *
+ */
+void ScalarField::set_thread_pool(ThreadPool* _pool) {
+  this->pool = _pool;
+}
+
+/*
+ * void set_format(format)
+ *
+ * Select the reader for the input; FORMAT_AUTO (default) detects the
+ * format from the file and assumes a VASP file on standard input.
+ *
+ */
+void ScalarField::set_format(GridReader::Format _format) {
+  this->format = _format;
+}
+
+/*
+ * void set_region(corner, edge1, edge2)
+ *
+ * Only keep the part of the grid that the parallelogram corner + a*edge1
+ * + b*edge2 (0 <= a,b <= 1) passes through, i.e. the plane that is going
+ * to be plotted. The grid is reduced to whole slabs of constant z, see
+ * select_slabs(). Values outside these slabs cannot be accessed anymore.
+ *
+ */
+void ScalarField::set_region(const XYZ &corner, const XYZ &edge1, const XYZ &edge2) {
+  this->use_region = true;
+  this->region[0] = corner;
+  this->region[1] = edge1;
+  this->region[2] = edge2;
+}
+
+/*
+ * void set_periodic(periodic)
+ *
+ * Repeat the unit cell in all directions when sampling with sample_row()
+ * or get_value_interp() instead of taking zero outside of it. The grid then has a period of n
+ * points along each axis: the points of a VASP grid lie at i/n of the
+ * lattice vectors, the lattice of a cube file is n grid steps long.
+ *
+ */
+void ScalarField::set_periodic(bool _periodic) {
+  this->periodic = _periodic;
+}
+
+/*
+ * double get_grid_scale(dim)
+ *
+ * Grid steps per lattice vector along dimension dim. Without periodic
+ * images the grid spans the cell.
+ *
+ */
+double ScalarField::get_grid_scale(unsigned int dim) const {
+  const unsigned int n = this->grid_dimensions[dim];
+  return (this->periodic && !this->closed_grid) ? double(n) : double(n - 1);
 }
 
 /*
- * void read_grid_dimensions(bool debug)
+ * double wrap_coordinate(r, n)
  *
- * Read the number of gridpoints in each
- * direction.
+ * Map a grid coordinate onto [0,n)
  *
- * Note that all read_* functions can
- * be used seperately, although they may depend
- * on each other and have to be used in some
- * consecutive order as is done in the read()
- * wrapper function.
+ */
+double ScalarField::wrap_coordinate(double r, unsigned int n) {
+  r -= double(n) * floor(r / double(n));
+  return r < double(n) ? r : 0.0;
+}
+
+/*
+ * void select_slabs(debug)
+ *
+ * Determine the range of slabs that holds all grid points used for
+ * interpolating on the region. The grid position depends linearly on the
+ * position in the plane, so its extremes lie on the corners of the region.
+ * A spare slab on either side absorbs rounding. Cubic interpolation takes
+ * two more slabs, and as the B-spline prefilter reflects the grid at its
+ * ends, enough further slabs for that reflection to fade out.
  *
  */
-void ScalarField::read_grid_dimensions(bool debug) {
-  if(debug) std::cout << "Reading grid dimensions...\t\t";
-  std::ifstream infile(this->filename.c_str());
-  std::string line;
-  // skip lines that contain atoms
-  for(unsigned int i=0; i<(this->vasp5_input ? 10 : 9); i++) {
-    std::getline(infile, line);
+void ScalarField::select_slabs(bool debug) {
+  const unsigned int nz = this->grid_dimensions[2];
+  this->slabs[0] = 0;
+  this->slabs[1] = nz;
+  if(!this->use_region || nz == 0) {
+    return;
+  }
+
+  double lo = 0.0;
+  double hi = 0.0;
+  for(unsigned int c=0; c<4; c++) {
+    const double a = (c & 1) ? 1.0 : 0.0;
+    const double b = (c & 2) ? 1.0 : 0.0;
+    XYZ d = this->realspace_to_direct(this->region[0].x + a * this->region[1].x + b * this->region[2].x,
+                                      this->region[0].y + a * this->region[1].y + b * this->region[2].y,
+                                      this->region[0].z + a * this->region[1].z + b * this->region[2].z);
+    const double r = d.z * this->get_grid_scale(2);
+    lo = (c == 0) ? r : std::min(lo, r);
+    hi = (c == 0) ? r : std::max(hi, r);
+  }
+
+  const double spare = (this->interpolation == INTERPOLATION_CUBIC) ? 16.0 : 1.0;
+
+  // a periodic plane that leaves the cell along z needs all slabs
+  if(this->periodic && (floor(lo) - spare < 0.0 || ceil(hi) + spare > double(nz - 1))) {
+    if(debug) std::cout << "Region of interest: all " << nz << " slabs" << std::endl;
+    return;
+  }
+
+  // a plane that misses the cell only ever samples zeros; keep one slab
+  const double first = std::max(0.0, std::min(floor(lo) - spare, double(nz - 1)));
+  const double last = std::max(0.0, std::min(ceil(hi) + spare, double(nz - 1)));
+  this->slabs[0] = (unsigned int)first;
+  this->slabs[1] = std::max((unsigned int)last + 1, this->slabs[0] + 1);
+
+  if(debug) {
+    std::cout << "Region of interest: slabs " << this->slabs[0] << "-" << (this->slabs[1] - 1)
+              << " of " << nz << std::endl;
+  }
+}
+
+/*
+ * void crop_grid()
+ *
+ * Release all slabs outside the selected range from a grid that has been
+ * read completely
+ *
+ */
+void ScalarField::crop_grid() {
+  const size_t slab = size_t(this->grid_dimensions[0]) * this->grid_dimensions[1];
+  const unsigned int size = slab * (this->slabs[1] - this->slabs[0]);
+  if(size == this->gridsize) {
+    return;
+  }
+
+  float* grid = new float[size];
+  memcpy(grid, this->gridptr + slab * this->slabs[0], size * sizeof(float));
+  delete[] this->gridptr;
+  this->gridptr = grid;
+
+  if(this->gridptr2 != NULL) {
+    grid = new float[size];
+    memcpy(grid, this->gridptr2 + slab * this->slabs[0], size * sizeof(float));
+    delete[] this->gridptr2;
+    this->gridptr2 = grid;
   }
-  for(unsigned int i=0; i<this->nrat.size(); i++) {
-    for(unsigned int j=0; j<this->nrat[i]; j++) {
-        std::getline(infile, line);
+
+  this->gridsize = size;
+}
+
+/*
+ * void set_header(header)
+ *
+ * Take over the description of the grid from the header of the file
+ *
+ */
+void ScalarField::set_header(const GridHeader &header) {
+  this->scalar = header.scalar;
+  for(unsigned int i=0; i<3; i++) {
+    for(unsigned int j=0; j<3; j++) {
+      this->mat[i][j] = header.mat[i][j];
     }
+    this->origin[i] = header.origin[i];
+    this->grid_dimensions[i] = header.grid_dimensions[i];
   }
+  this->nrat = header.nrat;
+  this->vasp5_input = header.vasp5_input;
+  this->closed_grid = header.closed_grid;
+  this->gridline = header.gridline;
+  this->gridsize = this->grid_dimensions[0] * this->grid_dimensions[1]
+                         * this->grid_dimensions[2];
+  this->slabs[0] = 0;
+  this->slabs[1] = this->grid_dimensions[2];
 
-  this->gridline = line;
+  // also construct inverse matrix
+  this->calculate_inverse();
+}
+
+/*
+ * void transpose_grid()
+ *
+ * Reorder a grid that was read with z running fastest (cube files) so
+ * that x runs fastest. The grid is transposed in tiles, one plane of
+ * constant y per step, on all threads.
+ *
+ */
+void ScalarField::transpose_grid() {
+  const unsigned int nx = this->grid_dimensions[0];
+  const unsigned int ny = this->grid_dimensions[1];
+  const unsigned int nz = this->grid_dimensions[2];
+  const unsigned int tile = 16;
+  const float* in = this->gridptr;
+  float* out = new float[this->gridsize];
+
+  auto work = [=](unsigned int jbegin, unsigned int jend) {
+    for(unsigned int j=jbegin; j<jend; j++) {
+      for(unsigned int i0=0; i0<nx; i0+=tile) {
+        for(unsigned int k0=0; k0<nz; k0+=tile) {
+          for(unsigned int i=i0; i<std::min(i0 + tile, nx); i++) {
+            for(unsigned int k=k0; k<std::min(k0 + tile, nz); k++) {
+              out[(size_t(k) * ny + j) * nx + i] = in[(size_t(i) * ny + j) * nz + k];
+            }
+          }
+        }
+      }
+    }
+  };
 
-  pcrecpp::RE re("([0-9]+)");
-  pcrecpp::StringPiece input(line);
-  unsigned int i = 0;
-  unsigned int val = 0;
-  while(re.FindAndConsume(&input, &val)) {
-    this->grid_dimensions[i] = val;
-    i++;
+  unsigned int nthreads = std::max(1u, std::min(this->nthreads, ny));
+  std::vector<std::thread> threads;
+  for(unsigned int t=0; t<nthreads; t++) {
+    threads.push_back(std::thread(work, ny * t / nthreads, ny * (t + 1) / nthreads));
   }
-  if(debug) std::cout << "[Done]" << std::endl;
-  if(debug) std::cout << "GRID: " << this->grid_dimensions[0] << "x" <<
-                                     this->grid_dimensions[1] << "x" <<
-                                     this->grid_dimensions[2] << std::endl;
+  for(unsigned int t=0; t<nthreads; t++) {
+    threads[t].join();
+  }
+
+  delete[] this->gridptr;
+  this->gridptr = out;
 }
 
 /*
- * void read_grid(bool debug)
+ * bool read_grid(pipe, debug)
  *
  * Read all the grid points. This function depends
  * on the the gridsize being set via the
- * read_grid_dimensions() function.
+ * read_grid_dimensions() function. Returns whether
+ * all grid points could be read.
+ *
+ * For spin polarized files, the second block is
+ * only read when the spin mode asks for it; the
+ * first block is skipped when only the
+ * magnetization is needed.
  *
- * Note that all read_* functions can
- * be used seperately, although they may depend
- * on each other and have to be used in some
- * consecutive order as is done in the read()
- * wrapper function.
+ * Note that all read_* functions consume the
+ * stream and have to be used in consecutive
+ * order as is done in the read() wrapper function.
  *
  */
-void ScalarField::read_grid(bool debug) {
+bool ScalarField::read_grid(StreamPipeline &pipe, bool debug) {
   std::cout.setf(std::ios_base::unitbuf); // flush after every "<<"
-  if(debug) std::cout << "Reading grid values...";
-  std::ifstream infile(this->filename.c_str());
-  std::string line;
-  // skip lines that contain atoms
-  for(unsigned int i=0; i<(this->vasp5_input ? 10 : 9); i++) {
-    std::getline(infile, line);
-  }
-  for(unsigned int i=0; i<this->nrat.size(); i++) {
-    for(unsigned int j=0; j<this->nrat[i]; j++) {
-        std::getline(infile, line);
-    }
+
+  /* read the total density */
+  float* dest = (this->spin_mode == SPIN_MAGNETIZATION) ? NULL : this->gridptr;
+  if(!this->read_grid_block(pipe, dest, debug)) {
+    return false;
   }
 
-  this->gridsize = this->grid_dimensions[0] * this->grid_dimensions[1]
-                         * this->grid_dimensions[2];
-  this->gridptr = new float[this->gridsize];  // spin up
-  this->gridptr2 = new float[this->gridsize]; // spin down (not being used now)
-
-  /* read spin up */
-  unsigned int i=0;
-  unsigned int cur=0;         // for the counter
-  unsigned int linecounter=0; // for the counter
-  unsigned int wordcounter=0; // for the counter
-  pcrecpp::RE re("([0-9Ee.+-]+)");
-  pcrecpp::RE aug("augmentation.*");
-  while(std::getline(infile, line)) {
-    // stop looping when a second gridline appears (this
-    // is where the spin down part starts)
-    if(line.compare(this->gridline) == 0) {
-      std::cout << "I am breaking the loop" << std::endl;
-      break;
-    }
+  if(this->spin_mode == SPIN_TOTAL) {
+    return true;
+  }
 
-    if(aug.FullMatch(line)) {
-      break;
-    }
+  /* skip the augmentation occupancies up to the second grid line */
+  if(!pipe.find_line(this->gridline)) {
+    return false;
+  }
 
-    pcrecpp::StringPiece input(line);
+  /* read the magnetization density */
+  dest = (this->spin_mode == SPIN_MAGNETIZATION) ? this->gridptr : this->gridptr2;
+  return this->read_grid_block(pipe, dest, debug);
+}
 
-    wordcounter = 0;
-    if(i > this->gridsize) {
-        break;
-    }
-    while(re.FindAndConsume(&input, &this->gridptr[i])) {
-      i++;
-      wordcounter++;
+/*
+ * bool read_grid_block(pipe, dest, debug)
+ *
+ * Read gridsize values into dest, or merely skip
+ * over them when dest is NULL. One thread reads
+ * the stream while the others tokenize it, see
+ * StreamPipeline. Returns whether all grid points
+ * could be read.
+ *
+ */
+bool ScalarField::read_grid_block(StreamPipeline &pipe, float* dest, bool debug) {
+  if(debug) std::cout << (dest != NULL ? "Reading grid values..." : "Skipping grid values...");
+
+  size_t i = pipe.parse_block(dest, this->gridsize, this->layout.stopline,
+                              this->layout.stop_prefix, debug);
+
+  if(debug) std::cout << "[100%]" << std::endl;
+  if(debug) std::cout << "Grabbed " << i << "/" << this->gridsize << " values" << std::endl;
+
+  return i == this->gridsize;
+}
+
+/*
+ * bool read_grid_mapped(offset, debug)
+ *
+ * Read all the grid points by memory mapping the file and parsing the
+ * data block, which starts at byte offset, on all threads. On success,
+ * offset is moved to the end of the data block.
+ *
+ * Returns false when the file cannot be mapped or the data block does
+ * not have a fixed number of values per line; the grid then has to be
+ * read via read_grid().
+ *
+ */
+bool ScalarField::read_grid_mapped(std::streamoff &offset, bool debug) {
+  MappedFile mf(this->filename);
+  if(!mf.is_open() || offset < 0 || size_t(offset) > mf.size()) {
+    return false;
+  }
+
+  const char* begin = mf.data() + offset;
+  const char* end = mf.data() + mf.size();
+  const char* stop = NULL;
+
+  // a grid that holds fewer values than the block only takes its slabs
+  const size_t slab = size_t(this->grid_dimensions[0]) * this->grid_dimensions[1];
+  const size_t block = slab * this->grid_dimensions[2];
+  const bool slice = (this->gridsize != block);
+  auto parse = [&](const char* p, float* dest) {
+    if(slice) {
+      return GridParser::parse_slice(p, end, dest, slab * this->slabs[0], this->gridsize,
+                                     block, this->nthreads);
     }
+    return GridParser::parse_block(p, end, dest, block, this->nthreads, this->layout.record);
+  };
 
-    /*
-     * Track the progress of the read procedure. (this is the task that takes the
-     * most amount of time)
-     */
-    if(debug) {
-      if(i > (this->gridsize / 5 * cur)) {
-        std::cout << "[" << int(cur * 20) << " %]";
-        cur++;
-      }
+  /* read the total density */
+  if(this->spin_mode == SPIN_MAGNETIZATION) {
+    if(debug) std::cout << "Skipping grid values...";
+    stop = slice ? GridParser::parse_slice(begin, end, NULL, 0, 0, block, 1) :
+                   GridParser::skip_block(begin, end, block, this->layout.record);
+  } else {
+    if(debug) std::cout << "Reading grid values (" << this->nthreads << " threads)...";
+    stop = parse(begin, this->gridptr);
+  }
+  if(stop == NULL) {
+    if(debug) std::cout << "[Failed]" << std::endl;
+    return false;
+  }
+  if(debug) std::cout << "[Done]" << std::endl;
+
+  /* skip the augmentation occupancies and read the magnetization density */
+  if(this->spin_mode != SPIN_TOTAL) {
+    if(debug) std::cout << "Reading magnetization values (" << this->nthreads << " threads)...";
+    const char* second = GridParser::find_line(stop, end, this->gridline);
+    float* dest = (this->spin_mode == SPIN_MAGNETIZATION) ? this->gridptr : this->gridptr2;
+    stop = second != NULL ? parse(second, dest) : NULL;
+    if(stop == NULL) {
+      if(debug) std::cout << "[Failed]" << std::endl;
+      return false;
     }
-    linecounter++;
+    if(debug) std::cout << "[Done]" << std::endl;
   }
-  if(debug) std::cout << "[100%]" << std::endl;
-  if(debug) std::cout << "End reading " << linecounter << " lines" << std::endl;
-  if(debug) std::cout << "Grabbed " << i << "/" << this->gridsize << " values" << std::endl;
 
-  // /* read spin down */
-  // i=0;
-  // while(std::getline(infile, line)) {
-  //   pcrecpp::StringPiece input(line);
-  //   while(re.FindAndConsume(&input, &this->gridptr2[i])) {
-  //     i++;
-  //   }
-  // }
-  // if(debug) std::cout << "[Done]" << std::endl;
+  if(debug) std::cout << "Grabbed " << this->gridsize << "/" << block << " values" << std::endl;
+  offset = stop - mf.data();
+  return true;
 }
 
 /*
  * float get_value_interp(x,y,z)
  *
- * Grabs a value from the 3D scalar field. Calculate the value
- * by using a trilinear interpolation.
+ * Grabs a value from the 3D scalar field at a point in realspace,
+ * interpolated as sample_row() does for a row of points: trilinearly, or
+ * by the cubic B-spline (see set_interpolation()), and zero outside the
+ * unit cell unless the cell is repeated (see set_periodic()).
  *
- * The trilinear interpolation algorithm has been extracted from:
- * http://paulbourke.net/miscellaneous/interpolation/
+ */
+float ScalarField::get_value_interp(const float &x, const float &y, const float &z) {
+  const XYZ point = {x, y, z};
+  const XYZ none = {0.0, 0.0, 0.0};
+  float value;
+  this->sample_span(point, none, 0, 1, &value);
+  return value;
+}
+
+/*
+ * void sample_row(start, step, n, out)
  *
- * Future algorithm can make use of a cubic interpolation.
+ * Interpolate the scalar field at the n points start + i*step (i = 0..n-1)
+ * in realspace into out, see sample_span()
  *
  */
-float ScalarField::get_value_interp(const float &x, const float &y, const float &z) {
-  // cast the input to the nearest grid point
-  XYZ r = this->realspace_to_grid(x,y,z);
-  XYZ d = this->realspace_to_direct(x,y,z);
+void ScalarField::sample_row(const XYZ &start, const XYZ &step, unsigned int n, float* out) const {
+  this->sample_span(start, step, 0, n, out);
+}
+
+/*
+ * void get_span(start, step, n, begin, end)
+ *
+ * Determine the points [begin,end) of the row start + i*step (i = 0..n-1)
+ * in realspace that lie inside the unit cell, i.e. the part of the row
+ * that sample_row() interpolates; all of them for periodic images
+ *
+ */
+void ScalarField::get_span(const XYZ &start, const XYZ &step, unsigned int n,
+                           unsigned int* begin, unsigned int* end) const {
+  if(this->periodic) {
+    *begin = 0;
+    *end = n;
+    return;
+  }
+
+  const XYZ d0 = this->realspace_to_direct(start.x, start.y, start.z);
+  XYZ dd;
+  dd.x = imat[0][0] * step.x + imat[0][1] * step.y + imat[0][2] * step.z;
+  dd.y = imat[1][0] * step.x + imat[1][1] * step.y + imat[1][2] * step.z;
+  dd.z = imat[2][0] * step.x + imat[2][1] * step.y + imat[2][2] * step.z;
+  this->get_row_span(d0, dd, n, begin, end);
+}
+
+/*
+ * void sample_span(start, step, first, last, out)
+ *
+ * Interpolate the scalar field trilinearly at the points start + i*step
+ * (i = first..last-1) in realspace and store the values in out[i - first];
+ * points outside the unit cell get zero, unless the cell is repeated
+ * periodically (see set_periodic()).
+ *
+ * The grid position is affine in i, so both transformations are done
+ * once for the row. The part of the row inside the unit cell is found up
+ * front and only that part is interpolated, in chunks of points by the
+ * vector kernels of Trilinear for grids at full precision (in plain or
+ * bricked order, see set_bricks()). A prefiltered grid is interpolated by
+ * cubic B-splines instead, see sample_row_cubic().
+ * The fraction is taken as the distance to the lower grid point, so that
+ * positions just below a grid point do not snap to the point beneath it.
+ *
+ * Usage: sf.sample_span(start, step, left, right, &row[0]);
+ *
+ */
+void ScalarField::sample_span(const XYZ &start, const XYZ &step, unsigned int first, unsigned int last,
+                              float* out) const {
+  const unsigned int nx = this->grid_dimensions[0];
+  const unsigned int ny = this->grid_dimensions[1];
+  const unsigned int nz = this->grid_dimensions[2];
+
+  // direct and grid position of the first point and their increments
+  const XYZ d0 = this->realspace_to_direct(start.x, start.y, start.z);
+  XYZ dd;
+  dd.x = imat[0][0] * step.x + imat[0][1] * step.y + imat[0][2] * step.z;
+  dd.y = imat[1][0] * step.x + imat[1][1] * step.y + imat[1][2] * step.z;
+  dd.z = imat[2][0] * step.x + imat[2][1] * step.y + imat[2][2] * step.z;
+
+  // with periodic images every point is inside the (repeated) cell
+  const bool wrap = this->periodic;
+  unsigned int begin = first;
+  unsigned int end = last;
+  if(!wrap) {
+    this->get_row_span(d0, dd, last, &begin, &end);
+    begin = std::min(std::max(begin, first), last);
+    end = std::max(end, begin);
+    std::fill(out, out + (begin - first), 0.0f);
+    std::fill(out + (end - first), out + (last - first), 0.0f);
+  }
+
+  if(this->prefiltered) {
+    this->sample_row_cubic(d0, dd, begin, end, out + (begin - first));
+    return;
+  }
+
+  const double sx = this->get_grid_scale(0);
+  const double sy = this->get_grid_scale(1);
+  const double sz = this->get_grid_scale(2);
+  const unsigned int slab = nx * ny;
+  const unsigned int nslabs = this->slabs[1] - this->slabs[0];
+  const float* grid = this->gridptr;
+  const BrickLayout* bricks = this->bricks;
+
+  // offsets from the last point along an axis to the next point: back to
+  // the first point for periodic images, otherwise none
+  const int32_t wx = wrap ? 1 - int32_t(nx) : 0;
+  const int32_t wy = wrap ? -int32_t(nx * (ny - 1)) : 0;
+  const int32_t wz = (wrap && nslabs == nz) ? -int32_t(slab * (nz - 1)) : 0;
+
+  // largest grid coordinates; periodic images continue up to the next cell
+  const double hx = double(nx - 1) + (wx != 0 ? 1.0 : 0.0);
+  const double hy = double(ny - 1) + (wy != 0 ? 1.0 : 0.0);
+  const double hz = double(this->slabs[1] - 1) + (wz != 0 ? 1.0 : 0.0);
+
+  // the vector kernels gather with signed 32 bit indices
+  const bool gather = (grid != NULL &&
+                       (bricks != NULL ? bricks->get_size() : size_t(this->gridsize)) <= 0x7FFFFFFFu);
+
+  // the cells of a chunk of points are located first, then interpolated
+  const unsigned int chunk = 256;
+  uint32_t base[chunk];
+  int32_t ox[chunk], oy[chunk], oz[chunk];
+  float fx[chunk], fy[chunk], fz[chunk];
+  float corners[8 * chunk];
+  const Trilinear::Points points = {base, ox, oy, oz, fx, fy, fz};
 
-  // to test whether the point is inside the box, we cast the point back
-  // to the direct grid and check if it is for each cartesian coordinate
-  // within the domain [0,1]
-  if(d.x < 0 || d.x > 1.0) {
-    return 0.0;
+  for(unsigned int i0=begin; i0<end; i0+=chunk) {
+    const unsigned int m = std::min(chunk, end - i0);
+    for(unsigned int t=0; t<m; t++) {
+      const unsigned int i = i0 + t;
+
+      double rx = (d0.x + i * dd.x) * sx;
+      double ry = (d0.y + i * dd.y) * sy;
+      double rz = (d0.z + i * dd.z) * sz;
+      if(wrap) {
+        rx = wrap_coordinate(rx, nx);
+        ry = wrap_coordinate(ry, ny);
+        rz = wrap_coordinate(rz, nz);
+      }
+
+      // clamp against rounding at the faces of the cell
+      rx = std::min(std::max(rx, 0.0), hx);
+      ry = std::min(std::max(ry, 0.0), hy);
+      rz = std::min(std::max(rz, double(this->slabs[0])), hz);
+
+      const unsigned int x0 = std::min((unsigned int)rx, nx - 1);
+      const unsigned int y0 = std::min((unsigned int)ry, ny - 1);
+      const unsigned int z0 = std::min((unsigned int)rz, this->slabs[1] - 1);
+      base[t] = (z0 - this->slabs[0]) * slab + y0 * nx + x0;
+      ox[t] = (x0 + 1 < nx) ? 1 : wx;
+      oy[t] = (y0 + 1 < ny) ? int32_t(nx) : wy;
+      oz[t] = (z0 + 1 < this->slabs[1]) ? int32_t(slab) : wz;
+      if(bricks != NULL) {
+        // the same corners in bricked order
+        const unsigned int k0 = z0 - this->slabs[0];
+        const unsigned int x1 = (ox[t] != 0) ? (x0 + 1) % nx : x0;
+        const unsigned int y1 = (oy[t] != 0) ? (y0 + 1) % ny : y0;
+        const unsigned int k1 = (oz[t] != 0) ? (k0 + 1) % nslabs : k0;
+        base[t] = bricks->get_index(x0, y0, k0);
+        ox[t] = int32_t(bricks->get_offset(0, x1) - bricks->get_offset(0, x0));
+        oy[t] = int32_t(bricks->get_offset(1, y1) - bricks->get_offset(1, y0));
+        oz[t] = int32_t(bricks->get_offset(2, k1) - bricks->get_offset(2, k0));
+      }
+      fx[t] = float(rx - x0);
+      fy[t] = float(ry - y0);
+      fz[t] = float(rz - z0);
+    }
+
+    if(gather) {
+      Trilinear::interpolate(grid, points, m, out + (i0 - first));
+      continue;
+    }
+
+    // compact grids: the corners of the chunk first, then all blended
+    for(unsigned int t=0; t<m; t++) {
+      float* c = corners + 8 * t;
+      if(grid != NULL) {
+        const float* g = grid + base[t];
+        c[0] = g[0];
+        c[1] = g[ox[t]];
+        c[2] = g[oy[t]];
+        c[3] = g[ox[t] + oy[t]];
+        c[4] = g[oz[t]];
+        c[5] = g[ox[t] + oz[t]];
+        c[6] = g[oy[t] + oz[t]];
+        c[7] = g[ox[t] + oy[t] + oz[t]];
+      } else {
+        const unsigned int x0 = base[t] % nx;
+        const unsigned int y0 = base[t] / nx % ny;
+        const unsigned int k0 = base[t] / slab;
+        const unsigned int x1 = (ox[t] != 0) ? (x0 + 1) % nx : x0;
+        const unsigned int y1 = (oy[t] != 0) ? (y0 + 1) % ny : y0;
+        const unsigned int k1 = (oz[t] != 0) ? (k0 + 1) % nslabs : k0;
+        c[0] = this->storage->get(x0, y0, k0);
+        c[1] = this->storage->get(x1, y0, k0);
+        c[2] = this->storage->get(x0, y1, k0);
+        c[3] = this->storage->get(x1, y1, k0);
+        c[4] = this->storage->get(x0, y0, k1);
+        c[5] = this->storage->get(x1, y0, k1);
+        c[6] = this->storage->get(x0, y1, k1);
+        c[7] = this->storage->get(x1, y1, k1);
+      }
+    }
+    Trilinear::blend_points(corners, fx, fy, fz, m, out + (i0 - first));
   }
-  if(d.y < 0 || d.y > 1.0) {
-    return 0.0;
+}
+
+/*
+ * void sample_row_cubic(d0, dd, begin, end, out)
+ *
+ * Interpolate the B-spline coefficients at the points [begin,end) of the
+ * row d0 + i*dd in direct coordinates into out[i - begin], by the kernels of Tricubic for
+ * grids at full precision. Taps beyond the faces of the grid are
+ * reflected back into it, or wrapped around for periodic images; taps
+ * beyond the slabs in memory are held at the outermost slab.
+ *
+ */
+void ScalarField::sample_row_cubic(const XYZ &d0, const XYZ &dd, unsigned int begin, unsigned int end,
+                                   float* out) const {
+  const unsigned int dims[3] = {this->grid_dimensions[0], this->grid_dimensions[1], this->grid_dimensions[2]};
+  const double p0[3] = {d0.x, d0.y, d0.z};
+  const double dp[3] = {dd.x, dd.y, dd.z};
+  const double scale[3] = {this->get_grid_scale(0), this->get_grid_scale(1), this->get_grid_scale(2)};
+  const size_t stride[3] = {1, size_t(dims[0]), size_t(dims[0]) * dims[1]};
+  const float* grid = this->gridptr;
+  const BrickLayout* bricks = this->bricks;
+
+  // range of grid points in memory and whether an axis wraps around
+  const unsigned int first[3] = {0, 0, this->slabs[0]};
+  const unsigned int last[3] = {dims[0] - 1, dims[1] - 1, this->slabs[1] - 1};
+  bool wrap[3];
+  for(unsigned int d=0; d<3; d++) {
+    wrap[d] = this->periodic && first[d] == 0 && last[d] == dims[d] - 1;
   }
-  if(d.z < 0 || d.z > 1.0) {
-    return 0.0;
+
+  const bool gather = (grid != NULL &&
+                       (bricks != NULL ? bricks->get_size() : size_t(this->gridsize)) <= 0x7FFFFFFFu);
+
+  const unsigned int chunk = 128;
+  uint32_t base[chunk];
+  int32_t off[3][4][chunk];
+  float frac[3][chunk];
+  float coef[64 * chunk];
+  const Tricubic::Points points = {base,
+                                   {off[0][0], off[0][1], off[0][2], off[0][3]},
+                                   {off[1][0], off[1][1], off[1][2], off[1][3]},
+                                   {off[2][0], off[2][1], off[2][2], off[2][3]},
+                                   frac[0], frac[1], frac[2]};
+
+  for(unsigned int i0=begin; i0<end; i0+=chunk) {
+    const unsigned int m = std::min(chunk, end - i0);
+    for(unsigned int t=0; t<m; t++) {
+      const unsigned int i = i0 + t;
+
+      // lower corner, fraction and taps (relative to the slabs in memory)
+      unsigned int corner[3];
+      unsigned int taps[3][4];
+      for(unsigned int d=0; d<3; d++) {
+        const int n = int(dims[d]);
+        double r = (p0[d] + i * dp[d]) * scale[d];
+        if(this->periodic) {
+          r = wrap_coordinate(r, dims[d]);
+        }
+        r = std::min(std::max(r, double(first[d])), double(last[d]) + (wrap[d] ? 1.0 : 0.0));
+        const unsigned int c = std::min((unsigned int)r, last[d]);
+        frac[d][t] = float(r - c);
+        corner[d] = c - first[d];
+        for(unsigned int a=0; a<4; a++) {
+          int q = int(c) - 1 + int(a);
+          if(wrap[d]) {
+            q = (q + n) % n;
+          } else {
+            q = (q < 0) ? -q : q;
+            q = (q > n - 1) ? 2 * (n - 1) - q : q;
+            q = std::min(std::max(q, int(first[d])), int(last[d]));
+          }
+          taps[d][a] = unsigned(q) - first[d];
+        }
+      }
+
+      if(gather) {
+        uint32_t at[3];
+        for(unsigned int d=0; d<3; d++) {
+          at[d] = bricks != NULL ? bricks->get_offset(d, corner[d]) : uint32_t(corner[d] * stride[d]);
+          for(unsigned int a=0; a<4; a++) {
+            const uint32_t tap = bricks != NULL ? bricks->get_offset(d, taps[d][a]) :
+                                 uint32_t(taps[d][a] * stride[d]);
+            off[d][a][t] = int32_t(tap - at[d]);
+          }
+        }
+        base[t] = at[0] + at[1] + at[2];
+        continue;
+      }
+
+      // otherwise the coefficients of the chunk are blended at once
+      float* c = coef + 64 * t;
+      for(unsigned int k=0; k<4; k++) {
+        for(unsigned int j=0; j<4; j++) {
+          for(unsigned int a=0; a<4; a++) {
+            if(grid == NULL) {
+              c[16 * k + 4 * j + a] = this->storage->get(taps[0][a], taps[1][j], taps[2][k]);
+            } else if(bricks != NULL) {
+              c[16 * k + 4 * j + a] = grid[bricks->get_index(taps[0][a], taps[1][j], taps[2][k])];
+            } else {
+              c[16 * k + 4 * j + a] = grid[taps[2][k] * stride[2] + taps[1][j] * stride[1] + taps[0][a]];
+            }
+          }
+        }
+      }
+    }
+
+    if(gather) {
+      Tricubic::interpolate(grid, points, m, out + (i0 - begin));
+    } else {
+      Tricubic::blend_points(coef, frac[0], frac[1], frac[2], m, out + (i0 - begin));
+    }
   }
+}
 
-  // calculate value using trilinear interpolation
-  float xd = remainderf(r.x, 1.0);
-  float yd = remainderf(r.y, 1.0);
-  float zd = remainderf(r.z, 1.0);
+/*
+ * void get_row_span(d0, dd, n, begin, end)
+ *
+ * Determine the points [begin,end) of the row d0 + i*dd (i = 0..n-1) in
+ * direct coordinates that lie inside the unit cell. The bounds follow
+ * from the crossings with the faces and are then corrected for rounding
+ * with the test of a single point.
+ *
+ */
+void ScalarField::get_row_span(const XYZ &d0, const XYZ &dd, unsigned int n,
+                               unsigned int* begin, unsigned int* end) const {
+  const double p[3] = {d0.x, d0.y, d0.z};
+  const double q[3] = {dd.x, dd.y, dd.z};
 
-  if(xd < 0) xd += 1.0;
-  if(yd < 0) yd += 1.0;
-  if(zd < 0) zd += 1.0;
+  auto inside = [&](unsigned int i) {
+    for(unsigned int a=0; a<3; a++) {
+      const double d = p[a] + i * q[a];
+      if(d < 0 || d > 1.0) {
+        return false;
+      }
+    }
+    return true;
+  };
 
-  float x0 = floor(r.x);
-  float x1 = ceil(r.x);
-  float y0 = floor(r.y);
-  float y1 = ceil(r.y);
-  float z0 = floor(r.z);
-  float z1 = ceil(r.z);
+  double lo = 0.0;
+  double hi = double(n) - 1.0;
+  for(unsigned int a=0; a<3; a++) {
+    if(q[a] == 0.0) {
+      if(p[a] < 0 || p[a] > 1.0) {
+        hi = -1.0;
+      }
+      continue;
+    }
+    double t0 = -p[a] / q[a];
+    double t1 = (1.0 - p[a]) / q[a];
+    if(t0 > t1) {
+      std::swap(t0, t1);
+    }
+    lo = std::max(lo, t0);
+    hi = std::min(hi, t1);
+  }
+
+  if(n == 0 || lo > hi) {
+    *begin = *end = 0;
+    return;
+  }
+
+  unsigned int b = (unsigned int)std::min(ceil(lo), double(n));
+  unsigned int e = (unsigned int)std::min(floor(hi) + 1.0, double(n));
+  while(b > 0 && inside(b - 1)) b--;
+  while(b < e && !inside(b)) b++;
+  while(e < n && inside(e)) e++;
+  while(e > b && !inside(e - 1)) e--;
 
-  return
-  this->get_value(x0, y0, z0) * (1.0 - xd) * (1.0 - yd) * (1.0 - zd) +
-  this->get_value(x1, y0, z0) * xd         * (1.0 - yd) * (1.0 - zd) +
-  this->get_value(x0, y1, z0) * (1.0 - xd) * yd         * (1.0 - zd) +
-  this->get_value(x0, y0, z1) * (1.0 - xd) * (1.0 - yd) * zd         +
-  this->get_value(x1, y0, z1) * xd         * (1.0 - yd) * zd         +
-  this->get_value(x0, y1, z1) * (1.0 - xd) * yd         * zd         +
-  this->get_value(x1, y1, z0) * xd         * yd         * (1.0 - zd) +
-  this->get_value(x1, y1, z1) * xd         * yd         * zd;
+  *begin = b;
+  *end = e;
 }
 
 /*
@@ -455,12 +1584,11 @@ void ScalarField::calculate_inverse() {
 /*
  * float get_value(i,j,k)
  *
- * Grabs the value at a particular grid point.
- *
- * This is a convenience function for the get_value_interp() function
+ * Grabs the value at a particular grid point, decoding it when
+ * the grid is kept at reduced precision.
  *
  */
-const float& ScalarField::get_value(const unsigned int i,
+float ScalarField::get_value(const unsigned int i,
                        const unsigned int j,
                        const unsigned int k) const {
   if(i >= this->grid_dimensions[0]) {
@@ -469,15 +1597,21 @@ const float& ScalarField::get_value(const unsigned int i,
   if(j >= this->grid_dimensions[1]) {
     std::cout << "ERROR: Cannot access y=" << j << std::endl;
   }
-  if(k >= this->grid_dimensions[2]) {
+  if(k < this->slabs[0] || k >= this->slabs[1]) {
     std::cout << "ERROR: Cannot access z=" << k << std::endl;
   }
-  unsigned int idx = k * this->grid_dimensions[0] * this->grid_dimensions[1] +
+  unsigned int idx = (k - this->slabs[0]) * this->grid_dimensions[0] * this->grid_dimensions[1] +
                      j * this->grid_dimensions[0] +
                      i;
   if(idx > this->gridsize) {
     std::cout << "Trying to allocate value outside gridspace: (" << i << "," << j << "," << k << ")" << std::endl;
   }
+  if(this->storage != NULL) {
+    return this->storage->get(i, j, k - this->slabs[0]);
+  }
+  if(this->bricks != NULL) {
+    return this->gridptr[this->bricks->get_index(i, j, k - this->slabs[0])];
+  }
   return this->gridptr[idx];
 }
 
@@ -507,18 +1641,21 @@ XYZ ScalarField::grid_to_realspace(const double &i,
  * XYZ realspace_to_grid(i,j,k)
  *
  * Convert 3d realspace vector to a position on the grid. Non-integer
- * values (i.e. floating point) are given as the result.
- *
- * This is a convenience function for the get_value_interp() function
+ * values (i.e. floating point) are given as the result. Positions are
+ * taken relative to the origin of the grid (zero for VASP files).
  *
  */
 XYZ ScalarField::realspace_to_grid(const double &i,
                      const double &j,
                      const double &k) const {
+  const double x = i - this->origin[0];
+  const double y = j - this->origin[1];
+  const double z = k - this->origin[2];
+
   XYZ r;
-  r.x = imat[0][0] * i + imat[0][1] * j + imat[0][2] * k;
-  r.y = imat[1][0] * i + imat[1][1] * j + imat[1][2] * k;
-  r.z = imat[2][0] * i + imat[2][1] * j + imat[2][2] * k;
+  r.x = imat[0][0] * x + imat[0][1] * y + imat[0][2] * z;
+  r.y = imat[1][0] * x + imat[1][1] * y + imat[1][2] * z;
+  r.z = imat[2][0] * x + imat[2][1] * y + imat[2][2] * z;
 
   r.x *= float(this->grid_dimensions[0]-1);
   r.y *= float(this->grid_dimensions[1]-1);
@@ -530,16 +1667,21 @@ XYZ ScalarField::realspace_to_grid(const double &i,
 /*
  * XYZ realspace_to_direct(i,j,k)
  *
- * Convert 3d realspace vector to direct position.
+ * Convert 3d realspace vector to direct position, relative to the
+ * origin of the grid.
  *
  */
 XYZ ScalarField::realspace_to_direct(const double &i,
                      const double &j,
                      const double &k) const {
+  const double x = i - this->origin[0];
+  const double y = j - this->origin[1];
+  const double z = k - this->origin[2];
+
   XYZ r;
-  r.x = imat[0][0] * i + imat[0][1] * j + imat[0][2] * k;
-  r.y = imat[1][0] * i + imat[1][1] * j + imat[1][2] * k;
-  r.z = imat[2][0] * i + imat[2][1] * j + imat[2][2] * k;
+  r.x = imat[0][0] * x + imat[0][1] * y + imat[0][2] * z;
+  r.y = imat[1][0] * x + imat[1][1] * y + imat[1][2] * z;
+  r.z = imat[2][0] * x + imat[2][1] * y + imat[2][2] * z;
 
   return r;
 }
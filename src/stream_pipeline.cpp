@@ -0,0 +1,349 @@
+/**************************************************************************
+ *   stream_pipeline.cpp                                                  *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#include "stream_pipeline.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+// bytes read from the input per slot
+static const size_t chunk_size = 1 << 20;
+
+StreamPipeline::StreamPipeline(std::istream &_in, unsigned int _nthreads) :
+    in(_in),
+    nthreads(std::max(1u, _nthreads)),
+    bytes_read(0),
+    reader_done(false),
+    stop(false) {
+}
+
+/*
+ * size_t parse_block(out, n, stopline, stop_prefix, debug)
+ *
+ * Read the next n values from the input into out, or merely skip over
+ * them when out is NULL. The block also ends at a line equal to stopline
+ * or starting with stop_prefix (unless these are empty; for CHGCAR files
+ * the grid dimension line and "augmentation"), and at the end of the
+ * input. The input
+ * is consumed up to and including the line holding the last value (or the
+ * line that ended the block). Returns the number of values read.
+ *
+ * Values are taken exactly as when reading the input line by line: the
+ * tokens of each line up to the first one that is not a number.
+ *
+ */
+size_t StreamPipeline::parse_block(float* out, size_t n, const std::string &stopline,
+                                   const std::string &stop_prefix, bool debug) {
+    if(n == 0) {
+        return 0;
+    }
+
+    const unsigned int nslots = 2 * this->nthreads + 2;
+    this->slots.assign(nslots, Slot());
+    this->free_slots.clear();
+    for(unsigned int s=0; s<nslots; s++) {
+        this->free_slots.push_back(s);
+    }
+    this->work.clear();
+    this->order.clear();
+    this->reader_done = false;
+    this->stop = false;
+    this->carry.swap(this->pending);
+    this->pending.clear();
+
+    std::thread reader(&StreamPipeline::run_reader, this);
+    std::vector<std::thread> workers;
+    for(unsigned int t=0; t<this->nthreads; t++) {
+        workers.push_back(std::thread(&StreamPipeline::run_worker, this, out != NULL,
+                                      std::cref(stopline), std::cref(stop_prefix)));
+    }
+
+    // move the parsed slots into place in the order of the input
+    size_t i = 0;
+    unsigned int cur = 0;  // for the progress counter
+    std::string rest;      // unused part of the slot that ended the block
+    while(true) {
+        std::unique_lock<std::mutex> lock(this->mtx);
+        while(!(this->order.empty() ? this->reader_done : this->slots[this->order.front()].parsed)) {
+            this->cv_parsed.wait(lock);
+        }
+        if(this->order.empty()) {
+            break; // end of the input
+        }
+        const unsigned int s = this->order.front();
+        this->order.pop_front();
+        lock.unlock();
+
+        Slot &slot = this->slots[s];
+        const size_t take = std::min(slot.count, n - i);
+        if(out != NULL) {
+            memcpy(out + i, &slot.values[0], take * sizeof(float));
+        }
+        i += take;
+
+        bool done = false;
+        if(i == n) {
+            size_t pos = this->line_end(slot, take, out != NULL);
+            rest.assign(&slot.text[0] + pos, slot.length - pos);
+            done = true;
+        } else if(slot.stop_at != std::string::npos) {
+            const char* p = &slot.text[0] + slot.stop_at;
+            const char* nl = static_cast<const char*>(memchr(p, '\n', slot.length - slot.stop_at));
+            size_t pos = (nl != NULL) ? (nl - &slot.text[0]) + 1 : slot.length;
+            rest.assign(&slot.text[0] + pos, slot.length - pos);
+            done = true;
+        }
+
+        if(debug) {
+            while(cur < 5 && i >= n / 5 * cur) {
+                std::cout << "[" << int(cur * 20) << " %]";
+                cur++;
+            }
+        }
+
+        lock.lock();
+        this->free_slots.push_back(s);
+        this->cv_free.notify_one();
+        if(done) {
+            break;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->stop = true;
+    }
+    this->cv_free.notify_all();
+    this->cv_work.notify_all();
+    reader.join();
+    for(unsigned int t=0; t<workers.size(); t++) {
+        workers[t].join();
+    }
+
+    // keep everything that was read beyond the block for the next call
+    this->pending.swap(rest);
+    for(unsigned int k=0; k<this->order.size(); k++) {
+        const Slot &slot = this->slots[this->order[k]];
+        this->pending.append(&slot.text[0], slot.length);
+    }
+    this->pending.append(this->carry);
+    this->carry.clear();
+    this->slots.clear();
+
+    return i;
+}
+
+/*
+ * bool find_line(line)
+ *
+ * Consume the input up to and including the next line equal to line.
+ * Returns false when the input ends before such a line.
+ *
+ */
+bool StreamPipeline::find_line(const std::string &line) {
+    size_t pos = 0;
+    while(true) {
+        size_t nl = this->pending.find('\n', pos);
+        if(nl == std::string::npos) {
+            // keep the partial line and read more input
+            this->pending.erase(0, pos);
+            pos = 0;
+            size_t old = this->pending.size();
+            this->pending.resize(old + chunk_size);
+            this->in.read(&this->pending[old], chunk_size);
+            this->pending.resize(old + this->in.gcount());
+            this->bytes_read += this->in.gcount();
+            if(this->pending.size() == old) {
+                bool found = old > 0 && this->pending == line;
+                this->pending.clear();
+                return found;
+            }
+            continue;
+        }
+
+        bool found = this->pending.compare(pos, nl - pos, line) == 0;
+        pos = nl + 1;
+        if(found) {
+            this->pending.erase(0, pos);
+            return true;
+        }
+    }
+}
+
+/*
+ * size_t get_bytes_read()
+ *
+ * Number of bytes taken from the input so far (including read ahead)
+ *
+ */
+size_t StreamPipeline::get_bytes_read() const {
+    return this->bytes_read;
+}
+
+/*
+ * void run_reader()
+ *
+ * Fill free slots with complete lines from the input until the input
+ * ends or the block is complete. The partial line at the end of a chunk
+ * is carried over to the next slot.
+ *
+ */
+void StreamPipeline::run_reader() {
+    bool eof = false;
+    while(!eof) {
+        std::unique_lock<std::mutex> lock(this->mtx);
+        while(this->free_slots.empty() && !this->stop) {
+            this->cv_free.wait(lock);
+        }
+        if(this->stop) {
+            break;
+        }
+        const unsigned int s = this->free_slots.front();
+        this->free_slots.pop_front();
+        lock.unlock();
+
+        Slot &slot = this->slots[s];
+        const size_t head = this->carry.size();
+        slot.text.resize(head + chunk_size);
+        if(head > 0) {
+            memcpy(&slot.text[0], this->carry.data(), head);
+        }
+        this->in.read(&slot.text[head], chunk_size);
+        size_t len = head + this->in.gcount();
+        this->bytes_read += this->in.gcount();
+        eof = !this->in;
+
+        // cut behind the last complete line
+        size_t cut = len;
+        if(!eof) {
+            while(cut > 0 && slot.text[cut - 1] != '\n') {
+                cut--;
+            }
+        }
+        this->carry.assign(&slot.text[0] + cut, len - cut);
+        slot.length = cut;
+        slot.count = 0;
+        slot.stop_at = std::string::npos;
+        slot.parsed = false;
+
+        lock.lock();
+        if(cut == 0) {
+            // no complete line in the slot yet (or nothing left at all)
+            this->free_slots.push_front(s);
+            continue;
+        }
+        this->order.push_back(s);
+        this->work.push_back(s);
+        this->cv_work.notify_one();
+    }
+
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->reader_done = true;
+    this->cv_work.notify_all();
+    this->cv_parsed.notify_all();
+}
+
+/*
+ * void run_worker(convert, stopline, stop_prefix)
+ *
+ * Tokenize filled slots line by line into the value buffer of the slot
+ * (or only count the tokens when convert is false)
+ *
+ */
+void StreamPipeline::run_worker(bool convert, const std::string &stopline, const std::string &stop_prefix) {
+    while(true) {
+        std::unique_lock<std::mutex> lock(this->mtx);
+        while(this->work.empty() && !this->reader_done && !this->stop) {
+            this->cv_work.wait(lock);
+        }
+        if(this->work.empty() || this->stop) {
+            return;
+        }
+        const unsigned int s = this->work.front();
+        this->work.pop_front();
+        lock.unlock();
+
+        Slot &slot = this->slots[s];
+        if(convert) {
+            // every value takes at least a digit and a separator
+            slot.values.resize(slot.length / 2 + 1);
+        }
+
+        const char* begin = &slot.text[0];
+        const char* end = begin + slot.length;
+        const char* p = begin;
+        size_t count = 0;
+        while(p < end) {
+            const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+            const char* eol = (nl != NULL) ? nl : end;
+            const size_t len = eol - p;
+
+            if((!stopline.empty() && len == stopline.size() && memcmp(p, stopline.data(), len) == 0) ||
+               (!stop_prefix.empty() && len >= stop_prefix.size() &&
+                memcmp(p, stop_prefix.data(), stop_prefix.size()) == 0)) {
+                slot.stop_at = p - begin;
+                break;
+            }
+
+            if(convert) {
+                const char* q = p;
+                count += FloatParser::parse_range(q, eol, &slot.values[count], slot.values.size() - count);
+            } else {
+                count += FloatParser::count_tokens(p, eol);
+            }
+            p = (nl != NULL) ? nl + 1 : end;
+        }
+        slot.count = count;
+
+        lock.lock();
+        slot.parsed = true;
+        this->cv_parsed.notify_all();
+    }
+}
+
+/*
+ * size_t line_end(slot, n, convert)
+ *
+ * Offset in the slot directly behind the line that holds value n
+ *
+ */
+size_t StreamPipeline::line_end(const Slot &slot, size_t n, bool convert) const {
+    const char* begin = &slot.text[0];
+    const char* end = begin + slot.length;
+    const char* p = begin;
+    float val;
+    while(n > 0 && p < end) {
+        const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+        const char* eol = (nl != NULL) ? nl : end;
+        if(convert) {
+            const char* q = p;
+            while(n > 0 && FloatParser::parse(q, eol, &val)) {
+                n--;
+            }
+        } else {
+            n -= std::min(n, FloatParser::count_tokens(p, eol));
+        }
+        p = (nl != NULL) ? nl + 1 : end;
+    }
+    return p - begin;
+}
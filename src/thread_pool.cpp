@@ -0,0 +1,224 @@
+/**************************************************************************
+ *   thread_pool.cpp                                                      *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <stdint.h>
+
+/*
+ * ThreadPool(nthreads)
+ *
+ * Start a pool that runs loops on nthreads threads, the thread that calls
+ * parallel_for() being one of them. A value of zero selects all available
+ * cores.
+ *
+ */
+ThreadPool::ThreadPool(unsigned int _nthreads) :
+    body(NULL),
+    grain(1),
+    generation(0),
+    busy(0),
+    stop(false) {
+    if(_nthreads == 0) {
+        _nthreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    this->nthreads = _nthreads;
+    this->shares = new Share[this->nthreads];
+    for(unsigned int t=0; t<this->nthreads; t++) {
+        this->shares[t].begin = 0;
+        this->shares[t].end = 0;
+    }
+    for(unsigned int t=0; t+1<this->nthreads; t++) {
+        this->workers.push_back(std::thread(&ThreadPool::run_worker, this, t));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->stop = true;
+    }
+    this->cv_start.notify_all();
+    for(unsigned int t=0; t<this->workers.size(); t++) {
+        this->workers[t].join();
+    }
+    delete[] this->shares;
+}
+
+/*
+ * void parallel_for(n, grain, body)
+ *
+ * Call body(begin, end) for consecutive chunks of at most grain of the
+ * items 0..n-1 on all threads of the pool and return when every item has
+ * been processed. Calls from several threads are run one after the other.
+ *
+ */
+void ThreadPool::parallel_for(unsigned int n, unsigned int _grain, const Body &_body) {
+    if(n == 0) {
+        return;
+    }
+    if(this->nthreads == 1) {
+        _body(0, n);
+        return;
+    }
+
+    std::lock_guard<std::mutex> run_lock(this->run_mtx);
+    for(unsigned int t=0; t<this->nthreads; t++) {
+        std::lock_guard<std::mutex> lock(this->shares[t].mtx);
+        this->shares[t].begin = unsigned(uint64_t(n) * t / this->nthreads);
+        this->shares[t].end = unsigned(uint64_t(n) * (t + 1) / this->nthreads);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->body = &_body;
+        this->grain = std::max(1u, _grain);
+        this->busy = this->nthreads - 1;
+        this->generation++;
+    }
+    this->cv_start.notify_all();
+
+    this->run_share(this->nthreads - 1);
+
+    std::unique_lock<std::mutex> lock(this->mtx);
+    this->cv_done.wait(lock, [this]{ return this->busy == 0; });
+    this->body = NULL;
+}
+
+/*
+ * unsigned int get_threads()
+ *
+ * Number of threads that run a loop, the calling thread included
+ *
+ */
+unsigned int ThreadPool::get_threads() const {
+    return this->nthreads;
+}
+
+/*
+ * void run_worker(id)
+ *
+ * Wait for loops and work on them until the pool is destroyed
+ *
+ */
+void ThreadPool::run_worker(unsigned int id) {
+    unsigned long seen = 0;
+    while(true) {
+        {
+            std::unique_lock<std::mutex> lock(this->mtx);
+            this->cv_start.wait(lock, [this, seen]{ return this->stop || this->generation != seen; });
+            if(this->stop) {
+                return;
+            }
+            seen = this->generation;
+        }
+
+        this->run_share(id);
+
+        std::lock_guard<std::mutex> lock(this->mtx);
+        if(--this->busy == 0) {
+            this->cv_done.notify_one();
+        }
+    }
+}
+
+/*
+ * void run_share(id)
+ *
+ * Process the share of thread id and then whatever can be stolen
+ *
+ */
+void ThreadPool::run_share(unsigned int id) {
+    unsigned int begin, end;
+    do {
+        while(this->take(id, &begin, &end)) {
+            (*this->body)(begin, end);
+        }
+    } while(this->steal(id));
+}
+
+/*
+ * bool take(id, begin, end)
+ *
+ * Take the next chunk from the front of the share of thread id
+ *
+ */
+bool ThreadPool::take(unsigned int id, unsigned int* begin, unsigned int* end) {
+    Share &s = this->shares[id];
+    std::lock_guard<std::mutex> lock(s.mtx);
+    if(s.begin >= s.end) {
+        return false;
+    }
+    *begin = s.begin;
+    *end = std::min(s.end, s.begin + this->grain);
+    s.begin = *end;
+    return true;
+}
+
+/*
+ * bool steal(id)
+ *
+ * Move the back half of the largest share of another thread (all of it
+ * when that is a single chunk) into the empty share of thread id
+ *
+ */
+bool ThreadPool::steal(unsigned int id) {
+    while(true) {
+        // find the largest share; it may shrink before it is locked again
+        // below, in which case the search is repeated
+        unsigned int victim = id;
+        unsigned int most = 0;
+        for(unsigned int t=0; t<this->nthreads; t++) {
+            if(t == id) {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(this->shares[t].mtx);
+            const unsigned int left = this->shares[t].end - std::min(this->shares[t].begin, this->shares[t].end);
+            if(left > most) {
+                most = left;
+                victim = t;
+            }
+        }
+        if(most == 0) {
+            return false;
+        }
+
+        unsigned int begin, end;
+        {
+            Share &v = this->shares[victim];
+            std::lock_guard<std::mutex> lock(v.mtx);
+            if(v.begin >= v.end) {
+                continue;
+            }
+            const unsigned int left = v.end - v.begin;
+            begin = (left <= this->grain) ? v.begin : v.end - left / 2;
+            end = v.end;
+            v.end = begin;
+        }
+
+        Share &s = this->shares[id];
+        std::lock_guard<std::mutex> lock(s.mtx);
+        s.begin = begin;
+        s.end = end;
+        return true;
+    }
+}
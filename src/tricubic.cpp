@@ -0,0 +1,453 @@
+/**************************************************************************
+ *   tricubic.cpp                                                         *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#include "tricubic.h"
+#include "trilinear.h"
+
+#include <algorithm>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TRICUBIC_X86
+#include <immintrin.h>
+#endif
+
+// pole of the cubic B-spline prefilter and the number of terms after
+// which its powers drop below single precision
+static const double pole = -0.2679491924311228; // sqrt(3) - 2
+static const unsigned int horizon = 13;
+
+/*
+ * void prefilter(grid, dims, periodic, pool)
+ *
+ * Replace the values of a k-major grid by its B-spline coefficients,
+ * in place. Along an axis the grid either repeats (periodic) or is
+ * mirrored at its first and last point. Rows, slabs and columns are
+ * filtered in parallel on the threads of the pool, or on the calling
+ * thread when there is none.
+ *
+ */
+void Tricubic::prefilter(float* grid, const unsigned int dims[3], const bool periodic[3], ThreadPool* pool) {
+    const unsigned int nx = dims[0];
+    const unsigned int ny = dims[1];
+    const unsigned int nz = dims[2];
+    const size_t slab = size_t(nx) * ny;
+    const auto parallel_for = [pool](unsigned int n, unsigned int grain, const ThreadPool::Body &body) {
+        if(pool != NULL) {
+            pool->parallel_for(n, grain, body);
+        } else {
+            body(0, n);
+        }
+    };
+
+    // along x every row on its own
+    parallel_for(ny * nz, 64, [&](unsigned int begin, unsigned int end) {
+        for(unsigned int r=begin; r<end; r++) {
+            filter_lines(grid + size_t(r) * nx, nx, 1, 1, periodic[0]);
+        }
+    });
+
+    // along y all columns of a slab at once
+    parallel_for(nz, 1, [&](unsigned int begin, unsigned int end) {
+        for(unsigned int k=begin; k<end; k++) {
+            filter_lines(grid + k * slab, ny, nx, nx, periodic[1]);
+        }
+    });
+
+    // along z blocks of columns that run through all slabs
+    const unsigned int block = 512;
+    const unsigned int blocks = unsigned((slab + block - 1) / block);
+    parallel_for(blocks, 1, [&](unsigned int begin, unsigned int end) {
+        for(unsigned int b=begin; b<end; b++) {
+            const size_t first = size_t(b) * block;
+            const unsigned int width = unsigned(std::min(slab - first, size_t(block)));
+            filter_lines(grid + first, nz, slab, width, periodic[2]);
+        }
+    });
+}
+
+/*
+ * void filter_lines(line, n, stride, width, periodic)
+ *
+ * Prefilter width adjacent lines of n points each; point k of line w is
+ * line[k * stride + w]. The initial values of both recursions follow from
+ * the boundary condition, as sums over the first (or last) points that
+ * are cut off once the powers of the pole become negligible.
+ *
+ */
+void Tricubic::filter_lines(float* line, unsigned int n, size_t stride, unsigned int width, bool periodic) {
+    if(n < 2) {
+        return;
+    }
+
+    const float z = float(pole);
+    const float gain = float((1.0 - pole) * (1.0 - 1.0 / pole));
+    const unsigned int terms = std::min(n, horizon);
+    std::vector<double> sum(width);
+
+    // initial value of the causal recursion
+    if(periodic) {
+        const double scale = 1.0 / (1.0 - pow(pole, double(n)));
+        double zk = 1.0;
+        std::fill(sum.begin(), sum.end(), 0.0);
+        for(unsigned int k=0; k<terms; k++) {
+            const float* p = line + ((n - k) % n) * stride;
+            for(unsigned int w=0; w<width; w++) {
+                sum[w] += zk * p[w];
+            }
+            zk *= pole;
+        }
+        for(unsigned int w=0; w<width; w++) {
+            line[w] = float(gain * sum[w] * scale);
+        }
+    } else if(n > horizon) {
+        double zk = 1.0;
+        std::fill(sum.begin(), sum.end(), 0.0);
+        for(unsigned int k=0; k<terms; k++) {
+            const float* p = line + k * stride;
+            for(unsigned int w=0; w<width; w++) {
+                sum[w] += zk * p[w];
+            }
+            zk *= pole;
+        }
+        for(unsigned int w=0; w<width; w++) {
+            line[w] = float(gain * sum[w]);
+        }
+    } else {
+        // short line: exact sum over the mirrored line
+        const double iz = 1.0 / pole;
+        double zn = pole;
+        double z2n = pow(pole, double(n - 1));
+        const float* last = line + (n - 1) * stride;
+        for(unsigned int w=0; w<width; w++) {
+            sum[w] = line[w] + z2n * last[w];
+        }
+        z2n *= z2n * iz;
+        for(unsigned int k=1; k+1<n; k++) {
+            const float* p = line + k * stride;
+            for(unsigned int w=0; w<width; w++) {
+                sum[w] += (zn + z2n) * p[w];
+            }
+            zn *= pole;
+            z2n *= iz;
+        }
+        for(unsigned int w=0; w<width; w++) {
+            line[w] = float(gain * sum[w] / (1.0 - zn * zn));
+        }
+    }
+
+    // causal recursion
+    for(unsigned int k=1; k<n; k++) {
+        float* p = line + k * stride;
+        const float* q = p - stride;
+        for(unsigned int w=0; w<width; w++) {
+            p[w] = gain * p[w] + z * q[w];
+        }
+    }
+
+    // initial value of the anti-causal recursion
+    float* last = line + (n - 1) * stride;
+    if(periodic) {
+        const double scale = -pole / (1.0 - pow(pole, double(n)));
+        double zk = 1.0;
+        std::fill(sum.begin(), sum.end(), 0.0);
+        for(unsigned int k=0; k<terms; k++) {
+            const float* p = line + ((n - 1 + k) % n) * stride;
+            for(unsigned int w=0; w<width; w++) {
+                sum[w] += zk * p[w];
+            }
+            zk *= pole;
+        }
+        for(unsigned int w=0; w<width; w++) {
+            last[w] = float(scale * sum[w]);
+        }
+    } else {
+        const double scale = pole / (pole * pole - 1.0);
+        const float* prev = last - stride;
+        for(unsigned int w=0; w<width; w++) {
+            last[w] = float(scale * (last[w] + pole * prev[w]));
+        }
+    }
+
+    // anti-causal recursion
+    for(unsigned int k=n-1; k-->0;) {
+        float* p = line + k * stride;
+        const float* q = p + stride;
+        for(unsigned int w=0; w<width; w++) {
+            p[w] = z * (q[w] - p[w]);
+        }
+    }
+}
+
+/*
+ * void interpolate(grid, p, n, out)
+ *
+ * Interpolate the coefficient grid at the n points p into out with the
+ * kernel Trilinear has picked
+ *
+ */
+void Tricubic::interpolate(const float* grid, const Points &p, size_t n, float* out) {
+    switch(Trilinear::get_kernel()) {
+        case Trilinear::KERNEL_AVX512:
+            interpolate_avx512(grid, p, n, out);
+            break;
+        case Trilinear::KERNEL_AVX2:
+            interpolate_avx2(grid, p, n, out);
+            break;
+        default:
+            interpolate_scalar(grid, p, 0, n, out);
+            break;
+    }
+}
+
+/*
+ * void interpolate_points(grid, p, begin, end, out) and
+ * void blend_coefficients(c, fx, fy, fz, n, out)
+ *
+ * The loops of the scalar code, inlined into the plain functions as well
+ * as into their clones for the FMA instructions
+ *
+ */
+__attribute__((always_inline))
+static inline void interpolate_points(const float* grid, const Tricubic::Points &p, size_t begin, size_t end,
+                                      float* out) {
+    for(size_t i=begin; i<end; i++) {
+        const float* g = grid + p.base[i];
+        float c[64];
+        for(unsigned int k=0; k<4; k++) {
+            for(unsigned int j=0; j<4; j++) {
+                const float* r = g + p.oy[j][i] + p.oz[k][i];
+                for(unsigned int a=0; a<4; a++) {
+                    c[16 * k + 4 * j + a] = r[p.ox[a][i]];
+                }
+            }
+        }
+        float wx[4], wy[4], wz[4];
+        Tricubic::weights(p.fx[i], wx);
+        Tricubic::weights(p.fy[i], wy);
+        Tricubic::weights(p.fz[i], wz);
+        out[i] = Tricubic::blend(c, wx, wy, wz);
+    }
+}
+
+__attribute__((always_inline))
+static inline void blend_coefficients(const float* c, const float* fx, const float* fy, const float* fz,
+                                      size_t n, float* out) {
+    for(size_t i=0; i<n; i++) {
+        float wx[4], wy[4], wz[4];
+        Tricubic::weights(fx[i], wx);
+        Tricubic::weights(fy[i], wy);
+        Tricubic::weights(fz[i], wz);
+        out[i] = Tricubic::blend(c + 64 * i, wx, wy, wz);
+    }
+}
+
+/*
+ * void interpolate_scalar(grid, p, begin, end, out)
+ *
+ * Reference kernel, also used for the points the vector kernels leave
+ *
+ */
+void Tricubic::interpolate_scalar(const float* grid, const Points &p, size_t begin, size_t end, float* out) {
+    if(Trilinear::has_fma()) {
+        interpolate_scalar_fma(grid, p, begin, end, out);
+        return;
+    }
+    interpolate_points(grid, p, begin, end, out);
+}
+
+/*
+ * void blend_points(c, fx, fy, fz, n, out)
+ *
+ * Blend the coefficients of n points, 64 per point in c (see blend()), at
+ * their fractional positions, for grids that are not gathered from a float
+ * array (i.e. compact storage)
+ *
+ */
+void Tricubic::blend_points(const float* c, const float* fx, const float* fy, const float* fz,
+                            size_t n, float* out) {
+    if(Trilinear::has_fma()) {
+        blend_points_fma(c, fx, fy, fz, n, out);
+        return;
+    }
+    blend_coefficients(c, fx, fy, fz, n, out);
+}
+
+#ifdef TRICUBIC_X86
+
+/*
+ * void interpolate_scalar_fma(grid, p, begin, end, out) and
+ * void blend_points_fma(c, fx, fy, fz, n, out)
+ *
+ * The scalar code with std::fma() on the FMA instructions
+ *
+ */
+__attribute__((target("fma")))
+void Tricubic::interpolate_scalar_fma(const float* grid, const Points &p, size_t begin, size_t end, float* out) {
+    interpolate_points(grid, p, begin, end, out);
+}
+
+__attribute__((target("fma")))
+void Tricubic::blend_points_fma(const float* c, const float* fx, const float* fy, const float* fz,
+                                size_t n, float* out) {
+    blend_coefficients(c, fx, fy, fz, n, out);
+}
+
+/*
+ * void weights8(f, w) and weights16(f, w)
+ *
+ * The tap weights of weights() for eight and sixteen points
+ *
+ */
+__attribute__((target("avx2,fma")))
+static inline void weights8(__m256 f, __m256 w[4]) {
+    const __m256 t = _mm256_sub_ps(_mm256_set1_ps(1.0f), f);
+    const __m256 f2 = _mm256_mul_ps(f, f);
+    const __m256 sixth = _mm256_set1_ps(1.0f / 6.0f);
+    w[0] = _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(t, t), t), sixth);
+    w[1] = _mm256_fmadd_ps(f2, _mm256_fmadd_ps(_mm256_set1_ps(0.5f), f, _mm256_set1_ps(-1.0f)),
+                           _mm256_set1_ps(2.0f / 3.0f));
+    w[3] = _mm256_mul_ps(_mm256_mul_ps(f2, f), sixth);
+    w[2] = _mm256_sub_ps(_mm256_sub_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), w[0]), w[1]), w[3]);
+}
+
+__attribute__((target("avx512f")))
+static inline void weights16(__m512 f, __m512 w[4]) {
+    const __m512 t = _mm512_sub_ps(_mm512_set1_ps(1.0f), f);
+    const __m512 f2 = _mm512_mul_ps(f, f);
+    const __m512 sixth = _mm512_set1_ps(1.0f / 6.0f);
+    w[0] = _mm512_mul_ps(_mm512_mul_ps(_mm512_mul_ps(t, t), t), sixth);
+    w[1] = _mm512_fmadd_ps(f2, _mm512_fmadd_ps(_mm512_set1_ps(0.5f), f, _mm512_set1_ps(-1.0f)),
+                           _mm512_set1_ps(2.0f / 3.0f));
+    w[3] = _mm512_mul_ps(_mm512_mul_ps(f2, f), sixth);
+    w[2] = _mm512_sub_ps(_mm512_sub_ps(_mm512_sub_ps(_mm512_set1_ps(1.0f), w[0]), w[1]), w[3]);
+}
+
+/*
+ * __m512 gather16(grid, idx)
+ *
+ * Gather sixteen values; the masked form avoids reading an undefined
+ * source register
+ *
+ */
+__attribute__((target("avx512f")))
+static inline __m512 gather16(const float* grid, __m512i idx) {
+    return _mm512_mask_i32gather_ps(_mm512_setzero_ps(), 0xFFFF, idx, grid, 4);
+}
+
+/*
+ * void interpolate_avx2(grid, p, n, out)
+ *
+ * Eight points per iteration
+ *
+ */
+__attribute__((target("avx2,fma")))
+void Tricubic::interpolate_avx2(const float* grid, const Points &p, size_t n, float* out) {
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p.base + i));
+        __m256i ox[4];
+        for(unsigned int a=0; a<4; a++) {
+            ox[a] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p.ox[a] + i));
+        }
+        __m256 wx[4], wy[4], wz[4];
+        weights8(_mm256_loadu_ps(p.fx + i), wx);
+        weights8(_mm256_loadu_ps(p.fy + i), wy);
+        weights8(_mm256_loadu_ps(p.fz + i), wz);
+
+        __m256 sum = _mm256_setzero_ps();
+        for(unsigned int k=0; k<4; k++) {
+            const __m256i bz = _mm256_add_epi32(b, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p.oz[k] + i)));
+            __m256 plane = _mm256_setzero_ps();
+            for(unsigned int j=0; j<4; j++) {
+                const __m256i r = _mm256_add_epi32(bz, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p.oy[j] + i)));
+                __m256 row = _mm256_mul_ps(wx[0], _mm256_i32gather_ps(grid, _mm256_add_epi32(r, ox[0]), 4));
+                row = _mm256_fmadd_ps(wx[1], _mm256_i32gather_ps(grid, _mm256_add_epi32(r, ox[1]), 4), row);
+                row = _mm256_fmadd_ps(wx[2], _mm256_i32gather_ps(grid, _mm256_add_epi32(r, ox[2]), 4), row);
+                row = _mm256_fmadd_ps(wx[3], _mm256_i32gather_ps(grid, _mm256_add_epi32(r, ox[3]), 4), row);
+                plane = (j == 0) ? _mm256_mul_ps(wy[0], row) : _mm256_fmadd_ps(wy[j], row, plane);
+            }
+            sum = (k == 0) ? _mm256_mul_ps(wz[0], plane) : _mm256_fmadd_ps(wz[k], plane, sum);
+        }
+        _mm256_storeu_ps(out + i, sum);
+    }
+    interpolate_scalar(grid, p, i, n, out);
+}
+
+/*
+ * void interpolate_avx512(grid, p, n, out)
+ *
+ * Sixteen points per iteration
+ *
+ */
+__attribute__((target("avx512f")))
+void Tricubic::interpolate_avx512(const float* grid, const Points &p, size_t n, float* out) {
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        const __m512i b = _mm512_loadu_si512(p.base + i);
+        __m512i ox[4];
+        for(unsigned int a=0; a<4; a++) {
+            ox[a] = _mm512_loadu_si512(p.ox[a] + i);
+        }
+        __m512 wx[4], wy[4], wz[4];
+        weights16(_mm512_loadu_ps(p.fx + i), wx);
+        weights16(_mm512_loadu_ps(p.fy + i), wy);
+        weights16(_mm512_loadu_ps(p.fz + i), wz);
+
+        __m512 sum = _mm512_setzero_ps();
+        for(unsigned int k=0; k<4; k++) {
+            const __m512i bz = _mm512_add_epi32(b, _mm512_loadu_si512(p.oz[k] + i));
+            __m512 plane = _mm512_setzero_ps();
+            for(unsigned int j=0; j<4; j++) {
+                const __m512i r = _mm512_add_epi32(bz, _mm512_loadu_si512(p.oy[j] + i));
+                __m512 row = _mm512_mul_ps(wx[0], gather16(grid, _mm512_add_epi32(r, ox[0])));
+                row = _mm512_fmadd_ps(wx[1], gather16(grid, _mm512_add_epi32(r, ox[1])), row);
+                row = _mm512_fmadd_ps(wx[2], gather16(grid, _mm512_add_epi32(r, ox[2])), row);
+                row = _mm512_fmadd_ps(wx[3], gather16(grid, _mm512_add_epi32(r, ox[3])), row);
+                plane = (j == 0) ? _mm512_mul_ps(wy[0], row) : _mm512_fmadd_ps(wy[j], row, plane);
+            }
+            sum = (k == 0) ? _mm512_mul_ps(wz[0], plane) : _mm512_fmadd_ps(wz[k], plane, sum);
+        }
+        _mm512_storeu_ps(out + i, sum);
+    }
+    interpolate_scalar(grid, p, i, n, out);
+}
+
+#else
+
+void Tricubic::interpolate_scalar_fma(const float* grid, const Points &p, size_t begin, size_t end, float* out) {
+    interpolate_points(grid, p, begin, end, out);
+}
+
+void Tricubic::blend_points_fma(const float* c, const float* fx, const float* fy, const float* fz,
+                                size_t n, float* out) {
+    blend_coefficients(c, fx, fy, fz, n, out);
+}
+
+void Tricubic::interpolate_avx2(const float* grid, const Points &p, size_t n, float* out) {
+    interpolate_scalar(grid, p, 0, n, out);
+}
+
+void Tricubic::interpolate_avx512(const float* grid, const Points &p, size_t n, float* out) {
+    interpolate_scalar(grid, p, 0, n, out);
+}
+
+#endif
@@ -0,0 +1,346 @@
+/**************************************************************************
+ *   trilinear.cpp                                                        *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#include "trilinear.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TRILINEAR_X86
+#include <immintrin.h>
+#endif
+
+Trilinear::Kernel Trilinear::kernel = Trilinear::select();
+bool Trilinear::fma = Trilinear::detect_fma();
+
+/*
+ * void interpolate_points(grid, p, begin, end, out) and
+ * void blend_corners(c, fx, fy, fz, n, out)
+ *
+ * The loops of the scalar code, inlined into the plain functions as well
+ * as into their clones for the FMA instructions
+ *
+ */
+__attribute__((always_inline))
+static inline void interpolate_points(const float* grid, const Trilinear::Points &p, size_t begin, size_t end,
+                                      float* out) {
+    for(size_t i=begin; i<end; i++) {
+        const float* g = grid + p.base[i];
+        const int32_t ox = p.ox[i];
+        const int32_t oy = p.oy[i];
+        const int32_t oz = p.oz[i];
+        const float c[8] = {
+            g[0],       g[ox],
+            g[oy],      g[ox + oy],
+            g[oz],      g[ox + oz],
+            g[oy + oz], g[ox + oy + oz]
+        };
+        out[i] = Trilinear::blend(c, p.fx[i], p.fy[i], p.fz[i]);
+    }
+}
+
+__attribute__((always_inline))
+static inline void blend_corners(const float* c, const float* fx, const float* fy, const float* fz,
+                                 size_t n, float* out) {
+    for(size_t i=0; i<n; i++) {
+        out[i] = Trilinear::blend(c + 8 * i, fx[i], fy[i], fz[i]);
+    }
+}
+
+/*
+ * void interpolate(grid, p, n, out)
+ *
+ * Interpolate the grid at the n points p into out with the fastest kernel
+ * the processor supports
+ *
+ */
+void Trilinear::interpolate(const float* grid, const Points &p, size_t n, float* out) {
+    switch(kernel) {
+        case KERNEL_AVX512:
+            interpolate_avx512(grid, p, n, out);
+            break;
+        case KERNEL_AVX2:
+            interpolate_avx2(grid, p, n, out);
+            break;
+        default:
+            interpolate_scalar(grid, p, 0, n, out);
+            break;
+    }
+}
+
+Trilinear::Kernel Trilinear::get_kernel() {
+    return kernel;
+}
+
+/*
+ * bool has_fma()
+ *
+ * Whether the scalar code runs on the FMA instructions rather than on
+ * calls of fmaf() in libm
+ *
+ */
+bool Trilinear::has_fma() {
+    return fma;
+}
+
+/*
+ * bool detect_fma()
+ *
+ * Whether the processor has the FMA instructions
+ *
+ */
+bool Trilinear::detect_fma() {
+#ifdef TRILINEAR_X86
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("fma");
+#else
+    return false;
+#endif
+}
+
+/*
+ * bool set_kernel(kernel)
+ *
+ * Force a particular kernel (i.e. for benchmarking); fails when the
+ * processor does not support it
+ *
+ */
+bool Trilinear::set_kernel(Kernel _kernel) {
+    if(!is_supported(_kernel)) {
+        return false;
+    }
+    kernel = _kernel;
+    return true;
+}
+
+/*
+ * bool is_supported(kernel)
+ *
+ * Whether the processor (and the operating system) support a kernel
+ *
+ */
+bool Trilinear::is_supported(Kernel _kernel) {
+#ifdef TRILINEAR_X86
+    __builtin_cpu_init();
+    switch(_kernel) {
+        case KERNEL_AVX512:
+            return __builtin_cpu_supports("avx512f");
+        case KERNEL_AVX2:
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        default:
+            return true;
+    }
+#else
+    return _kernel == KERNEL_SCALAR;
+#endif
+}
+
+const char* Trilinear::get_name(Kernel _kernel) {
+    switch(_kernel) {
+        case KERNEL_AVX512:
+            return "avx512";
+        case KERNEL_AVX2:
+            return "avx2";
+        default:
+            return "scalar";
+    }
+}
+
+/*
+ * Kernel select()
+ *
+ * The widest kernel the processor supports
+ *
+ */
+Trilinear::Kernel Trilinear::select() {
+    if(is_supported(KERNEL_AVX512)) {
+        return KERNEL_AVX512;
+    }
+    if(is_supported(KERNEL_AVX2)) {
+        return KERNEL_AVX2;
+    }
+    return KERNEL_SCALAR;
+}
+
+/*
+ * void interpolate_scalar(grid, p, begin, end, out)
+ *
+ * Reference kernel, also used for the points the vector kernels leave
+ *
+ */
+void Trilinear::interpolate_scalar(const float* grid, const Points &p, size_t begin, size_t end, float* out) {
+    if(fma) {
+        interpolate_scalar_fma(grid, p, begin, end, out);
+        return;
+    }
+    interpolate_points(grid, p, begin, end, out);
+}
+
+/*
+ * void blend_points(c, fx, fy, fz, n, out)
+ *
+ * Blend the corners of n points, eight per point in c, for grids that are
+ * not gathered from a float array (i.e. compact storage)
+ *
+ */
+void Trilinear::blend_points(const float* c, const float* fx, const float* fy, const float* fz,
+                             size_t n, float* out) {
+    if(fma) {
+        blend_points_fma(c, fx, fy, fz, n, out);
+        return;
+    }
+    blend_corners(c, fx, fy, fz, n, out);
+}
+
+#ifdef TRILINEAR_X86
+
+/*
+ * void interpolate_scalar_fma(grid, p, begin, end, out) and
+ * void blend_points_fma(c, fx, fy, fz, n, out)
+ *
+ * The scalar code with std::fma() on the FMA instructions
+ *
+ */
+__attribute__((target("fma")))
+void Trilinear::interpolate_scalar_fma(const float* grid, const Points &p, size_t begin, size_t end, float* out) {
+    interpolate_points(grid, p, begin, end, out);
+}
+
+__attribute__((target("fma")))
+void Trilinear::blend_points_fma(const float* c, const float* fx, const float* fy, const float* fz,
+                                 size_t n, float* out) {
+    blend_corners(c, fx, fy, fz, n, out);
+}
+
+/*
+ * void interpolate_avx2(grid, p, n, out)
+ *
+ * Eight points per iteration
+ *
+ */
+__attribute__((target("avx2,fma")))
+void Trilinear::interpolate_avx2(const float* grid, const Points &p, size_t n, float* out) {
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p.base + i));
+        const __m256i ox = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p.ox + i));
+        const __m256i oy = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p.oy + i));
+        const __m256i oz = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p.oz + i));
+        const __m256 fx = _mm256_loadu_ps(p.fx + i);
+        const __m256 fy = _mm256_loadu_ps(p.fy + i);
+        const __m256 fz = _mm256_loadu_ps(p.fz + i);
+
+        const __m256i by = _mm256_add_epi32(b, oy);
+        const __m256i bz = _mm256_add_epi32(b, oz);
+        const __m256i byz = _mm256_add_epi32(by, oz);
+
+        const __m256 c000 = _mm256_i32gather_ps(grid, b, 4);
+        const __m256 c100 = _mm256_i32gather_ps(grid, _mm256_add_epi32(b, ox), 4);
+        const __m256 c010 = _mm256_i32gather_ps(grid, by, 4);
+        const __m256 c110 = _mm256_i32gather_ps(grid, _mm256_add_epi32(by, ox), 4);
+        const __m256 c001 = _mm256_i32gather_ps(grid, bz, 4);
+        const __m256 c101 = _mm256_i32gather_ps(grid, _mm256_add_epi32(bz, ox), 4);
+        const __m256 c011 = _mm256_i32gather_ps(grid, byz, 4);
+        const __m256 c111 = _mm256_i32gather_ps(grid, _mm256_add_epi32(byz, ox), 4);
+
+        const __m256 c00 = _mm256_fmadd_ps(fx, _mm256_sub_ps(c100, c000), c000);
+        const __m256 c10 = _mm256_fmadd_ps(fx, _mm256_sub_ps(c110, c010), c010);
+        const __m256 c01 = _mm256_fmadd_ps(fx, _mm256_sub_ps(c101, c001), c001);
+        const __m256 c11 = _mm256_fmadd_ps(fx, _mm256_sub_ps(c111, c011), c011);
+        const __m256 c0 = _mm256_fmadd_ps(fy, _mm256_sub_ps(c10, c00), c00);
+        const __m256 c1 = _mm256_fmadd_ps(fy, _mm256_sub_ps(c11, c01), c01);
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(fz, _mm256_sub_ps(c1, c0), c0));
+    }
+    interpolate_scalar(grid, p, i, n, out);
+}
+
+/*
+ * __m512 gather16(grid, idx)
+ *
+ * Gather sixteen values; the masked form avoids reading an undefined
+ * source register
+ *
+ */
+__attribute__((target("avx512f")))
+static inline __m512 gather16(const float* grid, __m512i idx) {
+    return _mm512_mask_i32gather_ps(_mm512_setzero_ps(), 0xFFFF, idx, grid, 4);
+}
+
+/*
+ * void interpolate_avx512(grid, p, n, out)
+ *
+ * Sixteen points per iteration
+ *
+ */
+__attribute__((target("avx512f")))
+void Trilinear::interpolate_avx512(const float* grid, const Points &p, size_t n, float* out) {
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        const __m512i b = _mm512_loadu_si512(p.base + i);
+        const __m512i ox = _mm512_loadu_si512(p.ox + i);
+        const __m512i oy = _mm512_loadu_si512(p.oy + i);
+        const __m512i oz = _mm512_loadu_si512(p.oz + i);
+        const __m512 fx = _mm512_loadu_ps(p.fx + i);
+        const __m512 fy = _mm512_loadu_ps(p.fy + i);
+        const __m512 fz = _mm512_loadu_ps(p.fz + i);
+
+        const __m512i by = _mm512_add_epi32(b, oy);
+        const __m512i bz = _mm512_add_epi32(b, oz);
+        const __m512i byz = _mm512_add_epi32(by, oz);
+
+        const __m512 c000 = gather16(grid, b);
+        const __m512 c100 = gather16(grid, _mm512_add_epi32(b, ox));
+        const __m512 c010 = gather16(grid, by);
+        const __m512 c110 = gather16(grid, _mm512_add_epi32(by, ox));
+        const __m512 c001 = gather16(grid, bz);
+        const __m512 c101 = gather16(grid, _mm512_add_epi32(bz, ox));
+        const __m512 c011 = gather16(grid, byz);
+        const __m512 c111 = gather16(grid, _mm512_add_epi32(byz, ox));
+
+        const __m512 c00 = _mm512_fmadd_ps(fx, _mm512_sub_ps(c100, c000), c000);
+        const __m512 c10 = _mm512_fmadd_ps(fx, _mm512_sub_ps(c110, c010), c010);
+        const __m512 c01 = _mm512_fmadd_ps(fx, _mm512_sub_ps(c101, c001), c001);
+        const __m512 c11 = _mm512_fmadd_ps(fx, _mm512_sub_ps(c111, c011), c011);
+        const __m512 c0 = _mm512_fmadd_ps(fy, _mm512_sub_ps(c10, c00), c00);
+        const __m512 c1 = _mm512_fmadd_ps(fy, _mm512_sub_ps(c11, c01), c01);
+        _mm512_storeu_ps(out + i, _mm512_fmadd_ps(fz, _mm512_sub_ps(c1, c0), c0));
+    }
+    interpolate_scalar(grid, p, i, n, out);
+}
+
+#else
+
+void Trilinear::interpolate_scalar_fma(const float* grid, const Points &p, size_t begin, size_t end, float* out) {
+    interpolate_points(grid, p, begin, end, out);
+}
+
+void Trilinear::blend_points_fma(const float* c, const float* fx, const float* fy, const float* fz,
+                                 size_t n, float* out) {
+    blend_corners(c, fx, fy, fz, n, out);
+}
+
+void Trilinear::interpolate_avx2(const float* grid, const Points &p, size_t n, float* out) {
+    interpolate_scalar(grid, p, 0, n, out);
+}
+
+void Trilinear::interpolate_avx512(const float* grid, const Points &p, size_t n, float* out) {
+    interpolate_scalar(grid, p, 0, n, out);
+}
+
+#endif
@@ -0,0 +1,203 @@
+/**************************************************************************
+ *   vasp_reader.cpp                                                      *
+ *                                                                        *
+ *   EDP                                                                  *
+ *                                                                        *
+ *   Authors: Ivo Filot                                                   *
+ *            Bart Zijlstra                                               *
+ *            Emiel Hensen                                                *
+ *                                                                        *
+ *   (C) Copyright 2015 Inorganic Materials Chemistry                     *
+ *                                                                        *
+ *   This is a legal licensing agreement (Agreement) between              *
+ *   You (an individual or single legal entity) and                       *
+ *   Inorganic Materials Chemistry (IMC) governing the in-house use       *
+ *   of the EDP software product (Software).                              *
+ *   By downloading, installing, or using Software, You agree to be bound *
+ *   by the license terms as given in the LICENSE file                    *
+ *                                                                        *
+ **************************************************************************/
+
+
+#include "vasp_reader.h"
+
+/*
+ * bool read_header(infile, header, debug)
+ *
+ * Read everything up to and including the grid dimension line. Returns
+ * false when the stream ends before that.
+ *
+ */
+bool VaspReader::read_header(std::istream &infile, GridHeader &header, bool debug) {
+    this->read_scalar(infile, header, debug);
+    this->read_matrix(infile, header, debug);
+    this->read_atoms(infile, header, debug);
+    this->read_grid_dimensions(infile, header, debug);
+    return !infile.fail();
+}
+
+/*
+ * GridLayout get_layout(header)
+ *
+ * A single record per block, ending early at the augmentation
+ * occupancies or at the grid dimension line of a second block
+ *
+ */
+GridLayout VaspReader::get_layout(const GridHeader &header) const {
+    GridLayout layout;
+    layout.record = 0;
+    layout.z_fastest = false;
+    layout.stopline = header.gridline;
+    layout.stop_prefix = "augmentation";
+    layout.spin_blocks = true;
+    return layout;
+}
+
+const char* VaspReader::get_name() const {
+    return "VASP";
+}
+
+/*
+ * void test_vasp5(line, header, debug)
+ *
+ * Test if the input file is a VASP5 output file by checking whether the
+ * sixth line of the file contains atomic information (i.e. alpha-characters)
+ *
+ */
+void VaspReader::test_vasp5(const std::string &line, GridHeader &header, bool debug) {
+    if(debug) std::cout << "Testing VASP version: ";
+    pcrecpp::RE re("^(.*[A-Za-z]+.*)$");
+    std::string ans;
+    if(re.FullMatch(line, &ans)) {
+        header.vasp5_input = true;
+        if(debug) std::cout << "5" << std::endl;
+    } else {
+        if(debug) std::cout << "4" << std::endl;
+    }
+}
+
+/*
+ * void read_scalar(infile, header, debug)
+ *
+ * Read the scalar value from the 2nd line of the
+ * file. Note that all read_* functions consume
+ * the stream and have to be used in consecutive
+ * order as is done in read_header().
+ *
+ */
+void VaspReader::read_scalar(std::istream &infile, GridHeader &header, bool debug) {
+    if(debug) std::cout << "Reading scalar...\t\t\t";
+    std::string line;
+    std::getline(infile, line); // discard this line
+
+    std::getline(infile, line);
+    double val = -1;
+    pcrecpp::RE re("^\\s*([0-9.-]+)\\s*$");
+    re.FullMatch(line , &val);
+    header.scalar = val;
+    if(debug) std::cout << "[Done]" << std::endl;
+}
+
+/*
+ * void read_matrix(infile, header, debug)
+ *
+ * Reads the matrix that defines the unit cell
+ * and scales it by the scalar.
+ *
+ * Note that all read_* functions consume the
+ * stream and have to be used in consecutive
+ * order as is done in read_header().
+ *
+ */
+void VaspReader::read_matrix(std::istream &infile, GridHeader &header, bool debug) {
+    if(debug) std::cout << "Reading unitcell matrix...\t\t";
+    std::string line;
+
+    // setup match pattern
+    pcrecpp::RE re("^\\s*([0-9.-]+)\\s+([0-9.-]+)\\s+([0-9.-]+)\\s*$");
+    for(unsigned int i=0; i<3; i++) {
+        std::getline(infile, line);
+        re.FullMatch(line , &header.mat[i][0], &header.mat[i][1], &header.mat[i][2]);
+    }
+
+    for(unsigned int i=0; i<3; i++) {
+        for(unsigned int j=0; j<3; j++) {
+            header.mat[i][j] *= header.scalar;
+        }
+    }
+
+    if(debug) std::cout << "[Done]" << std::endl;
+}
+
+/*
+ * void read_atoms(infile, header, debug)
+ *
+ * Read the number of atoms of each element. These
+ * numbers are used to skip the required amount of
+ * lines. VASP5 files carry an extra line with the
+ * element names in front of the numbers, which is
+ * detected here as well.
+ *
+ * Note that all read_* functions consume the
+ * stream and have to be used in consecutive
+ * order as is done in read_header().
+ *
+ */
+void VaspReader::read_atoms(std::istream &infile, GridHeader &header, bool debug) {
+    std::string line;
+    std::getline(infile, line);
+    this->test_vasp5(line, header, debug);
+    if(header.vasp5_input) {
+        std::getline(infile, line); // the line with the element names is skipped
+    }
+
+    if(debug) std::cout << "Reading atoms...\t\t\t";
+    int val = 0;
+    pcrecpp::RE re("([0-9]+)");
+    pcrecpp::StringPiece input(line);
+    while(re.FindAndConsume(&input, &val)) {
+        header.nrat.push_back(val);
+    }
+    if(debug) std::cout << "[Done]" << std::endl;
+}
+
+/*
+ * void read_grid_dimensions(infile, header, debug)
+ *
+ * Read the number of gridpoints in each
+ * direction.
+ *
+ * Note that all read_* functions consume the
+ * stream and have to be used in consecutive
+ * order as is done in read_header().
+ *
+ */
+void VaspReader::read_grid_dimensions(std::istream &infile, GridHeader &header, bool debug) {
+    if(debug) std::cout << "Reading grid dimensions...\t\t";
+    std::string line;
+    // skip the coordinate type line, the lines that contain atoms
+    // and the empty line in front of the grid dimensions
+    std::getline(infile, line);
+    for(unsigned int i=0; i<header.nrat.size(); i++) {
+        for(unsigned int j=0; j<header.nrat[i]; j++) {
+            std::getline(infile, line);
+        }
+    }
+    std::getline(infile, line);
+    std::getline(infile, line);
+
+    header.gridline = line;
+
+    pcrecpp::RE re("([0-9]+)");
+    pcrecpp::StringPiece input(line);
+    unsigned int i = 0;
+    unsigned int val = 0;
+    while(i < 3 && re.FindAndConsume(&input, &val)) {
+        header.grid_dimensions[i] = val;
+        i++;
+    }
+    if(debug) std::cout << "[Done]" << std::endl;
+    if(debug) std::cout << "GRID: " << header.grid_dimensions[0] << "x" <<
+                                       header.grid_dimensions[1] << "x" <<
+                                       header.grid_dimensions[2] << std::endl;
+}